@@ -24,6 +24,7 @@
 #include <alsa/asoundlib.h>
 
 #include "alsa.h"
+#include "metrics.h"
 
 
 /* This structure doesn't have corresponding functions to be an
@@ -376,6 +377,7 @@ static int handle(struct device *dv)
         if (r < 0) {
             if (r == -EPIPE) {
                 fputs("ALSA: capture xrun.\n", stderr);
+                metric_inc(&metric_xruns);
 
                 r = snd_pcm_prepare(alsa->capture.pcm);
                 if (r < 0) {
@@ -408,6 +410,7 @@ static int handle(struct device *dv)
         if (r < 0) {
             if (r == -EPIPE) {
                 fputs("ALSA: playback xrun.\n", stderr);
+                metric_inc(&metric_xruns);
 
                 r = snd_pcm_prepare(alsa->playback.pcm);
                 if (r < 0) {
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+#include "decimator.h"
+
+/* Cut off below the output Nyquist frequency, as a proportion of it.
+ * The timecode carrier is far below this, so the transition band can
+ * be wide and the filter short */
+
+#define CUTOFF 0.8
+
+/*
+ * Initialise a low-pass filter which has the given number of taps
+ *
+ * A windowed sinc, using the Blackman window.
+ */
+
+static void init_taps(float *taps, unsigned int ntaps, double fc)
+{
+    unsigned int n;
+    double sum, mid;
+
+    mid = (ntaps - 1) / 2.0;
+    sum = 0.0;
+
+    for (n = 0; n < ntaps; n++) {
+        double t, sinc, window;
+
+        t = n - mid;
+        sinc = (t == 0.0) ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+        window = 0.42 - 0.5 * cos(2 * M_PI * n / (ntaps - 1))
+            + 0.08 * cos(4 * M_PI * n / (ntaps - 1));
+
+        taps[n] = sinc * window;
+        sum += taps[n];
+    }
+
+    /* Unity gain at DC */
+
+    for (n = 0; n < ntaps; n++)
+        taps[n] /= sum;
+}
+
+/*
+ * Initialise a decimator
+ *
+ * Pre: factor is between 1 and DECIMATOR_MAX_FACTOR
+ */
+
+void decimator_init(struct decimator *d, unsigned int factor)
+{
+    assert(factor >= 1 && factor <= DECIMATOR_MAX_FACTOR);
+
+    d->factor = factor;
+    d->phase = 0;
+    d->columns = DECIMATOR_TAPS - 1; /* history of silence */
+
+    init_taps(d->taps, factor * DECIMATOR_TAPS, CUTOFF * 0.5 / factor);
+    memset(d->buf, 0, sizeof d->buf);
+}
+
+/*
+ * Apply the filter to give a run of output samples
+ *
+ * Each tap is applied to a run of consecutive input samples from one
+ * phase. The inner loop has no dependency between iterations, so the
+ * compiler can vectorise it.
+ */
+
+static void convolve(const struct decimator *d,
+                     float buf[DECIMATOR_MAX_FACTOR]
+                              [DECIMATOR_TAPS + DECIMATOR_CHUNK],
+                     float *acc, size_t z)
+{
+    unsigned int q, r;
+    size_t s;
+
+    for (s = 0; s < z; s++)
+        acc[s] = 0.0f;
+
+    for (q = 0; q < DECIMATOR_TAPS; q++) {
+        for (r = 0; r < d->factor; r++) {
+            const float *x;
+            float t;
+
+            t = d->taps[q * d->factor + r];
+            x = &buf[d->factor - 1 - r][DECIMATOR_TAPS - 1 - q];
+
+            for (s = 0; s < z; s++)
+                acc[s] += t * x[s];
+        }
+    }
+}
+
+/*
+ * Return: the given value as a 16-bit sample
+ */
+
+static inline signed short clip(float v)
+{
+    if (v > SHRT_MAX)
+        return SHRT_MAX;
+    if (v < SHRT_MIN)
+        return SHRT_MIN;
+
+    return (signed short)(v < 0.0f ? v - 0.5f : v + 0.5f);
+}
+
+/*
+ * Decimate a block of interleaved stereo audio
+ *
+ * This is a polyphase filter; the filter is evaluated only at the
+ * positions of the output samples.
+ *
+ * Pre: n is no more than DECIMATOR_CHUNK
+ * Pre: out has space for decimator_max_output() samples
+ * Return: the number of samples placed in out
+ */
+
+size_t decimator_run(struct decimator *d, const signed short *pcm, size_t n,
+                     signed short *out)
+{
+    unsigned int c, p, col;
+    size_t s, z;
+    float acc[DECIMATOR_CHUNK + 1];
+
+    assert(n <= DECIMATOR_CHUNK);
+
+    /* Append the new audio to the buffer, split into phases */
+
+    p = d->phase;
+    col = d->columns;
+
+    for (s = 0; s < n; s++) {
+        for (c = 0; c < DECIMATOR_CHANNELS; c++)
+            d->buf[c][p][col] = pcm[s * DECIMATOR_CHANNELS + c];
+
+        if (++p == d->factor) {
+            p = 0;
+            col++;
+        }
+    }
+
+    d->phase = p;
+    d->columns = col;
+
+    z = col - (DECIMATOR_TAPS - 1);
+    assert(z <= decimator_max_output(d));
+
+    for (c = 0; c < DECIMATOR_CHANNELS; c++) {
+        convolve(d, d->buf[c], acc, z);
+
+        for (s = 0; s < z; s++)
+            out[s * DECIMATOR_CHANNELS + c] = clip(acc[s]);
+
+        /* Retain the history, and any incomplete column */
+
+        for (p = 0; p < d->factor; p++) {
+            memmove(d->buf[c][p], d->buf[c][p] + z,
+                    sizeof(float) * DECIMATOR_TAPS);
+        }
+    }
+
+    d->columns -= z;
+
+    return z;
+}
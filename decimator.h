@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Reduce the sample rate of stereo audio by an integer factor
+ */
+
+#ifndef DECIMATOR_H
+#define DECIMATOR_H
+
+#include <stddef.h>
+
+#define DECIMATOR_CHANNELS 2
+
+#define DECIMATOR_MAX_FACTOR 8
+#define DECIMATOR_TAPS 8 /* per unit of decimation factor */
+#define DECIMATOR_MAX_TAPS (DECIMATOR_MAX_FACTOR * DECIMATOR_TAPS)
+#define DECIMATOR_CHUNK 256 /* maximum input samples per call */
+
+/* Input is stored split into its phases; each column is the group of
+ * input samples which contribute to one output sample */
+
+struct decimator {
+    unsigned int factor,
+        phase, /* of the next input sample */
+        columns; /* complete columns in the buffer */
+    float taps[DECIMATOR_MAX_TAPS],
+        buf[DECIMATOR_CHANNELS][DECIMATOR_MAX_FACTOR]
+           [DECIMATOR_TAPS + DECIMATOR_CHUNK];
+};
+
+void decimator_init(struct decimator *d, unsigned int factor);
+size_t decimator_run(struct decimator *d, const signed short *pcm, size_t n,
+                     signed short *out);
+
+/*
+ * Return: the largest number of output samples from one call to
+ * decimator_run()
+ */
+
+static inline size_t decimator_max_output(const struct decimator *d)
+{
+    return DECIMATOR_CHUNK / d->factor + 1;
+}
+
+#endif
@@ -31,10 +31,72 @@
  */
 
 static const struct record no_record = {
+    .pathname = "",
     .artist = "",
     .title = ""
 };
 
+/*
+ * Account for playback which has advanced into the next track
+ */
+
+static void advanced(struct deck *d)
+{
+    struct track *t;
+
+    t = player_take_done(&d->player);
+    if (t == NULL)
+        return;
+
+    track_release(t);
+
+    assert(d->played < d->queue.entries);
+    d->record = index_record(&d->queue, d->played++);
+}
+
+/*
+ * Preload the next record of the play queue, and follow playback
+ * which has advanced into it
+ *
+ * Pre: rig lock is held
+ * Post: if the queue is finished, the deck is no longer handled
+ */
+
+static void handle(struct rig_handler *h)
+{
+    struct deck *d;
+
+    d = container_of(h, struct deck, handler);
+    advanced(d);
+
+    while (d->played < d->queue.entries && !player_has_next(&d->player)) {
+        struct record *re;
+        struct track *t;
+
+        /* Playback may have advanced since it was last checked; with
+         * no next track, the one it replaced is now to be seen */
+
+        advanced(d);
+        if (d->played == d->queue.entries)
+            break;
+
+        re = index_record(&d->queue, d->played);
+        t = track_acquire_by_import(d->importer, re->pathname);
+        if (t != NULL) {
+            player_set_next(&d->player, t); /* passes reference */
+            break;
+        }
+
+        d->played++; /* skip it, the import reported the error */
+    }
+
+    if (d->played == d->queue.entries && !player_has_next(&d->player)) {
+        index_blank(&d->queue);
+        d->played = 0;
+        rig_remove_handler(h);
+    }
+}
+
 /*
  * Initialise a deck
  *
@@ -45,7 +107,8 @@ static const struct record no_record = {
  */
 
 int deck_init(struct deck *d, struct rt *rt,
-              struct timecode_def *timecode, const char *importer,
+              struct timecode_def *timecode, bool autodetect,
+              const char *importer,
               double speed, bool phono, bool protect)
 {
     unsigned int rate;
@@ -62,8 +125,13 @@ int deck_init(struct deck *d, struct rt *rt,
     rate = device_sample_rate(&d->device);
     assert(timecode != NULL);
     timecoder_init(&d->timecoder, timecode, speed, rate, phono);
+    timecoder_set_autodetect(&d->timecoder, autodetect);
     player_init(&d->player, rate, track_acquire_empty(), &d->timecoder);
     cues_reset(&d->cues);
+    index_init(&d->queue);
+    d->played = 0;
+    list_init(&d->handler.rig);
+    d->handler.handle = handle;
 
     /* The timecoder and player are driven by requests from
      * the audio device */
@@ -78,6 +146,7 @@ void deck_clear(struct deck *d)
 {
     /* FIXME: remove from rig and rt */
     player_clear(&d->player);
+    index_clear(&d->queue);
     timecoder_clear(&d->timecoder);
     device_clear(&d->device);
 }
@@ -87,6 +156,31 @@ bool deck_is_locked(const struct deck *d)
     return (d->protect && player_is_active(&d->player));
 }
 
+/*
+ * Switch any of the given decks which has detected a different
+ * timecode, with a message to the user
+ *
+ * This builds lookup tables, so it can't be done in the realtime
+ * thread where the timecode is detected.
+ *
+ * Pre: rig lock is held
+ */
+
+void deck_commit_detected(struct deck d[], size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        struct timecode_def *def;
+
+        def = timecoder_commit_detected(&d[i].timecoder);
+        if (def != NULL) {
+            status_printf(STATUS_INFO, "Deck %zu detected timecode %s",
+                          i + 1, def->desc);
+        }
+    }
+}
+
 /*
  * Load a record from the library to a deck
  */
@@ -187,3 +281,72 @@ void deck_punch_out(struct deck *d)
     player_seek_to(&d->player, e - d->punch);
     d->punch = NO_PUNCH;
 }
+
+/*
+ * Add a record to the end of the play queue
+ *
+ * Playback advances through the queue without a gap when each track
+ * ends, as for an unattended set.
+ *
+ * Return: 0 on success or -1 if memory could not be allocated
+ */
+
+int deck_queue(struct deck *d, struct record *record)
+{
+    if (index_reserve(&d->queue, 1) == -1)
+        return -1;
+
+    index_add(&d->queue, record);
+
+    if (list_empty(&d->handler.rig))
+        rig_post_handler(&d->handler);
+
+    return 0;
+}
+
+/*
+ * Add all the records of an index, such as a crate, in order
+ *
+ * Return: 0 on success or -1 if memory could not be allocated
+ */
+
+int deck_queue_index(struct deck *d, const struct index *i)
+{
+    size_t n;
+
+    if (i->entries == 0)
+        return 0;
+
+    if (index_reserve(&d->queue, i->entries) == -1)
+        return -1;
+
+    for (n = 0; n < i->entries; n++)
+        index_add(&d->queue, index_record(i, n));
+
+    if (list_empty(&d->handler.rig))
+        rig_post_handler(&d->handler);
+
+    return 0;
+}
+
+/*
+ * Empty the play queue, including any track already preloaded
+ */
+
+void deck_unqueue(struct deck *d)
+{
+    player_set_next(&d->player, NULL); /* no further advance */
+    advanced(d);
+
+    index_blank(&d->queue);
+    d->played = 0;
+}
+
+/*
+ * Return: the number of records waiting in the play queue
+ */
+
+size_t deck_queued(const struct deck *d)
+{
+    return d->queue.entries - d->played;
+}
@@ -27,6 +27,7 @@
 #include "index.h"
 #include "player.h"
 #include "realtime.h"
+#include "rig.h"
 #include "timecoder.h"
 
 #define NO_PUNCH (HUGE_VAL)
@@ -45,6 +46,13 @@ struct deck {
 
     double punch;
 
+    /* Records to play next; the one at 'played' is preloaded into
+     * the player */
+
+    struct index queue;
+    size_t played;
+    struct rig_handler handler; /* whilst there is a queue */
+
     /* A controller adds itself here */
 
     size_t ncontrol;
@@ -52,11 +60,13 @@ struct deck {
 };
 
 int deck_init(struct deck *deck, struct rt *rt,
-              struct timecode_def *timecode, const char *importer,
+              struct timecode_def *timecode, bool autodetect,
+              const char *importer,
               double speed, bool phono, bool protect);
 void deck_clear(struct deck *deck);
 
 bool deck_is_locked(const struct deck *deck);
+void deck_commit_detected(struct deck d[], size_t n);
 
 void deck_load(struct deck *deck, struct record *record);
 
@@ -67,4 +77,9 @@ void deck_cue(struct deck *deck, unsigned int label);
 void deck_punch_in(struct deck *d, unsigned int label);
 void deck_punch_out(struct deck *d);
 
+int deck_queue(struct deck *d, struct record *record);
+int deck_queue_index(struct deck *d, const struct index *i);
+void deck_unqueue(struct deck *d);
+size_t deck_queued(const struct deck *d);
+
 #endif
@@ -213,7 +213,7 @@ static int read_from_pipe(struct excrate *e)
         if (x == NULL)
             return -1;
         if (x != d) /* our new record is a duplicate */
-            free(d);
+            record_discard(d);
 
         x = listing_add(&e->listing, x);
         if (x == NULL)
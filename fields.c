@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+
+#include "fields.h"
+
+/*
+ * Split a line into fields separated by tabs (destructive)
+ *
+ * Return: true if the line has exactly the given number of fields
+ */
+
+bool fields_split(char *s, char *x[], size_t len)
+{
+    size_t n;
+
+    for (n = 0; n < len; n++) {
+        x[n] = s;
+
+        s = strchr(s, '\t');
+        if (s == NULL)
+            return n + 1 == len;
+
+        *s++ = '\0';
+    }
+
+    return false;
+}
+
+/*
+ * Write a field of free text, escaping any characters which would
+ * break the line; see fields_unescape()
+ */
+
+void fields_escape(FILE *f, const char *s)
+{
+    for (; *s != '\0'; s++) {
+        switch (*s) {
+        case '\\':
+            fputs("\\\\", f);
+            break;
+        case '\t':
+            fputs("\\t", f);
+            break;
+        case '\n':
+            fputs("\\n", f);
+            break;
+        case '\r':
+            fputs("\\r", f);
+            break;
+        default:
+            fputc(*s, f);
+        }
+    }
+}
+
+/*
+ * Reverse fields_escape() on a field, in place
+ */
+
+void fields_unescape(char *s)
+{
+    char *out;
+
+    for (out = s; *s != '\0'; s++) {
+        if (*s != '\\' || s[1] == '\0') {
+            *out++ = *s;
+            continue;
+        }
+
+        switch (*++s) {
+        case 't':
+            *out++ = '\t';
+            break;
+        case 'n':
+            *out++ = '\n';
+            break;
+        case 'r':
+            *out++ = '\r';
+            break;
+        default:
+            *out++ = *s;
+        }
+    }
+
+    *out = '\0';
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE /* sincos() */
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "generator.h"
+
+#define LEVEL 0.5 /* of full scale */
+
+/*
+ * Calculate the next bit in the LFSR sequence
+ */
+
+static inline bits_t lfsr(bits_t code, bits_t taps)
+{
+    bits_t taken;
+    int xrs;
+
+    taken = code & taps;
+    xrs = 0;
+    while (taken != 0x0) {
+        xrs += taken & 0x1;
+        taken >>= 1;
+    }
+
+    return xrs & 0x1;
+}
+
+/*
+ * LFSR in the forward direction
+ */
+
+static inline bits_t fwd(bits_t current, const struct timecode_def *def)
+{
+    bits_t l;
+
+    /* New bits are added at the MSB; shift right by one */
+
+    l = lfsr(current, def->taps | 0x1);
+    return (current >> 1) | (l << (def->bits - 1));
+}
+
+static inline double dither(void)
+{
+    return (double)(rand() % 32768) / 32768.0 - 0.5;
+}
+
+/*
+ * Post: generator is at the start of the timecode
+ */
+
+void generator_init(struct generator *g, struct timecode_def *def,
+                    unsigned int sample_rate)
+{
+    g->def = def;
+    g->rate = sample_rate;
+    generator_seek(g, 0.0);
+}
+
+/*
+ * Move to the given position, as when the needle is dropped
+ *
+ * The LFSR is run forward from the seed, so this is not for use
+ * in a realtime thread; copy a generator which is already in place.
+ */
+
+void generator_seek(struct generator *g, double seconds)
+{
+    unsigned int n;
+
+    g->start = seconds * g->def->resolution;
+    g->s = 0;
+    g->n = (unsigned int)g->start;
+    g->bits = g->def->seed;
+
+    for (n = 0; n < g->n; n++)
+        g->bits = fwd(g->bits, g->def);
+}
+
+/*
+ * Generate stereo audio of the timecode
+ *
+ * The bit of each wave cycle is the least significant of the LFSR,
+ * as mktimecode has always written it, and a zero is recorded as a
+ * quieter cycle. The decoder reads this as a position some cycles
+ * behind (the number of bits, less one). The definition sets which
+ * channel leads and by how much.
+ *
+ * Post: buffer at pcm is filled with npcm samples
+ */
+
+void generator_run(struct generator *g, signed short *pcm, size_t npcm)
+{
+    const struct timecode_def *def = g->def;
+    size_t s;
+
+    for (s = 0; s < npcm; s++) {
+        double cycle, angle, modulate, x, y, primary, secondary;
+        bool one;
+
+        /* Each position is from the sample count, so that it does
+         * not drift over a long run */
+
+        cycle = g->start + (double)g->s / g->rate * def->resolution;
+        angle = cycle * M_PI * 2;
+        sincos(angle, &x, &y);
+
+        /* Modulate the waveform according to the bitstream */
+
+        one = g->bits & 0x1;
+        modulate = 1.0 - (-cos(angle) + 1.0) * 0.25 * !one;
+
+        primary = x * modulate;
+        secondary = ((def->flags & SWITCH_PHASE) ? y : -y) * modulate;
+
+        if (def->flags & SWITCH_PRIMARY) {
+            *pcm++ = primary * SHRT_MAX * LEVEL + dither();
+            *pcm++ = secondary * SHRT_MAX * LEVEL + dither();
+        } else {
+            *pcm++ = secondary * SHRT_MAX * LEVEL + dither();
+            *pcm++ = primary * SHRT_MAX * LEVEL + dither();
+        }
+
+        /* Advance the bitstream if required */
+
+        while ((unsigned int)cycle > g->n) {
+            g->bits = fwd(g->bits, def);
+            g->n++;
+        }
+
+        g->s++;
+    }
+}
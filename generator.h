@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Generate the signal of a timecode record, as played at normal speed
+ */
+
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <stddef.h>
+
+#include "timecoder.h"
+
+struct generator {
+    struct timecode_def *def;
+    unsigned int rate;
+    double start; /* position of the first sample, in wave cycles */
+    unsigned long s; /* samples since the start */
+    unsigned int n; /* cycle of the current bits */
+    bits_t bits;
+};
+
+void generator_init(struct generator *g, struct timecode_def *def,
+                    unsigned int sample_rate);
+void generator_seek(struct generator *g, double seconds);
+void generator_run(struct generator *g, signed short *pcm, size_t npcm);
+
+#endif
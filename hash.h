@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * FNV-1a hash of a string, for tables and names of files
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+
+static inline uint32_t fnv1a_32(const char *s)
+{
+    uint32_t h;
+
+    h = 2166136261u;
+
+    while (*s != '\0') {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+static inline uint64_t fnv1a_64(const char *s)
+{
+    uint64_t h;
+
+    h = 14695981039346656037ull;
+
+    while (*s != '\0') {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ull;
+    }
+
+    return h;
+}
+
+#endif
@@ -20,26 +20,124 @@
 #define _GNU_SOURCE /* strcasestr(), strdupa() */
 #include <assert.h>
 #include <ctype.h>
+#include <float.h>
+#include <math.h> /* INFINITY */
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "hash.h"
 #include "index.h"
+#include "metrics.h"
+#include "trace.h"
 
 #define BLOCK 1024
 #define MAX_WORDS 32
 #define SEPARATOR ' '
 
+#define BPM_PREFIX "bpm:"
+#define BPM_PRECISION 0.05 /* half of the precision displayed */
+
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
 
+/* Search words which apply to one part of a record */
+
+static const struct {
+    const char *prefix;
+    int field;
+} fields[] = {
+    { "artist:", MATCH_ARTIST },
+    { "title:", MATCH_TITLE },
+    { "path:", MATCH_PATH },
+};
+
+struct record **record_chunk = NULL;
+
+static size_t chunks = 0;
+static record_id_t records = 0;
+
+/*
+ * Allocate a new record in the table
+ *
+ * Return: pointer to the record, or NULL on memory allocation failure
+ * Post: the record's ID is set
+ */
+
+struct record* record_new(void)
+{
+    struct record *re;
+
+    if (records == NO_RECORD) {
+        fputs("Maximum number of records reached.\n", stderr);
+        return NULL;
+    }
+
+    if (records == chunks * RECORD_CHUNK) {
+        struct record **cn, *c;
+
+        cn = realloc(record_chunk, sizeof *cn * (chunks + 1));
+        if (cn == NULL) {
+            perror("realloc");
+            return NULL;
+        }
+        record_chunk = cn;
+
+        c = malloc(sizeof *c * RECORD_CHUNK);
+        if (c == NULL) {
+            perror("malloc");
+            return NULL;
+        }
+        record_chunk[chunks++] = c;
+    }
+
+    re = record_get(records);
+    re->id = records++;
+    metric_set(&metric_records, records);
+
+    return re;
+}
+
+/*
+ * Return a record which is not wanted to the table
+ *
+ * Pre: re is the most recent record from record_new()
+ */
+
+void record_discard(struct record *re)
+{
+    assert(re->id == records - 1);
+    records--;
+    metric_set(&metric_records, records);
+}
+
+/*
+ * Deallocate the table of records
+ *
+ * Pre: no records are in use
+ */
+
+void record_table_clear(void)
+{
+    size_t n;
+
+    for (n = 0; n < chunks; n++)
+        free(record_chunk[n]);
+    free(record_chunk);
+
+    record_chunk = NULL;
+    chunks = 0;
+    records = 0;
+    metric_set(&metric_records, 0);
+}
+
 /*
  * Initialise a record index
  */
 
 void index_init(struct index *ls)
 {
-    ls->record = NULL;
+    ls->id = NULL;
     ls->size = 0;
     ls->entries = 0;
 }
@@ -53,7 +151,7 @@ void index_init(struct index *ls)
 
 void index_clear(struct index *ls)
 {
-    free(ls->record); /* may be NULL */
+    free(ls->id); /* may be NULL */
 }
 
 /*
@@ -79,20 +177,20 @@ void index_blank(struct index *ls)
 static int enlarge(struct index *ls, size_t target)
 {
     size_t p;
-    struct record **ln;
+    record_id_t *ln;
 
     if (target <= ls->size)
         return 0;
 
     p = target + BLOCK - 1; /* pre-allocate additional entries */
 
-    ln = realloc(ls->record, sizeof(struct record*) * p);
+    ln = realloc(ls->id, sizeof(record_id_t) * p);
     if (ln == NULL) {
         perror("realloc");
         return -1;
     }
 
-    ls->record = ln;
+    ls->id = ln;
     ls->size = p;
     return 0;
 }
@@ -119,7 +217,70 @@ void index_add(struct index *ls, struct record *lr)
     assert(lr != NULL);
     assert(has_space(ls));
 
-    ls->record[ls->entries++] = lr;
+    ls->id[ls->entries++] = lr->id;
+}
+
+/*
+ * Prepare the key used to sort a record
+ *
+ * The key is the artist and title, each terminated, folded in the
+ * same way as strcasecmp() and truncated. It is packed so that
+ * comparing the words as integers gives the same order as the strings.
+ *
+ * Pre: artist and title are set
+ */
+
+void record_init_key(struct record *re)
+{
+    const char *s, *next;
+    size_t w, b;
+
+    s = re->artist;
+    next = re->title;
+
+    for (w = 0; w < ARRAY_SIZE(re->key); w++) {
+        uint64_t k;
+
+        k = 0;
+
+        for (b = 0; b < sizeof k; b++) {
+            unsigned char c;
+
+            if (s == NULL) {
+                c = '\0';
+            } else if (*s == '\0') {
+                c = '\0';
+                s = next;
+                next = NULL;
+            } else {
+                c = tolower((unsigned char)*s);
+                s++;
+            }
+
+            k = k << 8 | c;
+        }
+
+        re->key[w] = k;
+    }
+}
+
+/*
+ * Compare the keys of two records
+ *
+ * Return: 0 if the keys are the same and the records must be compared
+ * in full, otherwise the order of the records
+ */
+
+static int key_cmp(const struct record *a, const struct record *b)
+{
+    size_t n;
+
+    for (n = 0; n < ARRAY_SIZE(a->key); n++) {
+        if (a->key[n] != b->key[n])
+            return (a->key[n] < b->key[n]) ? -1 : 1;
+    }
+
+    return 0;
 }
 
 /*
@@ -130,6 +291,10 @@ static int record_cmp_artist(const struct record *a, const struct record *b)
 {
     int r;
 
+    r = key_cmp(a, b);
+    if (r != 0)
+        return r;
+
     r = strcasecmp(a->artist, b->artist);
     if (r < 0)
         return -1;
@@ -168,8 +333,26 @@ static int record_cmp_bpm(const struct record *a, const struct record *b)
  * Return: true if this is a match, otherwise false
  */
 
-static bool record_match_word(struct record *re, const char *match)
+static bool record_match_word(struct record *re, const char *match,
+                              int field)
 {
+    switch (field) {
+    case MATCH_ARTIST:
+        return strcasestr(re->artist, match) != NULL;
+
+    case MATCH_TITLE:
+        return strcasestr(re->title, match) != NULL;
+
+    case MATCH_PATH:
+        return strncasecmp(re->pathname, match, strlen(match)) == 0;
+
+    case MATCH_ANY:
+        break;
+
+    default:
+        abort();
+    }
+
     /* Some records provide a dedicated string for matching against,
      * in the same locale as "match" */
 
@@ -186,6 +369,16 @@ static bool record_match_word(struct record *re, const char *match)
     return false;
 }
 
+/*
+ * Return: true if the record's BPM is in the range of the search,
+ * otherwise false
+ */
+
+static bool record_match_bpm(const struct record *re, const struct match *h)
+{
+    return re->bpm >= h->bpm_min && re->bpm < h->bpm_max;
+}
+
 /*
  * Check for a match against the given search criteria
  *
@@ -194,14 +387,14 @@ static bool record_match_word(struct record *re, const char *match)
 
 bool record_match(struct record *re, const struct match *h)
 {
-    char *const *matches;
+    size_t n;
 
-    matches = h->words;
+    if (h->bpm && !record_match_bpm(re, h))
+        return false;
 
-    while (*matches != NULL) {
-        if (!record_match_word(re, *matches))
+    for (n = 0; h->words[n] != NULL; n++) {
+        if (!record_match_word(re, h->words[n], h->field[n]))
             return false;
-        matches++;
     }
     return true;
 }
@@ -215,22 +408,116 @@ bool record_match(struct record *re, const struct match *h)
 
 int index_copy(const struct index *src, struct index *dest)
 {
-    int n;
-
     index_blank(dest);
 
     if (index_reserve(dest, src->entries) == -1)
         return -1;
 
-    for (n = 0; n < src->entries; n++)
-        index_add(dest, src->record[n]);
+    memcpy(dest->id, src->id, sizeof *src->id * src->entries);
+    dest->entries = src->entries;
 
     return 0;
 }
 
+/*
+ * Parse a range of BPM, eg. "120-128", "120", "120-" or "-128"
+ *
+ * The range includes any BPM which is displayed as being within it.
+ * Records of unknown BPM are never in the range.
+ *
+ * Return: 0 on success, or -1 if the range is not valid
+ * Post: on success, [min, max) is the range
+ */
+
+static int parse_bpm_range(const char *s, double *min, double *max)
+{
+    char *end;
+    double lo, hi;
+
+    lo = 0.0;
+    hi = INFINITY;
+
+    if (*s != '-') {
+        lo = strtod(s, &end);
+        if (end == s)
+            return -1;
+        s = end;
+        hi = lo;
+    }
+
+    if (*s == '-') {
+        s++;
+        hi = INFINITY;
+
+        if (*s != '\0') {
+            hi = strtod(s, &end);
+            if (end == s)
+                return -1;
+            s = end;
+        }
+    }
+
+    if (*s != '\0' || hi < lo)
+        return -1;
+
+    *min = lo - BPM_PRECISION;
+    if (*min < DBL_MIN)
+        *min = DBL_MIN;
+    *max = hi + BPM_PRECISION;
+
+    return 0;
+}
+
+/*
+ * Compile a single word of a search, which may be a field filter
+ *
+ * Return: true if the word should be kept, otherwise false
+ */
+
+static bool compile_word(struct match *h, size_t n)
+{
+    char *w;
+    size_t f;
+
+    w = h->words[n];
+    h->field[n] = MATCH_ANY;
+
+    if (strncmp(w, BPM_PREFIX, strlen(BPM_PREFIX)) == 0) {
+        h->fields = true;
+
+        /* A partial range, as it is typed, does not filter */
+
+        if (parse_bpm_range(w + strlen(BPM_PREFIX),
+                            &h->bpm_min, &h->bpm_max) == 0)
+        {
+            h->bpm = true;
+        }
+
+        return false;
+    }
+
+    for (f = 0; f < ARRAY_SIZE(fields); f++) {
+        size_t len;
+
+        len = strlen(fields[f].prefix);
+        if (strncmp(w, fields[f].prefix, len) == 0) {
+            h->words[n] = w + len;
+            h->field[n] = fields[f].field;
+            h->fields = true;
+            break;
+        }
+    }
+
+    return true;
+}
+
 /*
  * Compile a search object from a given string
  *
+ * Words are matched against the artist and title, unless they are
+ * prefixed with a field, eg. "artist:", "title:" or "path:". A range
+ * of BPM is given as, eg. "bpm:120-128".
+ *
  * Pre: search string is within length
  */
 
@@ -242,6 +529,9 @@ void match_compile(struct match *h, const char *d)
     assert(strlen(d) < sizeof h->buf);
     strcpy(h->buf, d);
 
+    h->fields = false;
+    h->bpm = false;
+
     buf = h->buf;
     n = 0;
     for (;;) {
@@ -252,13 +542,16 @@ void match_compile(struct match *h, const char *d)
             break;
         }
 
+        s = strchr(buf, SEPARATOR);
+        if (s != NULL)
+            *s = '\0';
+
         h->words[n] = buf;
-        n++;
+        if (compile_word(h, n))
+            n++;
 
-        s = strchr(buf, SEPARATOR);
         if (s == NULL)
             break;
-        *s = '\0';
         buf = s + 1; /* skip separator */
     }
     h->words[n] = NULL; /* terminate list */
@@ -281,9 +574,10 @@ int index_match(struct index *src, struct index *dest,
     struct record *re;
 
     index_blank(dest);
+    TRACE(index_match_start, src, src->entries);
 
     for (n = 0; n < src->entries; n++) {
-        re = src->record[n];
+        re = index_record(src, n);
 
         if (record_match(re, match)) {
             if (index_reserve(dest, 1) == -1)
@@ -292,6 +586,158 @@ int index_match(struct index *src, struct index *dest,
         }
     }
 
+    TRACE(index_match_end, src, dest->entries);
+
+    return 0;
+}
+
+/*
+ * Return: the number of entries at the start of an index, sorted by
+ * BPM, which are at least the given BPM
+ */
+
+static size_t bpm_bound(const struct index *i, double bpm)
+{
+    size_t lo, hi;
+
+    lo = 0;
+    hi = i->entries;
+
+    while (lo < hi) {
+        size_t mid;
+
+        mid = lo + (hi - lo) / 2;
+        if (index_record(i, mid)->bpm >= bpm)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+ * Find entries from a source index sorted by BPM which match
+ *
+ * As index_match(), but the records in the range of BPM are found by
+ * binary search and only those are visited.
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ * Pre: src is sorted by BPM
+ * Pre: match has a range of BPM
+ * Post: on failure, dest is valid but incomplete
+ */
+
+int index_match_bpm(const struct index *src, struct index *dest,
+                    const struct match *match)
+{
+    size_t n, end;
+
+    assert(match->bpm);
+
+    index_blank(dest);
+    TRACE(index_match_start, src, src->entries);
+
+    end = bpm_bound(src, match->bpm_min);
+
+    for (n = bpm_bound(src, match->bpm_max); n < end; n++) {
+        struct record *re;
+
+        re = index_record(src, n);
+
+        if (record_match(re, match)) {
+            if (index_reserve(dest, 1) == -1)
+                return -1;
+            index_add(dest, re);
+        }
+    }
+
+    TRACE(index_match_end, src, dest->entries);
+
+    return 0;
+}
+
+/*
+ * Initialise an empty set of records
+ */
+
+void record_set_init(struct record_set *s)
+{
+    s->word = NULL;
+    s->words = 0;
+}
+
+void record_set_clear(struct record_set *s)
+{
+    free(s->word); /* may be NULL */
+}
+
+/*
+ * Enlarge the set so that it can hold any record in the table
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ */
+
+int record_set_reserve(struct record_set *s)
+{
+    size_t words;
+    uint64_t *w;
+
+    words = (records + 63) / 64;
+    if (words <= s->words)
+        return 0;
+
+    w = realloc(s->word, sizeof *w * words);
+    if (w == NULL) {
+        perror("realloc");
+        return -1;
+    }
+
+    memset(w + s->words, 0, sizeof *w * (words - s->words));
+    s->word = w;
+    s->words = words;
+
+    return 0;
+}
+
+/*
+ * Find entries from a source index which are also in another index,
+ * in the order of the source
+ *
+ * This is a way to re-order the result of a search without repeating
+ * it; set is workspace which is kept between calls to save on
+ * allocation.
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ * Pre: set is empty
+ * Post: set is empty
+ */
+
+int index_filter(const struct index *src, struct index *dest,
+                 const struct index *of, struct record_set *set)
+{
+    size_t n;
+
+    if (record_set_reserve(set) == -1)
+        return -1;
+    if (index_reserve(dest, of->entries) == -1)
+        return -1;
+
+    for (n = 0; n < of->entries; n++)
+        record_set_add(set, of->id[n]);
+
+    index_blank(dest);
+
+    for (n = 0; n < src->entries; n++) {
+        record_id_t id = src->id[n];
+
+        if (record_set_has(set, id))
+            dest->id[dest->entries++] = id;
+    }
+
+    for (n = 0; n < of->entries; n++)
+        set->word[of->id[n] / 64] = 0;
+
     return 0;
 }
 
@@ -307,7 +753,7 @@ int index_match(struct index *src, struct index *dest,
  * Post: on exact match, *found is true
  */
 
-static size_t bin_search(struct record **base, size_t n,
+static size_t bin_search(const record_id_t *base, size_t n,
                          struct record *item, int sort,
                          bool *found)
 {
@@ -323,7 +769,7 @@ static size_t bin_search(struct record **base, size_t n,
     }
 
     mid = n / 2;
-    x = base[mid];
+    x = record_get(base[mid]);
 
     switch (sort) {
     case SORT_ARTIST:
@@ -348,6 +794,43 @@ static size_t bin_search(struct record **base, size_t n,
     return mid;
 }
 
+/*
+ * Comparison functions, see qsort(3)
+ */
+
+static int qcompar_artist(const void *a, const void *b)
+{
+    return record_cmp_artist(record_get(*(const record_id_t*)a),
+                             record_get(*(const record_id_t*)b));
+}
+
+static int qcompar_bpm(const void *a, const void *b)
+{
+    return record_cmp_bpm(record_get(*(const record_id_t*)a),
+                          record_get(*(const record_id_t*)b));
+}
+
+/*
+ * Sort the entries of an index
+ *
+ * Post: index is sorted
+ */
+
+void index_sort(struct index *i, int sort)
+{
+    switch (sort) {
+    case SORT_ARTIST:
+        qsort(i->id, i->entries, sizeof *i->id, qcompar_artist);
+        break;
+    case SORT_BPM:
+        qsort(i->id, i->entries, sizeof *i->id, qcompar_bpm);
+        break;
+    case SORT_PLAYLIST:
+    default:
+        abort();
+    }
+}
+
 /*
  * Insert or re-use an entry in a sorted index
  *
@@ -363,20 +846,81 @@ struct record* index_insert(struct index *ls, struct record *item,
     bool found;
     size_t z;
 
-    z = bin_search(ls->record, ls->entries, item, sort, &found);
+    z = bin_search(ls->id, ls->entries, item, sort, &found);
     if (found)
-        return ls->record[z];
+        return index_record(ls, z);
 
     assert(has_space(ls));
 
-    memmove(ls->record + z + 1, ls->record + z,
-            sizeof(struct record*) * (ls->entries - z));
-    ls->record[z] = item;
+    memmove(ls->id + z + 1, ls->id + z,
+            sizeof(record_id_t) * (ls->entries - z));
+    ls->id[z] = item->id;
     ls->entries++;
 
     return item;
 }
 
+/*
+ * Merge a sorted set of new items into a sorted index
+ *
+ * Faster than index_insert() for each item when there are many, as
+ * each existing entry moves only once.
+ *
+ * Pre: both indexes are sorted the same way
+ * Pre: there are no items in common
+ * Pre: enough entries are reserved for all the items
+ * Post: index is sorted and contains all the items
+ */
+
+void index_merge(struct index *ls, const struct index *items, int sort)
+{
+    size_t a, b, z;
+
+    assert(ls->entries + items->entries <= ls->size);
+
+    /* Merge from the end, into the space which is reserved */
+
+    a = ls->entries;
+    b = items->entries;
+    z = a + b;
+
+    while (b > 0) {
+        struct record *x, *y;
+        int r;
+
+        y = index_record(items, b - 1);
+
+        if (a == 0) {
+            ls->id[--z] = y->id;
+            b--;
+            continue;
+        }
+
+        x = index_record(ls, a - 1);
+
+        switch (sort) {
+        case SORT_ARTIST:
+            r = record_cmp_artist(x, y);
+            break;
+        case SORT_BPM:
+            r = record_cmp_bpm(x, y);
+            break;
+        case SORT_PLAYLIST:
+        default:
+            abort();
+        }
+
+        assert(r != 0);
+
+        if (r > 0)
+            ls->id[--z] = ls->id[--a];
+        else
+            ls->id[--z] = items->id[--b];
+    }
+
+    ls->entries += items->entries;
+}
+
 /*
  * Reserve space in the index for the addition of n new items
  *
@@ -401,7 +945,7 @@ size_t index_find(struct index *ls, struct record *item, int sort)
     bool found;
     size_t z;
 
-    z = bin_search(ls->record, ls->entries, item, sort, &found);
+    z = bin_search(ls->id, ls->entries, item, sort, &found);
     return z;
 }
 
@@ -414,5 +958,158 @@ void index_debug(struct index *ls)
     int n;
 
     for (n = 0; n < ls->entries; n++)
-        fprintf(stderr, "%d: %s\n", n, ls->record[n]->pathname);
+        fprintf(stderr, "%d: %s\n", n, index_record(ls, n)->pathname);
+}
+
+/*
+ * Initialise a table of records by pathname
+ */
+
+void path_index_init(struct path_index *p)
+{
+    p->slot = NULL;
+    p->slots = 0;
+    p->entries = 0;
+}
+
+/*
+ * Deallocate the table; the records themselves are not affected
+ */
+
+void path_index_clear(struct path_index *p)
+{
+    free(p->slot); /* may be NULL */
+}
+
+/*
+ * Place a record in the table, without any checks
+ *
+ * Pre: table has at least one empty slot
+ */
+
+static void path_insert(record_id_t *slot, size_t slots,
+                        const struct record *re)
+{
+    size_t n;
+
+    n = fnv1a_32(re->pathname) & (slots - 1);
+    while (slot[n] != NO_RECORD)
+        n = (n + 1) & (slots - 1);
+
+    slot[n] = re->id;
+}
+
+/*
+ * Reserve space in the table for the addition of n new records, so
+ * that it is no more than half full
+ *
+ * Return: -1 if not enough memory, otherwise zero
+ * Post: if zero is returned, at least n records can be added
+ */
+
+int path_index_reserve(struct path_index *p, size_t n)
+{
+    size_t m, slots;
+    record_id_t *slot;
+
+    slots = p->slots ? p->slots : 1024;
+    while ((p->entries + n) * 2 > slots)
+        slots *= 2;
+
+    if (slots == p->slots)
+        return 0;
+
+    slot = malloc(sizeof *slot * slots);
+    if (slot == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    for (m = 0; m < slots; m++)
+        slot[m] = NO_RECORD;
+
+    for (m = 0; m < p->slots; m++) {
+        if (p->slot[m] != NO_RECORD)
+            path_insert(slot, slots, record_get(p->slot[m]));
+    }
+
+    free(p->slot);
+    p->slot = slot;
+    p->slots = slots;
+
+    return 0;
+}
+
+/*
+ * Add a record to the table
+ *
+ * More than one record may have the same pathname, eg. where the
+ * metadata differs between two scans of the same file.
+ *
+ * Pre: space is reserved, see path_index_reserve()
+ */
+
+void path_index_add(struct path_index *p, struct record *re)
+{
+    assert(p->entries * 2 < p->slots);
+
+    path_insert(p->slot, p->slots, re);
+    p->entries++;
+}
+
+/*
+ * Return: a record with the given pathname, or NULL if none
+ */
+
+struct record* path_index_find(const struct path_index *p,
+                               const char *pathname)
+{
+    size_t n;
+
+    if (p->slots == 0)
+        return NULL;
+
+    n = fnv1a_32(pathname) & (p->slots - 1);
+
+    while (p->slot[n] != NO_RECORD) {
+        struct record *x;
+
+        x = record_get(p->slot[n]);
+        if (strcmp(x->pathname, pathname) == 0)
+            return x;
+
+        n = (n + 1) & (p->slots - 1);
+    }
+
+    return NULL;
+}
+
+/*
+ * Find a record which is identical to the given one; that is, the
+ * same record as far as any index is concerned
+ *
+ * Return: existing record, or NULL if none
+ */
+
+struct record* path_index_match(const struct path_index *p,
+                                const struct record *re)
+{
+    size_t n;
+
+    if (p->slots == 0)
+        return NULL;
+
+    n = fnv1a_32(re->pathname) & (p->slots - 1);
+
+    while (p->slot[n] != NO_RECORD) {
+        struct record *x;
+
+        x = record_get(p->slot[n]);
+        if (record_cmp_artist(x, re) == 0)
+            return x;
+
+        n = (n + 1) & (p->slots - 1);
+    }
+
+    return NULL;
 }
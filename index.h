@@ -20,13 +20,20 @@
 #ifndef INDEX_H
 #define INDEX_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #define SORT_ARTIST   0
 #define SORT_BPM      1
 #define SORT_PLAYLIST 2
 #define SORT_END      3
 
+/* Records are held in a table and referred to by ID, which is
+ * smaller than a pointer */
+
+typedef uint32_t record_id_t;
+
 /* A single music track in our listings */
 
 struct record {
@@ -38,23 +45,72 @@ struct record {
     char *match; /* or NULL */
 
     double bpm; /* or 0.0 if not known */
+
+    /* Start of the artist and title, for sorting; see
+     * record_init_key() */
+
+    uint64_t key[3];
+
+    record_id_t id;
 };
 
-/* Index points to records, but does not manage those pointers */
+/* The table is allocated in chunks, so that records do not move and
+ * pointers to them remain valid */
+
+#define RECORD_CHUNK 4096
+
+extern struct record **record_chunk;
+
+/* Index refers to records, but does not manage those records */
 
 struct index {
-    struct record **record;
+    record_id_t *id;
     size_t size, entries;
 };
 
+/* Open-addressed table of records by pathname, for identity */
+
+struct path_index {
+    record_id_t *slot; /* or NO_RECORD */
+    size_t slots, /* power of two */
+        entries;
+};
+
+#define NO_RECORD UINT32_MAX
+
+/* Set of records, by ID */
+
+struct record_set {
+    uint64_t *word;
+    size_t words;
+};
+
+/* Part of a record which a search word applies to */
+
+#define MATCH_ANY    0 /* artist or title */
+#define MATCH_ARTIST 1
+#define MATCH_TITLE  2
+#define MATCH_PATH   3 /* prefix of the pathname */
+
 /* A 'compiled' search criteria, so we can repeat searches and
  * matches efficiently */
 
 struct match {
     char buf[512];
     char *words[32]; /* NULL-terminated array */
+    int field[32]; /* of each word */
+
+    bool fields, /* any word is a field filter, eg. "artist:" */
+        bpm; /* only records with BPM in the range */
+    double bpm_min, bpm_max; /* half-open interval */
 };
 
+struct record* record_new(void);
+void record_discard(struct record *re);
+void record_table_clear(void);
+
+void record_init_key(struct record *re);
+
 void index_init(struct index *ls);
 void index_clear(struct index *ls);
 void index_blank(struct index *ls);
@@ -64,10 +120,67 @@ int index_copy(const struct index *src, struct index *dest);
 void match_compile(struct match *h, const char *d);
 int index_match(struct index *src, struct index *dest,
                 const struct match *match);
+int index_match_bpm(const struct index *src, struct index *dest,
+                    const struct match *match);
+void index_sort(struct index *i, int sort);
+void record_set_init(struct record_set *s);
+void record_set_clear(struct record_set *s);
+int record_set_reserve(struct record_set *s);
+int index_filter(const struct index *src, struct index *dest,
+                 const struct index *of, struct record_set *set);
 struct record* index_insert(struct index *ls, struct record *item,
                             int sort);
+void index_merge(struct index *ls, const struct index *items, int sort);
 int index_reserve(struct index *i, unsigned int n);
 size_t index_find(struct index *ls, struct record *item, int sort);
 void index_debug(struct index *ls);
 
+void path_index_init(struct path_index *p);
+void path_index_clear(struct path_index *p);
+int path_index_reserve(struct path_index *p, size_t n);
+void path_index_add(struct path_index *p, struct record *re);
+struct record* path_index_find(const struct path_index *p,
+                               const char *pathname);
+struct record* path_index_match(const struct path_index *p,
+                                const struct record *re);
+
+/*
+ * Return: the record of the given ID
+ */
+
+static inline struct record* record_get(record_id_t id)
+{
+    return &record_chunk[id / RECORD_CHUNK][id % RECORD_CHUNK];
+}
+
+/*
+ * Operations on a set of records
+ *
+ * Pre: set is reserved to hold the record, see record_set_reserve()
+ */
+
+static inline void record_set_add(struct record_set *s, record_id_t id)
+{
+    s->word[id / 64] |= (uint64_t)1 << (id % 64);
+}
+
+static inline void record_set_remove(struct record_set *s, record_id_t id)
+{
+    s->word[id / 64] &= ~((uint64_t)1 << (id % 64));
+}
+
+static inline bool record_set_has(const struct record_set *s, record_id_t id)
+{
+    return s->word[id / 64] & (uint64_t)1 << (id % 64);
+}
+
+/*
+ * Return: the record at the given position in the index
+ */
+
+static inline struct record* index_record(const struct index *i, size_t n)
+{
+    return record_get(i->id[n]);
+}
+
 #endif
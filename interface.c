@@ -20,6 +20,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <iconv.h>
+#include <limits.h>
 #include <math.h>
 #include <pthread.h>
 #include <stdbool.h>
@@ -39,8 +40,10 @@
 #include "player.h"
 #include "rig.h"
 #include "selector.h"
+#include "spinner.h"
 #include "status.h"
 #include "timecoder.h"
+#include "trace.h"
 #include "xwax.h"
 
 /* Screen refresh time in milliseconds */
@@ -101,6 +104,8 @@
 
 #define BPM_WIDTH 32
 #define SORT_WIDTH 21
+#define CRATE_INDENT 8
+#define MAX_CRATE_DEPTH 4 /* of indentation */
 #define RESULTS_ARTIST_WIDTH 200
 
 #define TOKEN_SPACE 2
@@ -119,6 +124,7 @@
 #define FUNC_LOAD 0
 #define FUNC_RECUE 1
 #define FUNC_TIMECODE 2
+#define FUNC_QUEUE 3
 
 /* Types of SDL_USEREVENT */
 
@@ -165,7 +171,7 @@ static SDL_Color background_col = {0, 0, 0, 255},
     artist_col = {16, 64, 0, 255},
     bpm_col = {64, 16, 0, 255};
 
-static unsigned short *spinner_angle, spinner_size;
+static struct spinner spinner;
 
 static int width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT,
     meter_scale = DEFAULT_METER_SCALE;
@@ -215,69 +221,6 @@ static void time_to_clock(char buf[9], char deci[4], int t)
     sprintf(deci, "%03d", frac);
 }
 
-/*
- * Calculate a lookup which maps a position on screen to an angle,
- * relative to the centre of the spinner
- */
-
-static void calculate_angle_lut(unsigned short *lut, int size)
-{
-    int r, c, nr, nc;
-    float theta, rat;
-
-    for (r = 0; r < size; r++) {
-        nr = r - size / 2;
-
-        for (c = 0; c < size; c++) {
-            nc = c - size / 2;
-
-            if (nr == 0)
-                theta = M_PI_2;
-
-            else if (nc == 0) {
-                theta = 0;
-
-                if (nr < 0)
-                    theta = M_PI;
-
-            } else {
-                rat = (float)(nc) / -nr;
-                theta = atanf(rat);
-
-                if (rat < 0)
-                    theta += M_PI;
-            }
-
-            if (nc <= 0)
-                theta += M_PI;
-
-            /* The angles stored in the lookup table range from 0 to
-             * 1023 (where 1024 is 360 degrees) */
-
-            lut[r * size + c]
-                = ((int)(theta * 1024 / (M_PI * 2)) + 1024) % 1024;
-        }
-    }
-}
-
-static int init_spinner(int size)
-{
-    spinner_angle = malloc(size * size * (sizeof *spinner_angle));
-    if (spinner_angle == NULL) {
-        perror("malloc");
-        return -1;
-    }
-
-    calculate_angle_lut(spinner_angle, size);
-    spinner_size = size;
-    return 0;
-}
-
-static void clear_spinner(void)
-{
-    free(spinner_angle);
-}
-
 /*
  * Open a font, given the leafname
  *
@@ -732,53 +675,39 @@ static void draw_scope(SDL_Surface *surface, const struct rect *rect,
 static void draw_spinner(SDL_Surface *surface, const struct rect *rect,
                          struct player *pl)
 {
-    int x, y, r, c, rangle, pangle;
+    int bpp, rangle;
     double elapsed, remain, rps;
-    Uint8 *rp, *p;
+    Uint8 *p;
     SDL_Color col;
-
-    x = rect->x;
-    y = rect->y;
+    unsigned char dark[4], light[4];
 
     elapsed = player_get_elapsed(pl);
     remain = player_get_remain(pl);
 
     rps = timecoder_revs_per_sec(pl->timecoder);
-    rangle = (int)(player_get_position(pl) * 1024 * rps) % 1024;
+    rangle = (int)(player_get_position(pl) * SPINNER_ANGLES * rps)
+        % SPINNER_ANGLES;
 
     if (elapsed < 0 || remain < 0)
         col = alert_col;
     else
         col = ok_col;
 
-    for (r = 0; r < spinner_size; r++) {
-
-        /* Store a pointer to this row of the framebuffer */
-
-        rp = surface->pixels + (y + r) * surface->pitch;
-
-        for (c = 0; c < spinner_size; c++) {
-
-            /* Use the lookup table to provide the angle at each
-             * pixel */
-
-            pangle = spinner_angle[r * spinner_size + c];
+    light[0] = col.b;
+    light[1] = col.g;
+    light[2] = col.r;
+    light[3] = 0;
 
-            /* Calculate the final pixel location and set it */
+    dark[0] = col.b >> 2;
+    dark[1] = col.g >> 2;
+    dark[2] = col.r >> 2;
+    dark[3] = 0;
 
-            p = rp + (x + c) * surface->format->BytesPerPixel;
+    bpp = surface->format->BytesPerPixel;
+    p = surface->pixels + rect->y * surface->pitch + rect->x * bpp;
 
-            if ((rangle - pangle + 1024) % 1024 < 512) {
-                p[0] = col.b >> 2;
-                p[1] = col.g >> 2;
-                p[2] = col.r >> 2;
-            } else {
-                p[0] = col.b;
-                p[1] = col.g;
-                p[2] = col.r;
-            }
-        }
-    }
+    spinner_draw(&spinner, p, surface->pitch, bpp, rect->w, rect->h,
+                 rangle, dark, light);
 }
 
 /*
@@ -1024,6 +953,18 @@ static void draw_deck_top(SDL_Surface *surface, const struct rect *rect,
     draw_scope(surface, &scope, pl->timecoder);
 }
 
+/*
+ * Return: the given input level in dB relative to full scale
+ */
+
+static double dbfs(float level)
+{
+    if (level < 1.0)
+        return -99.0;
+
+    return 20.0 * log10(level / INT_MAX);
+}
+
 /*
  * Draw the textual description of playback status, which includes
  * information on the timecode
@@ -1033,13 +974,14 @@ static void draw_deck_status(SDL_Surface *surface,
                              const struct rect *rect,
                              const struct deck *deck)
 {
-    char buf[128], *c;
+    char buf[192], *c;
     int tc;
     const struct player *pl = &deck->player;
+    const struct timecoder *t = pl->timecoder;
 
     c = buf;
 
-    c += sprintf(c, "%s: ", pl->timecoder->def->name);
+    c += sprintf(c, "%s: ", t->def->name);
 
     tc = timecoder_get_position(pl->timecoder, NULL);
     if (pl->timecode_control && tc != -1) {
@@ -1048,11 +990,18 @@ static void draw_deck_status(SDL_Surface *surface,
         c += sprintf(c, "        ");
     }
 
-    sprintf(c, "pitch:%+0.2f (sync %0.2f %+.5fs = %+0.2f)  %s%s",
+    /* Input level and noise floor of each channel */
+
+    c += sprintf(c, "in:%.0f/%.0fdB floor:%.0f/%.0fdB ",
+                 dbfs(t->primary.level), dbfs(t->secondary.level),
+                 dbfs(t->primary.noise), dbfs(t->secondary.noise));
+
+    sprintf(c, "pitch:%+0.2f (sync %0.2f %+.5fs = %+0.2f)  %s%s%s",
             pl->pitch,
             pl->sync_pitch,
             pl->last_difference,
             pl->pitch * pl->sync_pitch,
+            t->present ? "" : "NOSIG  ",
             pl->recalibrate ? "RCAL  " : "",
             deck_is_locked(deck) ? "LOCK  " : "");
 
@@ -1259,23 +1208,33 @@ static void draw_crate_row(const void *context,
 {
     const struct selector *selector = context;
     const struct crate *crate;
-    struct rect left, right;
+    struct rect indent, left, right;
+    unsigned int depth;
     SDL_Color col;
 
-    crate = selector->library->crate[entry];
+    crate = library_crate(selector->library, entry);
 
     if (crate->is_fixed)
         col = detail_col;
     else
         col = text_col;
 
+    /* Indent the content of folders */
+
+    depth = crate->depth;
+    if (depth > MAX_CRATE_DEPTH)
+        depth = MAX_CRATE_DEPTH;
+
+    split(rect, from_left(depth * CRATE_INDENT, 0), &indent, &left);
+    draw_rect(surface, &indent, selected ? selected_col : background_col);
+
     if (!selected) {
-        draw_text_in_locale(surface, &rect, crate->name,
+        draw_text_in_locale(surface, &left, crate->name,
                             font, col, background_col);
         return;
     }
 
-    split(rect, from_right(SORT_WIDTH, 0), &left, &right);
+    split(left, from_right(SORT_WIDTH, 0), &left, &right);
 
     switch (selector->sort) {
     case SORT_ARTIST:
@@ -1332,7 +1291,7 @@ static void draw_record_row(const void *context,
     if (width > RESULTS_ARTIST_WIDTH)
         width = RESULTS_ARTIST_WIDTH;
 
-    record = index->record[entry];
+    record = index_record(index, entry);
 
     split(rect, from_left(BPM_WIDTH, 0), &left, &right);
     draw_bpm_field(surface, &left, record->bpm, col);
@@ -1397,6 +1356,21 @@ static void draw_library(SDL_Surface *surface, const struct rect *rect,
     }
 }
 
+/*
+ * Return: true if the last word of the search is a range of BPM,
+ * otherwise false
+ */
+
+static bool typing_range(const struct selector *sel)
+{
+    const char *w;
+
+    w = strrchr(sel->search, ' ');
+    w = (w == NULL) ? sel->search : w + 1;
+
+    return strncmp(w, "bpm:", 4) == 0;
+}
+
 /*
  * Handle a single key event
  *
@@ -1427,6 +1401,20 @@ static bool handle_key(SDLKey key, SDLMod mod)
         selector_search_refine(sel, '.');
         return true;
 
+    } else if (key == SDLK_SLASH) {
+        selector_search_refine(sel, '/');
+        return true;
+
+    } else if (key == SDLK_COLON
+               || (key == SDLK_SEMICOLON && mod & KMOD_SHIFT))
+    {
+        selector_search_refine(sel, ':');
+        return true;
+
+    } else if (key == SDLK_MINUS && typing_range(sel)) {
+        selector_search_refine(sel, '-');
+        return true;
+
     } else if (key == SDLK_HOME) {
         selector_top(sel);
         return true;
@@ -1535,6 +1523,20 @@ static bool handle_key(SDLKey key, SDLMod mod)
                     (void)player_toggle_timecode_control(pl);
                 }
                 break;
+
+            case FUNC_QUEUE:
+                if (mod & KMOD_CTRL) {
+                    if (mod & KMOD_SHIFT) {
+                        deck_unqueue(de);
+                    } else if (deck_queue_index(de, sel->view_index) == -1) {
+                        status_printf(STATUS_ALERT, "Out of memory");
+                    }
+                } else {
+                    re = selector_current(sel);
+                    if (re != NULL && deck_queue(de, re) == -1)
+                        status_printf(STATUS_ALERT, "Out of memory");
+                }
+                break;
             }
         }
     }
@@ -1653,6 +1655,7 @@ static int interface_main(void)
             break;
 
         case EVENT_TICKER:
+            deck_commit_detected(deck, ndeck);
             decks_update = true;
             break;
 
@@ -1703,6 +1706,8 @@ static int interface_main(void)
         if (!library_update && !decks_update && !status_update)
             continue;
 
+        TRACE(interface_frame_start, surface, decks_update);
+
         LOCK(surface);
 
         if (library_update)
@@ -1731,6 +1736,8 @@ static int interface_main(void)
             decks_update = false;
         }
 
+        TRACE(interface_frame_end, surface, 0);
+
     } /* main loop */
 
  finish:
@@ -1836,7 +1843,7 @@ static void cleanup()
     for (n = 0; n < ndeck; n++)
         timecoder_monitor_clear(&deck[n].timecoder);
 
-    clear_spinner();
+    spinner_clear(&spinner);
     ignore(&on_status);
     ignore(&on_selector);
     selector_clear(&selector);
@@ -1915,7 +1922,7 @@ int interface_start(struct library *lib, const char *geo, bool decor)
      * Timecode monitors
      */
 
-    if (init_spinner(zoom(SPINNER_SIZE)) == -1)
+    if (spinner_init(&spinner, zoom(SPINNER_SIZE)) == -1)
         goto fail_sdl;
 
     for (n = 0; n < ndeck; n++) {
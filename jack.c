@@ -25,6 +25,8 @@
 
 #include "device.h"
 #include "jack.h"
+#include "metrics.h"
+#include "trace.h"
 
 #define MAX_BLOCK 512 /* samples */
 #define SCALE 32768
@@ -128,6 +130,8 @@ static int process_callback(jack_nframes_t nframes, void *local)
 {
     size_t n;
 
+    TRACE(jack_period_start, client, nframes);
+
     for (n = 0; n < ndeck; n++) {
         struct jack *jack;
 
@@ -136,6 +140,16 @@ static int process_callback(jack_nframes_t nframes, void *local)
             process_deck(device[n], nframes);
     }
 
+    TRACE(jack_period_end, client, nframes);
+
+    return 0;
+}
+
+/* Callback for an under- or overrun */
+
+static int xrun_callback(void *local)
+{
+    metric_inc(&metric_xruns);
     return 0;
 }
 
@@ -167,6 +181,11 @@ static int start_jack_client(void)
         return -1;
     }
 
+    if (jack_set_xrun_callback(client, xrun_callback, NULL) != 0) {
+        fprintf(stderr, "JACK: Failed to set xrun callback\n");
+        return -1;
+    }
+
     jack_on_shutdown(client, shutdown_callback, NULL);
 
     rate = jack_get_sample_rate(client);
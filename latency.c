@@ -0,0 +1,676 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Measure the latency from timecode to audio of a running xwax
+ *
+ * A generated timecode is played into a deck through a loopback, and
+ * the deck's output is recorded from it. The timecode jumps between
+ * two positions, moving the test track between silence and a tone,
+ * and the time taken for each change to arrive back is recorded.
+ *
+ * Both streams are counted in frames from when they were started
+ * together, so the buffering of this program is not included.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef WITH_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#ifdef WITH_JACK
+#include <pthread.h>
+#include <unistd.h>
+#include <jack/jack.h>
+#endif
+
+#include "generator.h"
+
+#define DEFAULT_RATE 48000
+#define DEFAULT_PERIOD 64 /* samples */
+#define DEFAULT_JUMPS 100
+#define DEFAULT_TIMECODE "serato_2a"
+
+#define BUFFER_PERIODS 4
+
+/* The test track is silence, then a tone. The timecode moves between
+ * two positions which are this far apart */
+
+#define SILENCE 20.0 /* seconds */
+#define TONE 40.0 /* seconds */
+#define TONE_HZ 1000.0
+
+#define BASE 10.0 /* on the timecode, in seconds */
+#define JUMP 30.0 /* seconds */
+
+#define WARMUP 2.0 /* seconds for the deck to lock to the timecode */
+#define DWELL 0.5 /* seconds after each change before the next jump */
+#define TIMEOUT 2.0 /* seconds to wait for a change */
+
+#define THRESHOLD 2048 /* level of tone, well above dither */
+#define QUIET_CYCLES 2 /* of the tone, below threshold to be silence */
+
+#define MAX_PERIOD 4096 /* samples */
+
+#define MAX_JUMPS 10000
+
+static unsigned int rate;
+
+/* Output, in frames of the playback stream */
+
+static struct generator at[2], /* positions of silence and the tone */
+    gen;
+static unsigned long played, next_jump;
+static bool tone; /* expected from the last jump */
+
+/* Input, in frames of the capture stream */
+
+static unsigned long recorded, jumped, quiet;
+static bool waiting;
+
+static double result[MAX_JUMPS];
+static unsigned int jumps, measured, missed;
+static volatile bool finished;
+
+/*
+ * Produce the timecode for the next frames of playback, jumping at
+ * the requested time
+ */
+
+static void generate(signed short *pcm, size_t n)
+{
+    if (!waiting && played >= next_jump) {
+        tone = !tone;
+        gen = at[tone];
+        jumped = played;
+        waiting = true;
+        quiet = 0;
+    }
+
+    generator_run(&gen, pcm, n);
+    played += n;
+}
+
+/*
+ * Record the time of a change in the audio from the deck, and
+ * schedule the next jump
+ */
+
+static void change(unsigned long frame, bool found)
+{
+    if (found) {
+        result[measured++] = (double)(frame - jumped) / rate;
+    } else {
+        missed++;
+    }
+
+    if (measured + missed >= jumps)
+        finished = true;
+
+    /* Avoid a fixed relation to the period size */
+
+    next_jump = frame + DWELL * rate + rand() % (rate / 100);
+    waiting = false;
+}
+
+/*
+ * Look for the expected change in the audio of the deck
+ */
+
+static void analyse(const signed short *pcm, size_t n)
+{
+    size_t s;
+
+    for (s = 0; s < n; s++, recorded++) {
+        bool loud;
+
+        if (!waiting || recorded < jumped)
+            continue;
+
+        if (recorded - jumped > TIMEOUT * rate) {
+            change(recorded, false);
+            continue;
+        }
+
+        loud = abs(pcm[s * 2]) > THRESHOLD || abs(pcm[s * 2 + 1]) > THRESHOLD;
+
+        if (tone) {
+            if (loud)
+                change(recorded, true);
+        } else {
+            if (loud) {
+                quiet = 0;
+            } else if (++quiet == QUIET_CYCLES * rate / TONE_HZ) {
+                change(recorded - quiet + 1, true);
+            }
+        }
+    }
+}
+
+/*
+ * Time for the decoder to read the new position after a jump
+ *
+ * This is part of every measurement, however fast the audio path,
+ * so it is found separately using the decoder in this program.
+ *
+ * Return: time in seconds, or -1.0 if the position was not read
+ */
+
+static double decode_time(struct timecode_def *def)
+{
+    struct timecoder tc;
+    struct generator g;
+    signed short pcm[16 * 2];
+    unsigned long n;
+    signed int target;
+    double r;
+
+    timecoder_init(&tc, def, 1.0, rate, false);
+
+    g = at[0];
+    for (n = 0; n < WARMUP * rate; n += 16) {
+        generator_run(&g, pcm, 16);
+        timecoder_submit(&tc, pcm, 16);
+    }
+
+    g = at[1];
+    target = (BASE + JUMP) * def->resolution;
+    r = -1.0;
+
+    for (n = 0; n < TIMEOUT * rate; n += 16) {
+        signed int p;
+
+        generator_run(&g, pcm, 16);
+        timecoder_submit(&tc, pcm, 16);
+
+        p = timecoder_get_position(&tc, NULL);
+        if (p != -1 && abs(p - target) < def->resolution) {
+            r = (double)n / rate;
+            break;
+        }
+    }
+
+    timecoder_clear(&tc);
+
+    return r;
+}
+
+static int cmp(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+static double percentile(double p)
+{
+    size_t n;
+
+    n = p * (measured - 1) + 0.5;
+    return result[n] * 1000.0;
+}
+
+static void report(double decode)
+{
+    qsort(result, measured, sizeof *result, cmp);
+
+    printf("%u changes measured, %u missed\n", measured, missed);
+    if (measured == 0)
+        return;
+
+    printf("latency (ms): min %.1f, median %.1f, p90 %.1f, p99 %.1f, "
+           "max %.1f\n",
+           percentile(0.0), percentile(0.5), percentile(0.9),
+           percentile(0.99), percentile(1.0));
+
+    if (decode >= 0.0) {
+        printf("of which %.1fms is reading the timecode after a jump\n",
+               decode * 1000.0);
+    }
+}
+
+/*
+ * Write the test track, as a WAV file which the importer can read
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static void put(FILE *f, unsigned long v, size_t bytes)
+{
+    while (bytes--) {
+        fputc(v & 0xff, f);
+        v >>= 8;
+    }
+}
+
+static int write_track(const char *pathname)
+{
+    FILE *f;
+    unsigned long s, length;
+
+    f = fopen(pathname, "wb");
+    if (f == NULL) {
+        perror("fopen");
+        return -1;
+    }
+
+    length = (SILENCE + TONE) * rate;
+
+    fputs("RIFF", f);
+    put(f, 36 + length * 4, 4);
+    fputs("WAVEfmt ", f);
+    put(f, 16, 4);
+    put(f, 1, 2); /* PCM */
+    put(f, 2, 2);
+    put(f, rate, 4);
+    put(f, rate * 4, 4);
+    put(f, 4, 2);
+    put(f, 16, 2);
+    fputs("data", f);
+    put(f, length * 4, 4);
+
+    for (s = 0; s < length; s++) {
+        signed short v;
+
+        if (s < SILENCE * rate)
+            v = 0;
+        else
+            v = sin(2 * M_PI * TONE_HZ * s / rate) * SHRT_MAX / 2;
+
+        put(f, (unsigned short)v, 2);
+        put(f, (unsigned short)v, 2);
+    }
+
+    if (fclose(f) != 0) {
+        perror("fclose");
+        return -1;
+    }
+
+    return 0;
+}
+
+#ifdef WITH_ALSA
+
+static bool chk(const char *s, int r)
+{
+    if (r < 0) {
+        fprintf(stderr, "ALSA %s: %s\n", s, snd_strerror(r));
+        return false;
+    } else {
+        return true;
+    }
+}
+
+static int pcm_open(snd_pcm_t **pcm, const char *device,
+                    snd_pcm_stream_t stream, unsigned int period)
+{
+    int r;
+    snd_pcm_hw_params_t *hw_params;
+
+    r = snd_pcm_open(pcm, device, stream, 0);
+    if (!chk("open", r))
+        return -1;
+
+    snd_pcm_hw_params_alloca(&hw_params);
+
+    r = snd_pcm_hw_params_any(*pcm, hw_params);
+    if (!chk("hw_params_any", r))
+        return -1;
+
+    r = snd_pcm_hw_params_set_access(*pcm, hw_params,
+                                     SND_PCM_ACCESS_RW_INTERLEAVED);
+    if (!chk("hw_params_set_access", r))
+        return -1;
+
+    r = snd_pcm_hw_params_set_format(*pcm, hw_params, SND_PCM_FORMAT_S16);
+    if (!chk("hw_params_set_format", r))
+        return -1;
+
+    r = snd_pcm_hw_params_set_rate(*pcm, hw_params, rate, 0);
+    if (!chk("hw_params_set_rate", r))
+        return -1;
+
+    r = snd_pcm_hw_params_set_channels(*pcm, hw_params, 2);
+    if (!chk("hw_params_set_channels", r))
+        return -1;
+
+    r = snd_pcm_hw_params_set_period_size(*pcm, hw_params, period, 0);
+    if (!chk("hw_params_set_period_size", r))
+        return -1;
+
+    r = snd_pcm_hw_params_set_buffer_size(*pcm, hw_params,
+                                          period * BUFFER_PERIODS);
+    if (!chk("hw_params_set_buffer_size", r))
+        return -1;
+
+    r = snd_pcm_hw_params(*pcm, hw_params);
+    if (!chk("hw_params", r))
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Run the measurement on the other side of an ALSA loopback from
+ * the deck, eg. hw:Loopback,1 where xwax uses hw:Loopback,0
+ *
+ * Return: 0 on success, or -1 on error or an xrun
+ */
+
+static int run_alsa(const char *device, unsigned int period)
+{
+    int r;
+    unsigned int n;
+    snd_pcm_t *capture, *playback;
+    signed short buf[MAX_PERIOD * 2];
+
+    if (period > MAX_PERIOD) {
+        fprintf(stderr, "Period of %u samples is too large\n", period);
+        return -1;
+    }
+
+    if (pcm_open(&capture, device, SND_PCM_STREAM_CAPTURE, period) == -1)
+        return -1;
+    if (pcm_open(&playback, device, SND_PCM_STREAM_PLAYBACK, period) == -1)
+        return -1;
+
+    /* Start both streams together, so their frames are of the
+     * same time */
+
+    r = snd_pcm_link(capture, playback);
+    if (!chk("link", r))
+        return -1;
+
+    for (n = 0; n < BUFFER_PERIODS; n++) {
+        generate(buf, period);
+        r = snd_pcm_writei(playback, buf, period);
+        if (!chk("writei", r))
+            return -1;
+    }
+
+    if (snd_pcm_state(playback) == SND_PCM_STATE_PREPARED) {
+        r = snd_pcm_start(playback);
+        if (!chk("start", r))
+            return -1;
+    }
+
+    while (!finished) {
+        r = snd_pcm_readi(capture, buf, period);
+        if (!chk("readi", r))
+            break;
+        analyse(buf, r);
+
+        generate(buf, period);
+        r = snd_pcm_writei(playback, buf, period);
+        if (!chk("writei", r))
+            break;
+    }
+
+    if (snd_pcm_close(playback) < 0)
+        abort();
+    if (snd_pcm_close(capture) < 0)
+        abort();
+
+    if (!finished) {
+        fprintf(stderr, "The streams were interrupted; a larger period "
+                "may be needed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif
+
+#ifdef WITH_JACK
+
+static jack_port_t *port_in[2], *port_out[2];
+
+/*
+ * Process callback of the JACK client
+ *
+ * Both streams are in the same cycle, and the deck is a client
+ * of the same graph.
+ */
+
+static int process(jack_nframes_t nframes, void *arg)
+{
+    jack_default_audio_sample_t *in[2], *out[2];
+    signed short buf[MAX_PERIOD * 2];
+    jack_nframes_t s;
+    int c;
+
+    if (nframes > MAX_PERIOD)
+        return -1;
+
+    for (c = 0; c < 2; c++) {
+        in[c] = jack_port_get_buffer(port_in[c], nframes);
+        out[c] = jack_port_get_buffer(port_out[c], nframes);
+    }
+
+    for (s = 0; s < nframes; s++) {
+        for (c = 0; c < 2; c++)
+            buf[s * 2 + c] = in[c][s] * SHRT_MAX;
+    }
+
+    analyse(buf, nframes);
+    generate(buf, nframes);
+
+    for (s = 0; s < nframes; s++) {
+        for (c = 0; c < 2; c++)
+            out[c][s] = (jack_default_audio_sample_t)buf[s * 2 + c] / SHRT_MAX;
+    }
+
+    return 0;
+}
+
+/*
+ * Run the measurement as a JACK client, with its ports connected to
+ * those of the deck, directly or through a loopback
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int run_jack(const char *name)
+{
+    static const char *names[] = { "timecode_L", "timecode_R",
+                                   "deck_L", "deck_R" };
+    jack_client_t *client;
+    jack_status_t status;
+    int c;
+
+    client = jack_client_open(name, JackNullOption, &status);
+    if (client == NULL) {
+        fprintf(stderr, "JACK client could not be opened\n");
+        return -1;
+    }
+
+    if (jack_get_sample_rate(client) != rate) {
+        fprintf(stderr, "JACK is running at %uHz; use -r %u\n",
+                jack_get_sample_rate(client), jack_get_sample_rate(client));
+        jack_client_close(client);
+        return -1;
+    }
+
+    for (c = 0; c < 2; c++) {
+        port_out[c] = jack_port_register(client, names[c],
+                                         JACK_DEFAULT_AUDIO_TYPE,
+                                         JackPortIsOutput, 0);
+        port_in[c] = jack_port_register(client, names[c + 2],
+                                        JACK_DEFAULT_AUDIO_TYPE,
+                                        JackPortIsInput, 0);
+        if (port_out[c] == NULL || port_in[c] == NULL) {
+            fprintf(stderr, "JACK port could not be registered\n");
+            jack_client_close(client);
+            return -1;
+        }
+    }
+
+    if (jack_set_process_callback(client, process, NULL) != 0 ||
+        jack_activate(client) != 0)
+    {
+        fprintf(stderr, "JACK client could not be activated\n");
+        jack_client_close(client);
+        return -1;
+    }
+
+    fprintf(stderr, "Connect %s:timecode_L/R to the deck's timecode input, "
+            "and its playback to %s:deck_L/R\n", name, name);
+
+    while (!finished)
+        sleep(1);
+
+    jack_client_close(client);
+
+    return 0;
+}
+
+#endif
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-r <hz>] [-p <samples>] [-t <timecode>] "
+            "[-n <jumps>] -a <device> | -j <name> | -w <file>\n"
+            "\n"
+            "  -a  ALSA device on the other side of a loopback to the deck\n"
+            "  -j  Run as a JACK client of the given name\n"
+            "  -w  Write the test track to load on the deck, and exit\n"
+            "  -r  Sample rate (default %d)\n"
+            "  -p  Period of the ALSA device (default %d)\n"
+            "  -t  Timecode to generate (default %s)\n"
+            "  -n  Number of jumps to measure (default %d)\n",
+            argv0, DEFAULT_RATE, DEFAULT_PERIOD, DEFAULT_TIMECODE,
+            DEFAULT_JUMPS);
+}
+
+int main(int argc, char *argv[])
+{
+    int c, r;
+    unsigned int period;
+    const char *alsa, *jack, *track, *name;
+    struct timecode_def *def;
+
+    rate = DEFAULT_RATE;
+    period = DEFAULT_PERIOD;
+    jumps = DEFAULT_JUMPS;
+    name = DEFAULT_TIMECODE;
+    alsa = NULL;
+    jack = NULL;
+    track = NULL;
+
+    while ((c = getopt(argc, argv, "a:j:w:r:p:t:n:h")) != -1) {
+        switch (c) {
+        case 'a':
+            alsa = optarg;
+            break;
+        case 'j':
+            jack = optarg;
+            break;
+        case 'w':
+            track = optarg;
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 'p':
+            period = atoi(optarg);
+            break;
+        case 't':
+            name = optarg;
+            break;
+        case 'n':
+            jumps = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (rate < 8000) {
+        fprintf(stderr, "Sample rate must be at least 8000Hz\n");
+        return -1;
+    }
+
+    if (track != NULL)
+        return write_track(track) == -1 ? -1 : 0;
+
+    if (jumps < 1 || jumps > MAX_JUMPS) {
+        fprintf(stderr, "Jumps must be 1 to %d\n", MAX_JUMPS);
+        return -1;
+    }
+
+    def = timecoder_find_definition(name);
+    if (def == NULL) {
+        fprintf(stderr, "Timecode '%s' is not known\n", name);
+        return -1;
+    }
+
+    generator_init(&at[0], def, rate);
+    generator_seek(&at[0], BASE);
+    generator_init(&at[1], def, rate);
+    generator_seek(&at[1], BASE + JUMP);
+
+    gen = at[0];
+    tone = false;
+    next_jump = WARMUP * rate;
+
+    fprintf(stderr, "Play the test track on a deck under %s timecode\n",
+            def->desc);
+
+    if (alsa != NULL) {
+#ifdef WITH_ALSA
+        printf("ALSA %s, %uHz, period %u\n", alsa, rate, period);
+        r = run_alsa(alsa, period);
+#else
+        (void)period;
+        fprintf(stderr, "ALSA is not compiled in\n");
+        r = -1;
+#endif
+    } else if (jack != NULL) {
+#ifdef WITH_JACK
+        printf("JACK %s, %uHz\n", jack, rate);
+        r = run_jack(jack);
+#else
+        fprintf(stderr, "JACK is not compiled in\n");
+        r = -1;
+#endif
+    } else {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (r == 0)
+        report(decode_time(def));
+
+    timecoder_free_lookup();
+
+    if (r == -1)
+        return -1;
+
+    return 0;
+}
@@ -17,7 +17,7 @@
  *
  */
 
-#define _GNU_SOURCE /* strdupa() */
+#define _GNU_SOURCE /* asprintf(), strdupa() */
 #include <assert.h>
 #include <errno.h>
 #include <iconv.h>
@@ -30,9 +30,19 @@
 
 #include "excrate.h"
 #include "external.h"
+#include "hash.h"
+#include "metrics.h"
 
 #define CRATE_ALL "All records"
 
+/* Separate the names of a folder and its content in a crate's key;
+ * lower than any printable character, so that a folder's content
+ * sorts directly after it */
+
+#define KEY_SEPARATOR "\x01"
+
+#define MIN_CRATES 64
+
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
 
 /* The locale used for searches */
@@ -65,7 +75,10 @@ void listing_init(struct listing *l)
     index_init(&l->by_artist);
     index_init(&l->by_bpm);
     index_init(&l->by_order);
+    l->by_pathname = NULL;
     event_init(&l->addition);
+    l->deferred = false;
+    index_init(&l->pending);
 }
 
 void listing_clear(struct listing *l)
@@ -74,6 +87,31 @@ void listing_clear(struct listing *l)
     index_clear(&l->by_bpm);
     index_clear(&l->by_order);
     event_clear(&l->addition);
+    index_clear(&l->pending);
+}
+
+/*
+ * Return: key of a crate with the given name in a folder, or NULL on
+ * memory allocation failure
+ */
+
+static char* make_key(const struct crate *parent, const char *name)
+{
+    char *key;
+
+    if (parent == NULL) {
+        key = strdup(name);
+        if (key == NULL)
+            perror("strdup");
+        return key;
+    }
+
+    if (asprintf(&key, "%s" KEY_SEPARATOR "%s", parent->key, name) == -1) {
+        perror("asprintf");
+        return NULL;
+    }
+
+    return key;
 }
 
 /*
@@ -84,7 +122,8 @@ void listing_clear(struct listing *l)
  * Return: 0 on success or -1 on memory allocation failure
  */
 
-static int crate_init(struct crate *c, const char *name)
+static int crate_init(struct crate *c, struct crate *parent,
+                      const char *name)
 {
     c->name = strdup(name);
     if (c->name == NULL) {
@@ -92,6 +131,14 @@ static int crate_init(struct crate *c, const char *name)
         return -1;
     }
 
+    c->key = make_key(parent, name);
+    if (c->key == NULL) {
+        free(c->name);
+        return -1;
+    }
+
+    c->parent = parent;
+    c->depth = (parent == NULL) ? 0 : parent->depth + 1;
     c->is_busy = false;
 
     event_init(&c->activity);
@@ -131,7 +178,7 @@ static void propagate_completion(struct observer *o, void *x)
 
 static int crate_init_all(struct library *l, struct crate *c, const char *name)
 {
-    if (crate_init(c, name) == -1)
+    if (crate_init(c, NULL, name) == -1)
         return -1;
 
     c->is_fixed = true;
@@ -176,7 +223,7 @@ static int crate_init_scan(struct library *l, struct crate *c, const char *name,
 {
     struct excrate *e;
 
-    if (crate_init(c, name) == -1)
+    if (crate_init(c, NULL, name) == -1)
         return -1;
 
     c->is_fixed = false;
@@ -235,14 +282,20 @@ static void crate_clear(struct crate *c)
         excrate_release(c->excrate);
     }
 
+    if (c->listing == &c->local)
+        listing_clear(&c->local);
+
     event_clear(&c->activity);
     event_clear(&c->refresh);
     event_clear(&c->addition);
+    free(c->key);
     free(c->name);
 }
 
 /*
  * Comparison function for two crates
+ *
+ * The content of a folder follows the folder itself.
  */
 
 static int crate_cmp(const struct crate *a, const struct crate *b)
@@ -252,12 +305,15 @@ static int crate_cmp(const struct crate *a, const struct crate *b)
     if (!a->is_fixed && b->is_fixed)
         return 1;
 
-    return strcmp(a->name, b->name);
+    return strcmp(a->key, b->key);
 }
 
 /*
  * Add a record into a crate and its various indexes
  *
+ * Where the listing has a table by pathname, an existing record is
+ * found there without a search of the sorted index.
+ *
  * Return: Pointer to existing entry, NULL if out of memory
  * Post: Record added to the crate
  */
@@ -265,12 +321,35 @@ static int crate_cmp(const struct crate *a, const struct crate *b)
 struct record* listing_add(struct listing *l, struct record *r)
 {
     struct record *x;
+    size_t n;
 
     assert(r != NULL);
 
+    if (l->by_pathname != NULL) {
+        x = path_index_match(l->by_pathname, r);
+        if (x != NULL)
+            return x;
+    }
+
     /* Do all the memory reservation up-front as we can't
      * un-wind if it errors later */
 
+    if (l->by_pathname != NULL) {
+        if (path_index_reserve(l->by_pathname, 1) == -1)
+            return NULL;
+    }
+
+    if (l->deferred) {
+        if (index_reserve(&l->pending, 1) == -1)
+            return NULL;
+
+        index_add(&l->pending, r);
+        if (l->by_pathname != NULL)
+            path_index_add(l->by_pathname, r);
+
+        return r;
+    }
+
     if (index_reserve(&l->by_artist, 1) == -1)
         return NULL;
     if (index_reserve(&l->by_bpm, 1) == -1)
@@ -278,9 +357,10 @@ struct record* listing_add(struct listing *l, struct record *r)
     if (index_reserve(&l->by_order, 1) == -1)
         return NULL;
 
+    n = l->by_artist.entries;
     x = index_insert(&l->by_artist, r, SORT_ARTIST);
     assert(x != NULL);
-    if (x != r)
+    if (l->by_artist.entries == n) /* existing entry, maybe r itself */
         return x;
 
     x = index_insert(&l->by_bpm, r, SORT_BPM);
@@ -288,54 +368,259 @@ struct record* listing_add(struct listing *l, struct record *r)
 
     index_add(&l->by_order, r);
 
+    if (l->by_pathname != NULL)
+        path_index_add(l->by_pathname, r);
+
     fire(&l->addition, r);
     return r;
 }
 
 /*
- * Comparison function, see qsort(3)
+ * Defer the sorting of additions to the listing, for when many
+ * records are added at once
+ *
+ * Until listing_commit(), records are held aside and are not yet in
+ * the indexes. A duplicate is only detected at this point if the
+ * listing has a table by pathname.
  */
 
-static int qcompar(const void *a, const void *b)
+void listing_defer(struct listing *l)
 {
-    return crate_cmp(*(struct crate**)a, *(struct crate**)b);
+    assert(!l->deferred);
+    l->deferred = true;
 }
 
 /*
- * Sort all crates into a defined order
+ * Sort any deferred additions into the listing in one pass
+ *
+ * Return: 0 on success, -1 on memory allocation failure
+ * Post: listing is no longer deferred
+ * Post: on error, the additions are still held aside, for a later
+ * commit or for library_clear() to free
  */
 
-static void sort_crates(struct library *lib)
+int listing_commit(struct listing *l)
 {
-    qsort(lib->crate, lib->crates, sizeof(struct crate*), qcompar);
+    size_t n, z;
+    struct record_set seen;
+    struct index *p;
+    int r;
+
+    assert(l->deferred);
+    l->deferred = false;
+
+    p = &l->pending;
+    if (p->entries == 0)
+        return 0;
+    r = -1;
+
+    record_set_init(&seen);
+
+    if (record_set_reserve(&seen) == -1)
+        goto done;
+    if (index_reserve(&l->by_artist, p->entries) == -1)
+        goto done;
+    if (index_reserve(&l->by_bpm, p->entries) == -1)
+        goto done;
+    if (index_reserve(&l->by_order, p->entries) == -1)
+        goto done;
+
+    /* Remove any duplicates, keeping the first in order of addition */
+
+    z = 0;
+
+    for (n = 0; n < p->entries; n++) {
+        struct record *re;
+        size_t m;
+
+        re = index_record(p, n);
+
+        if (record_set_has(&seen, re->id))
+            continue;
+        record_set_add(&seen, re->id);
+
+        m = index_find(&l->by_artist, re, SORT_ARTIST);
+        if (m < l->by_artist.entries && index_record(&l->by_artist, m) == re)
+            continue;
+
+        p->id[z++] = re->id;
+        index_add(&l->by_order, re);
+    }
+
+    p->entries = z;
+
+    index_sort(p, SORT_ARTIST);
+    index_merge(&l->by_artist, p, SORT_ARTIST);
+    index_sort(p, SORT_BPM);
+    index_merge(&l->by_bpm, p, SORT_BPM);
+
+    for (n = l->by_order.entries - z; n < l->by_order.entries; n++)
+        fire(&l->addition, index_record(&l->by_order, n));
+
+    index_blank(p);
+    r = 0;
+
+done:
+    record_set_clear(&seen);
+    return r;
+}
+
+/*
+ * Return: the position in the sorted order of all crates at which
+ * the given crate belongs
+ */
+
+static size_t find_position(const struct library *lib, const struct crate *c)
+{
+    size_t lo, hi;
+
+    lo = 0;
+    hi = lib->crates;
+
+    while (lo < hi) {
+        size_t mid;
+
+        mid = lo + (hi - lo) / 2;
+        if (crate_cmp(lib->crate[mid], c) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/*
+ * Place a crate in the table of crates by key
+ *
+ * Pre: table has at least one empty slot
+ */
+
+static void insert(struct crate **bucket, size_t buckets, struct crate *c)
+{
+    size_t n;
+
+    n = fnv1a_32(c->key) & (buckets - 1);
+    while (bucket[n] != NULL)
+        n = (n + 1) & (buckets - 1);
+
+    bucket[n] = c;
+}
+
+/*
+ * Enlarge the table of crates by key, so it is no more than half full
+ * after adding the given number of crates
+ *
+ * Return: 0 on success or -1 on memory allocation failure
+ */
+
+static int reserve_buckets(struct library *lib, size_t n)
+{
+    size_t buckets, i;
+    struct crate **bucket;
+
+    buckets = lib->buckets ? lib->buckets : MIN_CRATES;
+    while (buckets < (lib->crates + n) * 2)
+        buckets *= 2;
+
+    if (buckets == lib->buckets)
+        return 0;
+
+    bucket = calloc(buckets, sizeof *bucket);
+    if (bucket == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    for (i = 0; i < lib->crates; i++)
+        insert(bucket, buckets, lib->crate[i]);
+
+    free(lib->bucket);
+    lib->bucket = bucket;
+    lib->buckets = buckets;
+
+    return 0;
 }
 
 /*
  * Add a crate to the list of all crates
  *
+ * The crate is inserted in its place in the sorted order, so that
+ * library_crate() has no need to modify the library.
+ *
  * Return: 0 on success or -1 on memory allocation failure
  */
 
 static int add_crate(struct library *lib, struct crate *c)
 {
-    struct crate **cn;
+    size_t n;
 
-    cn = realloc(lib->crate, sizeof(struct crate*) * (lib->crates + 1));
-    if (cn == NULL) {
-        perror("realloc");
-        return -1;
+    if (lib->crates == lib->size) {
+        struct crate **cn;
+        size_t size;
+
+        size = lib->size ? lib->size * 2 : MIN_CRATES;
+
+        cn = realloc(lib->crate, sizeof(struct crate*) * size);
+        if (cn == NULL) {
+            perror("realloc");
+            return -1;
+        }
+
+        lib->crate = cn;
+        lib->size = size;
     }
 
-    lib->crate = cn;
-    lib->crate[lib->crates++] = c;
+    if (reserve_buckets(lib, 1) == -1)
+        return -1;
+
+    n = find_position(lib, c);
+    memmove(&lib->crate[n + 1], &lib->crate[n],
+            sizeof(struct crate*) * (lib->crates - n));
+    lib->crate[n] = c;
+    lib->crates++;
 
-    sort_crates(lib);
+    insert(lib->bucket, lib->buckets, c);
+    metric_set(&metric_crates, lib->crates);
 
     return 0;
 }
 
 /*
- * Get a crate by the given name
+ * Return: the crate with the given key, or NULL if there is none
+ */
+
+static struct crate* find_crate(const struct library *lib, const char *key)
+{
+    size_t n;
+
+    if (lib->buckets == 0)
+        return NULL;
+
+    n = fnv1a_32(key) & (lib->buckets - 1);
+
+    while (lib->bucket[n] != NULL) {
+        if (strcmp(lib->bucket[n]->key, key) == 0)
+            return lib->bucket[n];
+        n = (n + 1) & (lib->buckets - 1);
+    }
+
+    return NULL;
+}
+
+/*
+ * Find a record in the library by the pathname of its file
+ *
+ * Return: pointer to record, or NULL if the file is not known
+ */
+
+struct record* library_find(struct library *lib, const char *pathname)
+{
+    return path_index_find(&lib->pathnames, pathname);
+}
+
+/*
+ * Get a crate by the given name, which is not in a folder
  *
  * Beware: The match could match the fixed crates if the name is the
  * same.
@@ -345,13 +630,99 @@ static int add_crate(struct library *lib, struct crate *c)
 
 struct crate* get_crate(struct library *lib, const char *name)
 {
-    int n;
+    return find_crate(lib, name);
+}
+
+/*
+ * Get a crate in the sorted order of all crates
+ *
+ * Pre: n is less than the number of crates
+ */
+
+struct crate* library_crate(struct library *lib, size_t n)
+{
+    assert(n < lib->crates);
+    return lib->crate[n];
+}
+
+/*
+ * Choose the name of a new crate which is not in a folder, so that
+ * libraries of the same name from different paths are kept apart
+ *
+ * Return: name to be freed by the caller, or NULL on error
+ */
+
+char* library_unique_name(struct library *lib, const char *name)
+{
+    char *s;
+    unsigned int n;
 
-    for (n = 0; n < lib->crates; n++) {
-        if (strcmp(lib->crate[n]->name, name) == 0)
-            return lib->crate[n];
+    s = strdup(name);
+    if (s == NULL) {
+        perror("strdup");
+        return NULL;
+    }
+
+    for (n = 2; find_crate(lib, s) != NULL; n++) {
+        free(s);
+        if (asprintf(&s, "%s (%u)", name, n) == -1) {
+            perror("asprintf");
+            return NULL;
+        }
     }
 
+    return s;
+}
+
+/*
+ * Get a crate which holds its own records, such as a playlist or a
+ * folder of them, creating it if it does not exist
+ *
+ * Return: pointer to crate, or NULL on error
+ */
+
+struct crate* library_local(struct library *lib, struct crate *parent,
+                            const char *name)
+{
+    char *key;
+    struct crate *c;
+
+    key = make_key(parent, name);
+    if (key == NULL)
+        return NULL;
+
+    c = find_crate(lib, key);
+    free(key);
+    if (c != NULL)
+        return c;
+
+    c = malloc(sizeof *c);
+    if (c == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    if (crate_init(c, parent, name) == -1)
+        goto fail;
+
+    c->is_fixed = false;
+    c->scan = NULL;
+    c->path = NULL;
+    c->excrate = NULL;
+
+    listing_init(&c->local);
+    c->listing = &c->local;
+    watch(&c->on_addition, &c->listing->addition, propagate_addition);
+
+    if (add_crate(lib, c) == -1)
+        goto fail_crate;
+
+    return c;
+
+fail_crate:
+    crate_clear(c);
+fail:
+    free(c);
     return NULL;
 }
 
@@ -365,7 +736,12 @@ int library_init(struct library *li)
 {
     li->crate = NULL;
     li->crates = 0;
+    li->size = 0;
+    li->bucket = NULL;
+    li->buckets = 0;
     listing_init(&li->storage);
+    path_index_init(&li->pathnames);
+    li->storage.by_pathname = &li->pathnames;
 
     if (crate_init_all(li, &li->all, CRATE_ALL) == -1)
         return -1;
@@ -401,24 +777,39 @@ void library_clear(struct library *li)
     for (n = 0; n < li->storage.by_artist.entries; n++) {
         struct record *re;
 
-        re = li->storage.by_artist.record[n];
+        re = index_record(&li->storage.by_artist, n);
+        record_clear(re);
+    }
+
+    /* And any which an import failed to commit */
+
+    for (n = 0; n < li->storage.pending.entries; n++) {
+        struct record *re;
+
+        re = index_record(&li->storage.pending, n);
         record_clear(re);
-        free(re);
     }
 
     /* Clear crates */
 
-    for (n = 1; n < li->crates; n++) { /* skip the 'all' crate */
+    for (n = 0; n < li->crates; n++) {
         struct crate *crate;
 
         crate = li->crate[n];
+        if (crate == &li->all)
+            continue;
+
         crate_clear(crate);
         free(crate);
     }
     free(li->crate);
+    free(li->bucket);
+    metric_set(&metric_crates, 0);
 
     crate_clear(&li->all);
     listing_clear(&li->storage);
+    path_index_clear(&li->pathnames);
+    record_table_clear();
 }
 
 /*
@@ -525,7 +916,7 @@ static char* matchable(const char *artist, const char *title)
 /*
  * Convert a line from the scan script to a record structure in memory
  *
- * Return: pointer to alloc'd record, or NULL on error
+ * Return: pointer to new record in the table, or NULL on error
  * Post: if successful, responsibility for pointer line is taken
  */
 
@@ -535,11 +926,9 @@ struct record* get_record(char *line)
     struct record *x;
     char *field[4];
 
-    x = malloc(sizeof *x);
-    if (!x) {
-        perror("malloc");
+    x = record_new();
+    if (!x)
         return NULL;
-    }
 
     x->bpm = 0.0;
 
@@ -572,10 +961,12 @@ struct record* get_record(char *line)
 
     x->match = matchable(x->artist, x->title);
 
+    record_init_key(x);
+
     return x;
 
 bad:
-    free(x);
+    record_discard(x);
     return NULL;
 }
 
@@ -597,10 +988,14 @@ int library_import(struct library *li, const char *scan, const char *path)
     cratename = basename(pathname); /* POSIX version, see basename(3) */
     assert(cratename != NULL);
 
+    cratename = library_unique_name(li, cratename);
+    if (cratename == NULL)
+        return -1;
+
     crate = malloc(sizeof *crate);
     if (crate == NULL) {
         perror("malloc");
-        return -1;
+        goto fail_name;
     }
 
     if (crate_init_scan(li, crate, cratename, scan, path) == -1)
@@ -609,12 +1004,15 @@ int library_import(struct library *li, const char *scan, const char *path)
     if (add_crate(li, crate) == -1)
         goto fail_crate;
 
+    free(cratename);
     return 0;
 
 fail_crate:
     crate_clear(crate);
 fail:
     free(crate);
+fail_name:
+    free(cratename);
     return -1;
 
 }
@@ -30,14 +30,22 @@
 
 struct listing {
     struct index by_artist, by_bpm, by_order;
+    struct path_index *by_pathname; /* or NULL */
     struct event addition;
+
+    /* Additions which are not yet sorted, see listing_defer() */
+    bool deferred;
+    struct index pending;
 };
 
 /* A single crate of records */
 
 struct crate {
     bool is_fixed, is_busy;
-    char *name;
+    char *name,
+        *key; /* unique, including the names of any folders */
+    struct crate *parent; /* folder, or NULL */
+    unsigned int depth; /* of folders */
     struct listing *listing;
     struct observer on_addition, on_completion;
     struct event activity, /* at the crate level, not the listing */
@@ -46,14 +54,22 @@ struct crate {
     /* Optionally, the corresponding source */
     const char *scan, *path;
     struct excrate *excrate;
+
+    /* Otherwise, records held by the crate itself */
+    struct listing local;
 };
 
 /* The complete music library, which consists of multiple crates */
 
 struct library {
     struct listing storage; /* owns the record pointers */
-    struct crate all, **crate;
-    size_t crates;
+    struct path_index pathnames; /* of the storage */
+    struct crate all, **crate; /* see library_crate() */
+    size_t crates, size;
+
+    /* Open-addressed table of crates by key */
+    struct crate **bucket;
+    size_t buckets; /* power of two */
 };
 
 int library_global_init(void);
@@ -62,12 +78,22 @@ void library_global_clear(void);
 void listing_init(struct listing *l);
 void listing_clear(struct listing *l);
 struct record* listing_add(struct listing *l, struct record *r);
+void listing_defer(struct listing *l);
+int listing_commit(struct listing *l);
 
 int library_init(struct library *li);
 void library_clear(struct library *li);
 
 struct record* get_record(char *line);
 
+struct record* library_find(struct library *lib, const char *pathname);
+
+struct crate* get_crate(struct library *lib, const char *name);
+struct crate* library_crate(struct library *lib, size_t n);
+char* library_unique_name(struct library *lib, const char *name);
+struct crate* library_local(struct library *lib, struct crate *parent,
+                            const char *name);
+
 int library_import(struct library *lib, const char *scan, const char *path);
 int library_rescan(struct library *l, struct crate *c);
 
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 
 #include "lut.h"
+#include "metrics.h"
 
 /* The number of bits to form the hash, which governs the overall size
  * of the hash lookup table, and hence the amount of chaining */
@@ -62,6 +63,8 @@ int lut_init(struct lut *lut, int nslots)
         lut->table[n] = NO_SLOT;
 
     lut->avail = 0;
+    lut->bytes = bytes;
+    metric_add(&metric_lut_bytes, bytes);
 
     return 0;
 }
@@ -71,6 +74,7 @@ void lut_clear(struct lut *lut)
 {
     free(lut->table);
     free(lut->slot);
+    metric_add(&metric_lut_bytes, -(double)lut->bytes);
 }
 
 
@@ -31,6 +31,7 @@ struct lut {
     struct slot *slot;
     slot_no_t *table, /* hash -> slot lookup */
         avail; /* next available slot */
+    size_t bytes; /* allocated */
 };
 
 int lut_init(struct lut *lut, int nslots);
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "meter.h"
+#include "track.h"
+
+/* Response of each meter per sample, as a proportion of the distance
+ * to the input; a fast PPM-style meter and a slow overview */
+
+#define PPM_ATTACK (1.0f / 8)
+#define PPM_RELEASE (1.0f / 512)
+
+#define OVERVIEW_ATTACK (1.0f / 256)
+#define OVERVIEW_RELEASE (1.0f / 131072)
+
+/* Input relative to the level of a meter, over a window */
+
+struct excursion {
+    int rise, fall; /* total distance above and below */
+    int above; /* number of samples above */
+};
+
+/*
+ * Calculate the response to input above a meter, over a window
+ *
+ * Each sample's effect is taken against the level at the start of
+ * the window. Only the attack moves far enough within a window for
+ * this to matter, so it is corrected for the samples above the level
+ * acting in turn.
+ */
+
+static void init_attack(float *gain, float attack)
+{
+    unsigned int n;
+
+    gain[0] = 0.0;
+
+    for (n = 1; n <= METER_WINDOW; n++)
+        gain[n] = (1.0 - pow(1.0 - attack, n)) / n;
+}
+
+void meter_init(struct meter *m, unsigned int window)
+{
+    assert(window > 0 && window <= METER_WINDOW);
+    assert(TRACK_PPM_RES % window == 0);
+
+    m->window = window;
+    m->ppm = 0.0;
+    m->overview = 0.0;
+
+    init_attack(m->ppm_attack, PPM_ATTACK);
+    init_attack(m->overview_attack, OVERVIEW_ATTACK);
+}
+
+/*
+ * Measure the input of a window against the current meter levels
+ *
+ * Without branches, so that the compiler can vectorise it.
+ */
+
+static void measure(const signed short *pcm, size_t n,
+                    int ppm, int overview,
+                    struct excursion *p, struct excursion *o)
+{
+    size_t s;
+    int prise, pfall, pabove, orise, ofall, oabove;
+
+    prise = 0;
+    pfall = 0;
+    pabove = 0;
+    orise = 0;
+    ofall = 0;
+    oabove = 0;
+
+    for (s = 0; s < n; s++) {
+        int v;
+
+        v = abs(pcm[s * TRACK_CHANNELS]) + abs(pcm[s * TRACK_CHANNELS + 1]);
+
+        prise += (v > ppm) ? v - ppm : 0;
+        pfall += (v > ppm) ? 0 : ppm - v;
+        pabove += (v > ppm);
+
+        orise += (v > overview) ? v - overview : 0;
+        ofall += (v > overview) ? 0 : overview - v;
+        oabove += (v > overview);
+    }
+
+    p->rise = prise;
+    p->fall = pfall;
+    p->above = pabove;
+    o->rise = orise;
+    o->fall = ofall;
+    o->above = oabove;
+}
+
+/*
+ * Move a meter by the excursion of the input over a window
+ *
+ * Return: new level of the meter
+ */
+
+static float follow(float level, const struct excursion *e,
+                    const float *attack, float release)
+{
+    level += attack[e->above] * e->rise;
+    level -= release * e->fall;
+    if (level < 0.0f)
+        level = 0.0f;
+
+    return level;
+}
+
+/*
+ * Return: display value of a meter level, 0 to 255
+ */
+
+static unsigned char display(float level)
+{
+    if (level >= 65535.0f)
+        return 255;
+
+    return (unsigned int)level >> 8;
+}
+
+/*
+ * Meter new audio which has been placed in a block
+ *
+ * The meter values cover each window up to the most recent sample,
+ * so a partial window is updated again as the rest of it arrives.
+ */
+
+void meter_commit(struct meter *m, struct track_block *b,
+                  unsigned int fill, unsigned int samples)
+{
+    while (samples > 0) {
+        unsigned int n, last;
+        struct excursion p, o;
+
+        n = m->window - fill % m->window;
+        if (n > samples)
+            n = samples;
+
+        measure(b->pcm + TRACK_CHANNELS * fill, n, m->ppm, m->overview, &p, &o);
+
+        m->ppm = follow(m->ppm, &p, m->ppm_attack, PPM_RELEASE);
+        m->overview = follow(m->overview, &o,
+                             m->overview_attack, OVERVIEW_RELEASE);
+
+        last = fill + n - 1;
+        b->ppm[last / TRACK_PPM_RES] = display(m->ppm);
+        b->overview[last / TRACK_OVERVIEW_RES] = display(m->overview);
+
+        fill += n;
+        samples -= n;
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Meters of a track's audio, as it is imported
+ */
+
+#ifndef METER_H
+#define METER_H
+
+/* Followers are moved once per window of this many samples. The
+ * smaller compatibility window closely matches the per-sample meters
+ * of earlier versions, at some cost in speed */
+
+#define METER_WINDOW 64
+#define METER_COMPAT_WINDOW 8
+
+struct track_block;
+
+struct meter {
+    unsigned int window;
+    float ppm, overview; /* sum of both channels' magnitude */
+
+    /* Attack over a window, by the number of samples above */
+
+    float ppm_attack[METER_WINDOW + 1],
+        overview_attack[METER_WINDOW + 1];
+};
+
+void meter_init(struct meter *m, unsigned int window);
+void meter_commit(struct meter *m, struct track_block *b,
+                  unsigned int fill, unsigned int samples);
+
+#endif
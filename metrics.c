@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Registry of metrics, and export in the Prometheus text format
+ *
+ * Values are updated without locks from any thread; the registry
+ * itself is changed only outside of the realtime thread.
+ */
+
+#define _GNU_SOURCE /* asprintf() */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "thread.h"
+
+#define INTERVAL 1 /* seconds between writes of the file */
+
+struct metric
+    metric_xruns = METRIC(METRIC_COUNTER, "xwax_xruns_total", NULL,
+                          "Under- and overruns of the audio devices"),
+    metric_imports = METRIC(METRIC_COUNTER, "xwax_imports_total", NULL,
+                            "Tracks imported"),
+    metric_import_failures = METRIC(METRIC_COUNTER,
+                                    "xwax_import_failures_total", NULL,
+                                    "Tracks which failed to import"),
+    metric_import_bytes = METRIC(METRIC_COUNTER, "xwax_import_bytes_total",
+                                 NULL, "Audio read from the importer"),
+    metric_import_seconds = METRIC(METRIC_COUNTER,
+                                   "xwax_import_seconds_total", NULL,
+                                   "Time spent importing tracks"),
+    metric_track_bytes = METRIC(METRIC_GAUGE, "xwax_track_bytes", NULL,
+                                "Memory holding audio tracks"),
+    metric_lut_bytes = METRIC(METRIC_GAUGE, "xwax_lut_bytes", NULL,
+                              "Memory holding timecode lookup tables"),
+    metric_records = METRIC(METRIC_GAUGE, "xwax_library_records", NULL,
+                            "Records in the library"),
+    metric_crates = METRIC(METRIC_GAUGE, "xwax_library_crates", NULL,
+                           "Crates in the library"),
+    metric_searches = METRIC(METRIC_COUNTER, "xwax_searches_total", NULL,
+                             "Searches of the library"),
+    metric_search_seconds = METRIC(METRIC_COUNTER,
+                                   "xwax_search_seconds_total", NULL,
+                                   "Time spent searching the library");
+
+static struct metric *global[] = {
+    &metric_xruns,
+    &metric_imports,
+    &metric_import_failures,
+    &metric_import_bytes,
+    &metric_import_seconds,
+    &metric_track_bytes,
+    &metric_lut_bytes,
+    &metric_records,
+    &metric_crates,
+    &metric_searches,
+    &metric_search_seconds,
+};
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct list metrics = LIST_INIT(metrics);
+
+/* Writing of the file, see metrics_start() */
+
+static char *pathname, *tmp;
+static struct periodic periodic;
+
+void metrics_global_init(void)
+{
+    size_t n;
+
+    for (n = 0; n < ARRAY_SIZE(global); n++)
+        metric_register(global[n]);
+}
+
+void metrics_global_clear(void)
+{
+    size_t n;
+
+    for (n = 0; n < ARRAY_SIZE(global); n++)
+        metric_unregister(global[n]);
+}
+
+/*
+ * Initialise a metric which is not known to the program as a whole,
+ * eg. one for each deck
+ *
+ * Post: metric is zero, and not registered
+ */
+
+void metric_init(struct metric *m, int type, const char *name,
+                 const char *labels, const char *help)
+{
+    m->type = type;
+    m->name = name;
+    m->labels = labels;
+    m->help = help;
+    m->value = 0.0;
+    m->registered = false;
+}
+
+/*
+ * Make a metric visible in the output
+ *
+ * Metrics of the same name, but different labels, are kept together
+ * so that they are described only once.
+ */
+
+void metric_register(struct metric *m)
+{
+    struct list *pos;
+    struct metric *x;
+
+    if (pthread_mutex_lock(&lock) != 0)
+        abort();
+
+    if (!m->registered) {
+
+        /* After the last of the same name, otherwise at the end */
+
+        pos = &metrics;
+
+        list_for_each(x, &metrics, metrics) {
+            if (!strcmp(x->name, m->name))
+                pos = x->metrics.next;
+        }
+
+        list_add_tail(&m->metrics, pos);
+        m->registered = true;
+    }
+
+    if (pthread_mutex_unlock(&lock) != 0)
+        abort();
+}
+
+void metric_unregister(struct metric *m)
+{
+    if (pthread_mutex_lock(&lock) != 0)
+        abort();
+
+    if (m->registered) {
+        list_del(&m->metrics);
+        m->registered = false;
+    }
+
+    if (pthread_mutex_unlock(&lock) != 0)
+        abort();
+}
+
+/*
+ * Write all the registered metrics, in the Prometheus text format
+ *
+ * Return: 0 on success, otherwise -1
+ */
+
+int metrics_write(FILE *f)
+{
+    const char *name;
+    struct metric *m;
+
+    if (pthread_mutex_lock(&lock) != 0)
+        abort();
+
+    name = NULL;
+
+    list_for_each(m, &metrics, metrics) {
+        if (name == NULL || strcmp(name, m->name) != 0) {
+            fprintf(f, "# HELP %s %s\n", m->name, m->help);
+            fprintf(f, "# TYPE %s %s\n", m->name,
+                    m->type == METRIC_COUNTER ? "counter" : "gauge");
+            name = m->name;
+        }
+
+        if (m->labels != NULL)
+            fprintf(f, "%s{%s} %.17g\n", m->name, m->labels, metric_get(m));
+        else
+            fprintf(f, "%s %.17g\n", m->name, metric_get(m));
+    }
+
+    if (pthread_mutex_unlock(&lock) != 0)
+        abort();
+
+    return ferror(f) ? -1 : 0;
+}
+
+/*
+ * Replace the file with the current metrics
+ *
+ * A reader never sees a file which is partly written.
+ */
+
+static void write_file(void)
+{
+    FILE *f;
+
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        perror(tmp);
+        return;
+    }
+
+    if (metrics_write(f) == -1) {
+        perror(tmp);
+        fclose(f);
+        goto fail;
+    }
+
+    if (fclose(f) != 0) {
+        perror(tmp);
+        goto fail;
+    }
+
+    if (rename(tmp, pathname) == -1) {
+        perror("rename");
+        goto fail;
+    }
+
+    return;
+
+fail:
+    (void)unlink(tmp);
+}
+
+/*
+ * Write the metrics to a file at a regular interval, eg. for the
+ * 'textfile' collector of the Prometheus node exporter
+ *
+ * Return: 0 on success, otherwise -1
+ */
+
+int metrics_start(const char *path)
+{
+    pathname = strdup(path);
+    if (pathname == NULL) {
+        perror("strdup");
+        return -1;
+    }
+
+    if (asprintf(&tmp, "%s.%d", path, getpid()) == -1) {
+        perror("asprintf");
+        free(pathname);
+        return -1;
+    }
+
+    if (periodic_start(&periodic, write_file, INTERVAL) == -1) {
+        free(tmp);
+        free(pathname);
+        return -1;
+    }
+
+    return 0;
+}
+
+void metrics_stop(void)
+{
+    periodic_stop(&periodic);
+
+    free(tmp);
+    free(pathname);
+}
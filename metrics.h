@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Counters and gauges for monitoring the health of the rig
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "list.h"
+
+#define METRIC_COUNTER 0
+#define METRIC_GAUGE   1
+
+struct metric {
+    int type;
+    const char *name, *help,
+        *labels; /* eg. 'deck="0"', or NULL */
+
+    double value; /* atomic, see metric_add() */
+
+    bool registered;
+    struct list metrics;
+};
+
+#define METRIC(t, n, l, h) { .type = (t), .name = (n), .labels = (l), \
+                             .help = (h), .value = 0.0 }
+
+/* Metrics of the program as a whole */
+
+extern struct metric metric_xruns,
+    metric_imports, metric_import_failures,
+    metric_import_bytes, metric_import_seconds,
+    metric_track_bytes, metric_lut_bytes,
+    metric_records, metric_crates,
+    metric_searches, metric_search_seconds;
+
+void metrics_global_init(void);
+void metrics_global_clear(void);
+
+void metric_init(struct metric *m, int type, const char *name,
+                 const char *labels, const char *help);
+void metric_register(struct metric *m);
+void metric_unregister(struct metric *m);
+
+int metrics_write(FILE *f);
+
+int metrics_start(const char *pathname);
+void metrics_stop(void);
+
+/*
+ * Update a metric, from any thread
+ *
+ * These never block, so they are safe to use in the realtime thread.
+ */
+
+static inline void metric_add(struct metric *m, double x)
+{
+    double old, new;
+
+    __atomic_load(&m->value, &old, __ATOMIC_RELAXED);
+
+    do {
+        new = old + x;
+    } while (!__atomic_compare_exchange(&m->value, &old, &new, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static inline void metric_inc(struct metric *m)
+{
+    metric_add(m, 1.0);
+}
+
+static inline void metric_set(struct metric *m, double x)
+{
+    __atomic_store(&m->value, &x, __ATOMIC_RELAXED);
+}
+
+static inline double metric_get(struct metric *m)
+{
+    double x;
+
+    __atomic_load(&m->value, &x, __ATOMIC_RELAXED);
+    return x;
+}
+
+/*
+ * Return: a monotonic time in seconds, to measure durations from
+ */
+
+static inline double metrics_now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+#endif
@@ -22,12 +22,9 @@
  * with xwax.
  */
 
-#define _GNU_SOURCE /* sincos() */
-#include <assert.h>
-#include <limits.h>
-#include <math.h>
 #include <stdio.h>
-#include <stdlib.h>
+
+#include "generator.h"
 
 #define BANNER "xwax timecode generator " \
     "(C) Copyright 2021 Mark Hills <mark@xwax.org>"
@@ -40,50 +37,15 @@
 
 #define MAX(x,y) ((x)>(y)?(x):(y))
 
-typedef unsigned int bits_t;
-
-/*
- * Calculate the next bit in the LFSR sequence
- */
-
-static inline bits_t lfsr(bits_t code, bits_t taps)
-{
-    bits_t taken;
-    int xrs;
-
-    taken = code & taps;
-    xrs = 0;
-    while (taken != 0x0) {
-        xrs += taken & 0x1;
-        taken >>= 1;
-    }
-
-    return xrs & 0x1;
-}
-
-/*
- * LFSR in the forward direction
- */
-
-static inline bits_t fwd(bits_t current, bits_t taps, unsigned int nbits)
-{
-    bits_t l;
-
-    /* New bits are added at the MSB; shift right by one */
-
-    l = lfsr(current, taps | 0x1);
-    return (current >> 1) | (l << (nbits - 1));
-}
-
-static inline double dither(void)
-{
-    return (double)(rand() % 32768) / 32768.0 - 0.5;
-}
-
 int main(int argc, char *argv[])
 {
-    unsigned int s;
-    bits_t b;
+    struct timecode_def def = {
+        .resolution = RESOLUTION,
+        .bits = BITS,
+        .seed = SEED,
+        .taps = TAPS,
+    };
+    struct generator g;
     int length;
 
     fputs(BANNER, stderr);
@@ -92,40 +54,19 @@ int main(int argc, char *argv[])
     fprintf(stderr, "Generating %d-bit %dHz timecode sampled at %dKhz\n",
             BITS, RESOLUTION, RATE);
 
-    b = SEED;
+    generator_init(&g, &def, RATE);
     length = 0;
 
-    for (s = 0; ; s++) {
-        double time, cycle, angle, modulate, x, y;
+    for (;;) {
         signed short c[2];
 
-        time = (double)s / RATE;
-        cycle = time * RESOLUTION;
-        angle = cycle * M_PI * 2;
-
-        sincos(angle, &x, &y);
-
-        /* Modulate the waveform according to the bitstream */
-
-        modulate = 1.0 - (-cos(angle) + 1.0) * 0.25 * ((b & 0x1) == 0);
-        x *= modulate;
-        y *= modulate;
-
-        /* Write out 16-bit PCM data */
-
-        c[0] = -y * SHRT_MAX * 0.5 + dither();
-        c[1] = x * SHRT_MAX * 0.5 + dither();
-
+        generator_run(&g, c, 1);
         fwrite(c, sizeof(signed short), 2, stdout);
 
-        /* Advance the bitstream if required */
-
-        if ((int)cycle > length) {
-            assert((int)cycle - length == 1);
-            b = fwd(b, TAPS, BITS);
-            if (b == SEED) /* LFSR period reached */
+        if (g.n > length) {
+            if (g.bits == SEED) /* LFSR period reached */
                 break;
-            length = cycle;
+            length = g.n;
         }
     }
 
@@ -20,31 +20,35 @@
 #ifndef PITCH_H
 #define PITCH_H
 
-/* Values for the filter concluded experimentally */
+/* Values for the filter concluded experimentally. Observations are
+ * taken from the phase of the signal, so they are smooth enough to
+ * allow a faster response than with quantised zero crossings */
 
-#define ALPHA (1.0/512)
+#define ALPHA (1.0/128)
 #define BETA (ALPHA/256)
 
 /* State of the pitch calculation filter */
 
 struct pitch {
-    double dt, x, v;
+    double dt, x, v, alpha, beta;
 };
 
-/* Prepare the filter for observations every dt seconds */
+/* Prepare the filter for observations every dt seconds, where each
+ * observation spans the given number of input samples. The gains are
+ * scaled so that the response in time is the same as if every sample
+ * had been observed */
 
-static inline void pitch_init(struct pitch *p, double dt)
+static inline void pitch_init(struct pitch *p, double dt, unsigned int stride)
 {
     p->dt = dt;
+    p->alpha = ALPHA * stride;
+    p->beta = BETA * stride * stride;
     p->x = 0.0;
     p->v = 0.0;
 }
 
 /* Input an observation to the filter; in the last dt seconds the
- * position has moved by dx.
- *
- * Because the vinyl uses timestamps, the values for dx are discrete
- * rather than smooth. */
+ * position has moved by dx. */
 
 static inline void pitch_dt_observation(struct pitch *p, double dx)
 {
@@ -55,8 +59,8 @@ static inline void pitch_dt_observation(struct pitch *p, double dx)
 
     residual_x = dx - predicted_x;
 
-    p->x = predicted_x + residual_x * ALPHA;
-    p->v = predicted_v + residual_x * BETA / p->dt;
+    p->x = predicted_x + residual_x * p->alpha;
+    p->v = predicted_v + residual_x * p->beta / p->dt;
 
     p->x -= dx; /* relative to previous */
 }
@@ -29,6 +29,7 @@
 #include "player.h"
 #include "track.h"
 #include "timecoder.h"
+#include "trace.h"
 
 /* Bend playback speed to compensate for the difference between our
  * current position and that given by the timecode */
@@ -48,6 +49,18 @@
 
 #define VOLUME (7.0/8)
 
+/* Audio for the next period is fetched into the cache, in the
+ * direction of play, a cache line at a time */
+
+#define LINE_SAMPLES (64 / (sizeof(signed short) * TRACK_CHANNELS))
+#define MAX_LINES 256
+
+/* The next track in the queue is mixed in this many seconds before
+ * the end of the current one, a chunk at a time */
+
+#define DEFAULT_CROSSFADE 4.0
+#define CROSSFADE_CHUNK 256
+
 #define SQ(x) ((x)*(x))
 #define TARGET_UNKNOWN INFINITY
 
@@ -69,6 +82,23 @@ static inline double cubic_interpolate(signed short y[4], double mu)
     return (mu * mu2 * a0) + (mu2 * a1) + (mu * a2) + a3;
 }
 
+/*
+ * As cubic_interpolate(), for a window already mixed from stems
+ */
+
+static inline double cubic_interpolate_mix(const double y[4], double mu)
+{
+    double a0, a1, a2, a3, mu2;
+
+    mu2 = SQ(mu);
+    a0 = y[3] - y[2] - y[0] + y[1];
+    a1 = y[0] - y[1] - a0;
+    a2 = y[2] - y[0];
+    a3 = y[1];
+
+    return (mu * mu2 * a0) + (mu2 * a1) + (mu * a2) + a3;
+}
+
 /*
  * Return: Random dither, between -0.5 and 0.5
  */
@@ -94,6 +124,39 @@ static double dither(void)
     return (double)v / 4096 - 0.5; /* not quite whole range */
 }
 
+/*
+ * Request audio into the cache ahead of its use
+ *
+ * The hardware prefetcher does not follow a fast scratch, especially
+ * backwards, so the audio is requested in the direction of play.
+ */
+
+static void prefetch(struct track *tr, double sample, double span,
+                     unsigned int stems)
+{
+    int s, n, lines, stride;
+    unsigned int k;
+
+    lines = fabs(span) / LINE_SAMPLES + 1;
+    if (lines > MAX_LINES)
+        lines = MAX_LINES;
+
+    stride = (span < 0.0) ? -(int)LINE_SAMPLES : (int)LINE_SAMPLES;
+    s = (int)sample;
+
+    for (n = 0; n < lines; n++, s += stride) {
+        if (s < 0 || s >= tr->length)
+            break;
+
+        if (stems == 0) {
+            __builtin_prefetch(track_get_sample(tr, s));
+        } else {
+            for (k = 0; k < stems; k++)
+                __builtin_prefetch(track_get_stem(tr, k, s));
+        }
+    }
+}
+
 /*
  * Build a block of PCM audio, resampled from the track
  *
@@ -114,6 +177,8 @@ static double build_pcm(signed short *pcm, unsigned samples, double sample_dt,
     sample = position * tr->rate;
     step = sample_dt * pitch * tr->rate;
 
+    prefetch(tr, sample + step * samples, step * samples, 0);
+
     vol = start_vol;
     gradient = (end_vol - start_vol) / samples;
 
@@ -165,6 +230,82 @@ static double build_pcm(signed short *pcm, unsigned samples, double sample_dt,
     return sample_dt * pitch * samples;
 }
 
+/*
+ * Equivalent to build_pcm, but mixing the stems of the track with
+ * the given gains
+ *
+ * All the stems are read in one pass. Interpolation is linear in its
+ * input, so the stems are mixed to stereo in the window and each
+ * output channel is interpolated once.
+ */
+
+static double build_stems(signed short *pcm, unsigned samples,
+                          double sample_dt, struct track *tr,
+                          double position, double pitch,
+                          double start_vol, double end_vol,
+                          const double *gain)
+{
+    int s;
+    double sample, step, vol, gradient;
+
+    sample = position * tr->rate;
+    step = sample_dt * pitch * tr->rate;
+
+    prefetch(tr, sample + step * samples, step * samples, tr->stems);
+
+    vol = start_vol;
+    gradient = (end_vol - start_vol) / samples;
+
+    for (s = 0; s < samples; s++) {
+        int c, sa, q;
+        unsigned int k;
+        double f, i[PLAYER_CHANNELS][4];
+
+        /* 4-sample window for interpolation */
+
+        sa = (int)sample;
+        if (sample < 0.0)
+            sa--;
+        f = sample - sa;
+        sa--;
+
+        for (q = 0; q < 4; q++, sa++) {
+            for (c = 0; c < PLAYER_CHANNELS; c++)
+                i[c][q] = 0.0;
+
+            if (sa < 0 || sa >= tr->length)
+                continue;
+
+            for (k = 0; k < tr->stems; k++) {
+                signed short *ts;
+
+                ts = track_get_stem(tr, k, sa);
+                for (c = 0; c < PLAYER_CHANNELS; c++)
+                    i[c][q] += gain[k] * ts[c];
+            }
+        }
+
+        for (c = 0; c < PLAYER_CHANNELS; c++) {
+            double v;
+
+            v = vol * cubic_interpolate_mix(i[c], f) + dither();
+
+            if (v > SHRT_MAX) {
+                *pcm++ = SHRT_MAX;
+            } else if (v < SHRT_MIN) {
+                *pcm++ = SHRT_MIN;
+            } else {
+                *pcm++ = (signed short)v;
+            }
+        }
+
+        sample += step;
+        vol += gradient;
+    }
+
+    return sample_dt * pitch * samples;
+}
+
 /*
  * Equivalent to build_pcm, but for use when the track is
  * not available
@@ -180,6 +321,105 @@ static double build_silence(signed short *pcm, unsigned samples,
     return sample_dt * pitch * samples;
 }
 
+/*
+ * Build a block of PCM audio from the given track, mixing its stems
+ * if they are not at unity
+ *
+ * Return: number of seconds advanced in the source audio track
+ */
+
+static double build(struct player *pl, signed short *pcm, unsigned samples,
+                    struct track *tr, double position, double pitch,
+                    double start_vol, double end_vol)
+{
+    /* The number of stems is settled before any audio is committed to
+     * the track (see confirm_stems()), so it is read only after the
+     * length shows there is some */
+
+    if (__atomic_load_n(&tr->length, __ATOMIC_ACQUIRE) > 0
+        && tr->stems > 0 && !pl->unity)
+    {
+        return build_stems(pcm, samples, pl->sample_dt, tr, position, pitch,
+                           start_vol, end_vol, pl->gain);
+    } else {
+        return build_pcm(pcm, samples, pl->sample_dt, tr, position, pitch,
+                         start_vol, end_vol);
+    }
+}
+
+/*
+ * Mix the start of the next track into a block of the end of the
+ * current one
+ *
+ * The crossfade begins at 'start' seconds into the current track.
+ * Each output sample is weighted by its own point along the
+ * crossfade, so the transition does not depend on the period size.
+ *
+ * Pre: spin lock is held and next track is present
+ * Post: the next track, from its beginning, is mixed into pcm
+ */
+
+static void crossfade(struct player *pl, signed short *pcm, unsigned samples,
+                      double elapsed, double start, double fade,
+                      double pitch, double start_vol, double end_vol)
+{
+    unsigned s, n;
+    double step, gradient;
+
+    step = pl->sample_dt * pitch;
+    gradient = (end_vol - start_vol) / samples;
+
+    for (s = 0; s < samples; s += n) {
+        unsigned int m;
+        signed short x[CROSSFADE_CHUNK * PLAYER_CHANNELS];
+        double e;
+
+        n = samples - s;
+        if (n > CROSSFADE_CHUNK)
+            n = CROSSFADE_CHUNK;
+
+        e = elapsed + step * s;
+        build(pl, x, n, pl->next, e - start, pitch,
+              start_vol + gradient * s, start_vol + gradient * (s + n));
+
+        for (m = 0; m < n; m++, e += step) {
+            double mu, a, b;
+            int c;
+
+            if (fade > 0.0)
+                mu = (e - start) / fade;
+            else
+                mu = (e >= start) ? 1.0 : 0.0;
+
+            if (mu <= 0.0)
+                continue;
+            if (mu > 1.0)
+                mu = 1.0;
+
+            /* Equal power, as the tracks are not correlated */
+
+            a = cos(mu * M_PI_2);
+            b = sin(mu * M_PI_2);
+
+            for (c = 0; c < PLAYER_CHANNELS; c++) {
+                signed short *y;
+                double v;
+
+                y = &pcm[(s + m) * PLAYER_CHANNELS + c];
+                v = a * *y + b * x[m * PLAYER_CHANNELS + c];
+
+                if (v > SHRT_MAX) {
+                    *y = SHRT_MAX;
+                } else if (v < SHRT_MIN) {
+                    *y = SHRT_MIN;
+                } else {
+                    *y = (signed short)v;
+                }
+            }
+        }
+    }
+}
+
 /*
  * Change the timecoder used by this playback
  */
@@ -199,6 +439,8 @@ void player_set_timecoder(struct player *pl, struct timecoder *tc)
 void player_init(struct player *pl, unsigned int sample_rate,
                  struct track *track, struct timecoder *tc)
 {
+    unsigned int n;
+
     assert(track != NULL);
     assert(sample_rate != 0);
 
@@ -206,6 +448,9 @@ void player_init(struct player *pl, unsigned int sample_rate,
 
     pl->sample_dt = 1.0 / sample_rate;
     pl->track = track;
+    pl->next = NULL;
+    pl->done = NULL;
+    pl->fade = DEFAULT_CROSSFADE;
     player_set_timecoder(pl, tc);
 
     pl->position = 0.0;
@@ -216,6 +461,20 @@ void player_init(struct player *pl, unsigned int sample_rate,
     pl->pitch = 0.0;
     pl->sync_pitch = 1.0;
     pl->volume = 0.0;
+
+    for (n = 0; n < TRACK_MAX_STEMS; n++)
+        pl->gain[n] = 1.0;
+    pl->unity = true;
+
+    pl->labels[0] = '\0';
+    metric_init(&pl->dropouts, METRIC_COUNTER, "xwax_deck_dropouts_total",
+                pl->labels, "Periods of silence whilst the track changed");
+    metric_init(&pl->timecode_seconds, METRIC_COUNTER,
+                "xwax_deck_timecode_seconds_total", pl->labels,
+                "Time under timecode control");
+    metric_init(&pl->lost_seconds, METRIC_COUNTER,
+                "xwax_deck_timecode_lost_seconds_total", pl->labels,
+                "Time under timecode control with no absolute position");
 }
 
 /*
@@ -225,8 +484,29 @@ void player_init(struct player *pl, unsigned int sample_rate,
 
 void player_clear(struct player *pl)
 {
+    metric_unregister(&pl->dropouts);
+    metric_unregister(&pl->timecode_seconds);
+    metric_unregister(&pl->lost_seconds);
+
     spin_clear(&pl->lock);
     track_release(pl->track);
+    if (pl->next != NULL)
+        track_release(pl->next);
+    if (pl->done != NULL)
+        track_release(pl->done);
+}
+
+/*
+ * Export the metrics of this player, as the given deck number
+ */
+
+void player_add_metrics(struct player *pl, unsigned int n)
+{
+    snprintf(pl->labels, sizeof pl->labels, "deck=\"%u\"", n);
+
+    metric_register(&pl->dropouts);
+    metric_register(&pl->timecode_seconds);
+    metric_register(&pl->lost_seconds);
 }
 
 /*
@@ -290,6 +570,20 @@ void player_recue(struct player *pl)
     pl->offset = pl->position;
 }
 
+/*
+ * Restore the playback position and offset, eg. from before a restart
+ *
+ * The offset is not recalibrated when the timecode is next read, so
+ * the track follows the needle from wherever it is now on the record.
+ */
+
+void player_restore(struct player *pl, double position, double offset)
+{
+    pl->position = position;
+    pl->offset = offset;
+    pl->recalibrate = false;
+}
+
 /*
  * Set the track used for the playback
  *
@@ -312,6 +606,94 @@ void player_set_track(struct player *pl, struct track *track)
     track_release(x); /* discard the old track */
 }
 
+/*
+ * Set the track which follows the current one, or NULL for none
+ *
+ * When the current track ends the playback advances into the next,
+ * crossfading between them. The swap is made by the realtime thread;
+ * the track it replaces is handed back by player_take_done().
+ *
+ * Pre: caller holds reference on track, if any
+ * Post: caller does not hold reference on track
+ */
+
+void player_set_next(struct player *pl, struct track *track)
+{
+    struct track *x;
+
+    spin_lock(&pl->lock);
+    x = pl->next;
+    __atomic_store_n(&pl->next, track, __ATOMIC_RELEASE);
+    spin_unlock(&pl->lock);
+
+    if (x != NULL)
+        track_release(x);
+}
+
+/*
+ * This is polled, so it does not take the lock; that would contend
+ * with the realtime thread
+ *
+ * Return: true if a next track is set and waiting to be played
+ */
+
+bool player_has_next(struct player *pl)
+{
+    return __atomic_load_n(&pl->next, __ATOMIC_ACQUIRE) != NULL;
+}
+
+/*
+ * Collect the track which was replaced when playback advanced to
+ * the next, since the realtime thread cannot release it
+ *
+ * Like player_has_next() this is polled, and does not take the lock.
+ *
+ * Return: the replaced track, or NULL if playback has not advanced
+ * Post: caller holds reference on any returned track
+ */
+
+struct track* player_take_done(struct player *pl)
+{
+    return __atomic_exchange_n(&pl->done, NULL, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Set the length of the crossfade into the next track, in seconds
+ */
+
+void player_set_crossfade(struct player *pl, double seconds)
+{
+    assert(seconds >= 0.0);
+    pl->fade = seconds;
+}
+
+/*
+ * Advance playback into the next track, once the end of the current
+ * one is reached
+ *
+ * The swap only exchanges pointers, so it is safe in the realtime
+ * thread. The elapsed time continues from the crossfade, so there is
+ * no gap.
+ *
+ * 'done' is set before 'next' is cleared, so anyone who sees there is
+ * no next track also sees the track which was replaced.
+ *
+ * Pre: spin lock is held, and no track is waiting in 'done'
+ */
+
+static void advance(struct player *pl, double start)
+{
+    struct track *x;
+
+    x = pl->track;
+    pl->track = pl->next;
+    __atomic_store_n(&pl->done, x, __ATOMIC_RELAXED);
+    __atomic_store_n(&pl->next, NULL, __ATOMIC_RELEASE);
+    pl->offset += start;
+
+    TRACE(player_advance, pl, (long)(start * 1e3));
+}
+
 /*
  * Set the playback of one player to match another, used
  * for "instant doubles" and beat juggling
@@ -344,10 +726,10 @@ void player_clone(struct player *pl, const struct player *from)
 
 static int sync_to_timecode(struct player *pl)
 {
-    double when, tcpos;
+    double tcpos;
     signed int timecode;
 
-    timecode = timecoder_get_position(pl->timecoder, &when);
+    timecode = timecoder_get_position(pl->timecoder, NULL);
 
     /* Instruct the caller to disconnect the timecoder if the needle
      * is outside the 'safe' zone of the record */
@@ -365,7 +747,7 @@ static int sync_to_timecode(struct player *pl)
 	pl->target_position = TARGET_UNKNOWN;
     } else {
         tcpos = (double)timecode / timecoder_get_resolution(pl->timecoder);
-        pl->target_position = tcpos + pl->pitch * when;
+        pl->target_position = tcpos + timecoder_get_movement(pl->timecoder);
     }
 
     return 0;
@@ -398,12 +780,15 @@ void retarget(struct player *pl)
     diff = pl->position - pl->target_position;
     pl->last_difference = diff; /* to print in user interface */
 
+    TRACE(player_retarget, pl, (long)(diff * 1e6));
+
     if (fabs(diff) > SKIP_THRESHOLD) {
 
         /* Jump the track to the time */
 
         pl->position = pl->target_position;
         fprintf(stderr, "Seek to new position %.2lfs.\n", pl->position);
+        TRACE(player_seek, pl, (long)(pl->position * 1e3));
 
     } else if (fabs(pl->pitch) > SYNC_PITCH) {
 
@@ -422,6 +807,29 @@ void retarget(struct player *pl)
 void player_seek_to(struct player *pl, double seconds)
 {
     pl->offset = pl->position - seconds;
+    TRACE(player_seek, pl, (long)(seconds * 1e3));
+}
+
+/*
+ * Set the gain of one stem, for tracks which have them
+ *
+ * The gains stay with the player, like the faders of a mixer, as
+ * the track is changed.
+ */
+
+void player_set_gain(struct player *pl, unsigned int stem, double gain)
+{
+    unsigned int n;
+    bool unity;
+
+    assert(stem < TRACK_MAX_STEMS);
+    pl->gain[stem] = gain;
+
+    unity = true;
+    for (n = 0; n < TRACK_MAX_STEMS; n++)
+        unity &= (pl->gain[n] == 1.0);
+
+    pl->unity = unity;
 }
 
 /*
@@ -441,8 +849,13 @@ void player_collect(struct player *pl, signed short *pcm, unsigned samples)
     dt = pl->sample_dt * samples;
 
     if (pl->timecode_control) {
-        if (sync_to_timecode(pl) == -1)
+        if (sync_to_timecode(pl) == -1) {
             pl->timecode_control = false;
+        } else {
+            metric_add(&pl->timecode_seconds, dt);
+            if (pl->target_position == TARGET_UNKNOWN)
+                metric_add(&pl->lost_seconds, dt);
+        }
     }
 
     if (pl->target_position != TARGET_UNKNOWN) {
@@ -474,10 +887,36 @@ void player_collect(struct player *pl, signed short *pcm, unsigned samples)
 
     if (!spin_try_lock(&pl->lock)) {
         r = build_silence(pcm, samples, pl->sample_dt, pitch);
+        metric_inc(&pl->dropouts);
     } else {
-        r = build_pcm(pcm, samples, pl->sample_dt, pl->track,
-                      pl->position - pl->offset, pitch,
-                      pl->volume, target_volume);
+        struct track *tr;
+        double elapsed, length, fade, start;
+
+        tr = pl->track;
+        elapsed = pl->position - pl->offset;
+        r = build(pl, pcm, samples, tr, elapsed, pitch,
+                  pl->volume, target_volume);
+
+        /* Play on into the next track, only once the length of this
+         * one is known */
+
+        if (pl->next != NULL && pitch > 0.0
+            && __atomic_load_n(&pl->done, __ATOMIC_RELAXED) == NULL
+            && !track_is_importing(tr))
+        {
+            length = (double)tr->length / tr->rate;
+            fade = (pl->fade < length) ? pl->fade : length;
+            start = length - fade;
+
+            if (elapsed + r > start) {
+                crossfade(pl, pcm, samples, elapsed, start, fade, pitch,
+                          pl->volume, target_volume);
+            }
+
+            if (elapsed + r >= length)
+                advance(pl, start);
+        }
+
         spin_unlock(&pl->lock);
     }
 
@@ -22,6 +22,7 @@
 
 #include <stdbool.h>
 
+#include "metrics.h"
 #include "spin.h"
 #include "track.h"
 
@@ -33,6 +34,12 @@ struct player {
     spin lock;
     struct track *track;
 
+    /* Queued to follow the current track, and the track it replaced
+     * awaiting release outside the realtime thread */
+
+    struct track *next, *done;
+    double fade; /* seconds */
+
     /* Current playback parameters */
 
     double position, /* seconds */
@@ -48,11 +55,22 @@ struct player {
     struct timecoder *timecoder;
     bool timecode_control,
         recalibrate; /* re-sync offset at next opportunity */
+
+    /* Mix of a track with stems; at unity the stereo mix is played */
+
+    double gain[TRACK_MAX_STEMS];
+    bool unity;
+
+    /* Metrics of playback, see player_add_metrics() */
+
+    char labels[16];
+    struct metric dropouts, timecode_seconds, lost_seconds;
 };
 
 void player_init(struct player *pl, unsigned int sample_rate,
                  struct track *track, struct timecoder *timecoder);
 void player_clear(struct player *pl);
+void player_add_metrics(struct player *pl, unsigned int n);
 
 void player_set_timecoder(struct player *pl, struct timecoder *tc);
 void player_set_timecode_control(struct player *pl, bool on);
@@ -62,6 +80,11 @@ void player_set_internal_playback(struct player *pl);
 void player_set_track(struct player *pl, struct track *track);
 void player_clone(struct player *pl, const struct player *from);
 
+void player_set_next(struct player *pl, struct track *track);
+bool player_has_next(struct player *pl);
+struct track* player_take_done(struct player *pl);
+void player_set_crossfade(struct player *pl, double seconds);
+
 double player_get_position(struct player *pl);
 double player_get_elapsed(struct player *pl);
 double player_get_remain(struct player *pl);
@@ -69,6 +92,9 @@ bool player_is_active(const struct player *pl);
 
 void player_seek_to(struct player *pl, double seconds);
 void player_recue(struct player *pl);
+void player_restore(struct player *pl, double position, double offset);
+
+void player_set_gain(struct player *pl, unsigned int stem, double gain);
 
 void player_collect(struct player *pl, signed short *pcm, unsigned samples);
 
@@ -0,0 +1,1240 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Import of playlists and the libraries of other DJ software, read
+ * directly rather than through a scan script
+ */
+
+#define _GNU_SOURCE /* asprintf(), strdupa() */
+#include <ctype.h>
+#include <libgen.h> /* basename(), dirname() */
+#include <math.h> /* isfinite() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "debug.h"
+#include "playlist.h"
+#include "xml.h"
+
+#define MAX_DEPTH 32 /* of folders of playlists */
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+/* An import into a crate of the library */
+
+struct import {
+    struct library *lib;
+    const char *pathname;
+    struct crate *crate; /* of the whole import */
+
+    /* Crates whose additions are sorted at the end */
+    struct crate **deferred;
+    size_t crates, size;
+};
+
+/*
+ * Defer the additions to a crate until the end of the import, so
+ * that a large playlist is sorted in one pass
+ *
+ * Return: 0 on success, -1 on error
+ */
+
+static int defer(struct import *im, struct crate *c)
+{
+    if (c->listing->deferred)
+        return 0; /* already seen in this import */
+
+    if (im->crates == im->size) {
+        struct crate **d;
+        size_t size;
+
+        size = im->size ? im->size * 2 : 32;
+        d = realloc(im->deferred, sizeof *d * size);
+        if (d == NULL) {
+            perror("realloc");
+            return -1;
+        }
+
+        im->deferred = d;
+        im->size = size;
+    }
+
+    listing_defer(c->listing);
+    im->deferred[im->crates++] = c;
+    return 0;
+}
+
+/*
+ * Sort the deferred additions into every crate of the import
+ *
+ * Return: 0 on success, -1 on error
+ */
+
+static int commit(struct import *im)
+{
+    size_t n;
+    int r;
+
+    r = 0;
+
+    for (n = 0; n < im->crates; n++) {
+        if (listing_commit(im->deferred[n]->listing) == -1)
+            r = -1;
+    }
+
+    free(im->deferred);
+    return r;
+}
+
+/*
+ * Copy a field into a line for get_record(), replacing any
+ * characters which would break it
+ *
+ * Return: pointer to the end of the copied field
+ */
+
+static char* copy_field(char *out, const char *s)
+{
+    for (; *s != '\0'; s++)
+        *out++ = (*s == '\t' || *s == '\n' || *s == '\r') ? ' ' : *s;
+
+    return out;
+}
+
+/*
+ * Return a new record which is not wanted, see record_discard()
+ */
+
+static void discard(struct record *re)
+{
+    free(re->pathname); /* and the other fields */
+    free(re->match);
+    record_discard(re);
+}
+
+/*
+ * Add a record to the library, and to the given crate
+ *
+ * Return: pointer to the record (which may be an existing one), or
+ * NULL on memory allocation failure
+ */
+
+static struct record* add(struct import *im, struct crate *c,
+                          const char *pathname, const char *artist,
+                          const char *title, double bpm)
+{
+    char *line, *s;
+    struct record *d, *x;
+
+    line = malloc(strlen(pathname) + strlen(artist) + strlen(title) + 3);
+    if (line == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    s = copy_field(line, pathname);
+    *s++ = '\t';
+    s = copy_field(s, artist);
+    *s++ = '\t';
+    s = copy_field(s, title);
+    *s = '\0';
+
+    d = get_record(line);
+    if (d == NULL) {
+        free(line);
+        return NULL;
+    }
+
+    if (isfinite(bpm) && bpm > 0.0)
+        d->bpm = bpm;
+
+    x = listing_add(&im->lib->storage, d);
+    if (x != d) /* a duplicate, or out of memory */
+        discard(d);
+    if (x == NULL)
+        return NULL;
+
+    if (listing_add(c->listing, x) == NULL)
+        return NULL;
+
+    return x;
+}
+
+/*
+ * Add a record with the artist and title in a single string, as
+ * commonly found in playlists, eg. "Artist - Title"
+ *
+ * Return: as add()
+ */
+
+static struct record* add_named(struct import *im, struct crate *c,
+                                const char *pathname, const char *name)
+{
+    char *artist, *title, *s;
+
+    artist = strdupa(name);
+
+    s = strstr(artist, " - ");
+    if (s == NULL) {
+        title = artist;
+        artist = "";
+    } else {
+        *s = '\0';
+        title = s + 3;
+    }
+
+    return add(im, c, pathname, artist, title, 0.0);
+}
+
+/*
+ * Add a record with the artist and title taken from its filename,
+ * eg. "/music/Artist - Title.mp3", unless the file is already known
+ *
+ * Return: as add()
+ */
+
+static struct record* add_file(struct import *im, struct crate *c,
+                               const char *pathname)
+{
+    char *name, *s;
+    struct record *x;
+
+    x = library_find(im->lib, pathname);
+    if (x != NULL)
+        return listing_add(c->listing, x);
+
+    name = strdupa(pathname);
+    name = basename(name);
+
+    s = strrchr(name, '.');
+    if (s != NULL && s != name)
+        *s = '\0';
+
+    return add_named(im, c, pathname, name);
+}
+
+/*
+ * Return: value of a hex digit, or -1 if not a digit
+ */
+
+static int hex(int c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+
+    c = tolower(c);
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+
+    return -1;
+}
+
+/*
+ * Convert a file URL to a pathname, including any drive letter, eg.
+ * "file://localhost/C:/Music/A%20B.mp3" to "C:/Music/A B.mp3"
+ *
+ * Return: pathname with responsibility, or NULL on error
+ */
+
+static char* url_to_path(const char *url)
+{
+    char *path, *out;
+
+    if (strncasecmp(url, "file://", 7) != 0)
+        return NULL;
+
+    url += 7;
+    if (strncasecmp(url, "localhost", 9) == 0)
+        url += 9;
+    if (url[0] == '/' && isalpha(url[1]) && url[2] == ':')
+        url++;
+
+    path = malloc(strlen(url) + 1);
+    if (path == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    out = path;
+
+    while (*url != '\0') {
+        int h, l;
+
+        if (url[0] == '%' && (h = hex(url[1])) != -1 && (l = hex(url[2])) != -1) {
+            *out++ = h << 4 | l;
+            url += 3;
+        } else {
+            *out++ = *url++;
+        }
+    }
+
+    *out = '\0';
+    return path;
+}
+
+/*
+ * Find the pathname of an entry in a playlist, which may be a URL
+ * or relative to the playlist itself
+ *
+ * Return: pathname with responsibility, or NULL if the entry is not
+ * a file or on error
+ */
+
+static char* entry_path(const struct import *im, const char *entry)
+{
+    char *path, *dir;
+
+    if (strncasecmp(entry, "file:", 5) == 0)
+        return url_to_path(entry);
+
+    if (strstr(entry, "://") != NULL) /* eg. a stream */
+        return NULL;
+
+    if (entry[0] == '/') {
+        path = strdup(entry);
+        if (path == NULL)
+            perror("strdup");
+        return path;
+    }
+
+    dir = strdupa(im->pathname);
+    dir = dirname(dir);
+
+    if (asprintf(&path, "%s/%s", dir, entry) == -1) {
+        perror("asprintf");
+        return NULL;
+    }
+
+    return path;
+}
+
+/*
+ * Read the next line of a text file, without its line ending
+ *
+ * Return: length of line, or -1 at the end of the file or on error
+ */
+
+static ssize_t read_line(FILE *f, char **line, size_t *len)
+{
+    ssize_t z;
+
+    z = getline(line, len, f);
+    if (z == -1)
+        return -1;
+
+    while (z > 0 && ((*line)[z - 1] == '\n' || (*line)[z - 1] == '\r'))
+        (*line)[--z] = '\0';
+
+    /* A byte order mark (UTF-8) on the first line */
+
+    if (strncmp(*line, "\xef\xbb\xbf", 3) == 0) {
+        memmove(*line, *line + 3, z - 2);
+        z -= 3;
+    }
+
+    return z;
+}
+
+/*
+ * Import an M3U playlist, including the extended form
+ *
+ * Return: 0 on success, -1 on error
+ */
+
+static int import_m3u(struct import *im, FILE *f)
+{
+    char *line, *name;
+    size_t len;
+    int r;
+
+    line = NULL;
+    len = 0;
+    name = NULL;
+    r = 0;
+
+    while (read_line(f, &line, &len) != -1) {
+        char *path;
+
+        if (line[0] == '\0')
+            continue;
+
+        if (line[0] == '#') {
+            char *s;
+
+            /* #EXTINF:<seconds>,<artist> - <title> */
+
+            if (strncmp(line, "#EXTINF:", 8) != 0)
+                continue;
+
+            s = strchr(line, ',');
+            if (s == NULL)
+                continue;
+
+            free(name);
+            name = strdup(s + 1);
+            if (name == NULL) {
+                perror("strdup");
+                r = -1;
+                break;
+            }
+
+            continue;
+        }
+
+        path = entry_path(im, line);
+        if (path != NULL) {
+            struct record *x;
+
+            if (name != NULL && name[0] != '\0')
+                x = add_named(im, im->crate, path, name);
+            else
+                x = add_file(im, im->crate, path);
+
+            free(path);
+
+            if (x == NULL) {
+                r = -1;
+                break;
+            }
+        }
+
+        free(name);
+        name = NULL;
+    }
+
+    free(name);
+    free(line);
+    return r;
+}
+
+/*
+ * Add the pending entry of a PLS playlist
+ *
+ * Return: 0 on success, -1 on error
+ */
+
+static int flush_pls(struct import *im, char **path, char **title)
+{
+    struct record *x;
+    char *p;
+
+    if (*path == NULL)
+        return 0;
+
+    p = entry_path(im, *path);
+    free(*path);
+    *path = NULL;
+
+    if (p == NULL) {
+        free(*title);
+        *title = NULL;
+        return 0;
+    }
+
+    if (*title != NULL) {
+        x = add_named(im, im->crate, p, *title);
+        free(*title);
+        *title = NULL;
+    } else {
+        x = add_file(im, im->crate, p);
+    }
+
+    free(p);
+    return (x == NULL) ? -1 : 0;
+}
+
+/*
+ * Import a PLS playlist
+ *
+ * Entries are numbered, eg. "File1=" and "Title1="; each entry is
+ * expected to be together in the file.
+ *
+ * Return: 0 on success, -1 on error
+ */
+
+static int import_pls(struct import *im, FILE *f)
+{
+    char *line, *path, *title;
+    size_t len;
+    long entry;
+    int r;
+
+    line = NULL;
+    len = 0;
+    path = NULL;
+    title = NULL;
+    entry = -1;
+    r = 0;
+
+    while (read_line(f, &line, &len) != -1) {
+        char *key, *value, **field;
+        long n;
+
+        value = strchr(line, '=');
+        if (value == NULL)
+            continue;
+        *value++ = '\0';
+
+        key = line;
+        if (strncasecmp(key, "File", 4) == 0) {
+            field = &path;
+            n = strtol(key + 4, NULL, 10);
+        } else if (strncasecmp(key, "Title", 5) == 0) {
+            field = &title;
+            n = strtol(key + 5, NULL, 10);
+        } else {
+            continue;
+        }
+
+        if (n != entry) {
+            if (flush_pls(im, &path, &title) == -1) {
+                r = -1;
+                break;
+            }
+            entry = n;
+        }
+
+        free(*field);
+        *field = strdup(value);
+        if (*field == NULL) {
+            perror("strdup");
+            r = -1;
+            break;
+        }
+    }
+
+    if (r == 0)
+        r = flush_pls(im, &path, &title);
+
+    free(path);
+    free(title);
+    free(line);
+    return r;
+}
+
+/*
+ * Parse a BPM value from an attribute
+ *
+ * Return: BPM, or 0.0 if not known
+ */
+
+static double parse_bpm(const char *s)
+{
+    double bpm;
+
+    if (s == NULL)
+        return 0.0;
+
+    bpm = strtod(s, NULL);
+    if (!isfinite(bpm) || bpm <= 0.0)
+        return 0.0;
+
+    return bpm;
+}
+
+/*
+ * State of the import as the XML document is read
+ */
+
+struct xml_import {
+    struct xml_handler handler;
+    struct import *im;
+    bool collection, playlists;
+
+    /* Folders and playlists which are open */
+    struct crate *node[MAX_DEPTH];
+    size_t depth, ignored;
+    bool by_location; /* tracks of playlist are given by location */
+
+    /* Rekordbox; tracks of the collection by ID */
+    struct track_id {
+        unsigned long id;
+        record_id_t record;
+    } *track;
+    size_t tracks, size;
+
+    /* Traktor; entry of the collection which is open */
+    char *artist, *title, *path;
+    double bpm;
+};
+
+/*
+ * Enter a folder or playlist
+ *
+ * Return: 0 on success, -1 on error
+ */
+
+static int push_node(struct xml_import *x, const char *name)
+{
+    struct crate *c;
+
+    if (x->depth == 0) {
+        c = x->im->crate; /* root of the tree */
+    } else if (x->depth == MAX_DEPTH || x->ignored > 0) {
+        x->ignored++;
+        return 0;
+    } else {
+        if (name == NULL)
+            name = "";
+
+        c = library_local(x->im->lib, x->node[x->depth - 1], name);
+        if (c == NULL)
+            return -1;
+        if (defer(x->im, c) == -1)
+            return -1;
+    }
+
+    x->node[x->depth++] = c;
+    return 0;
+}
+
+static void pop_node(struct xml_import *x)
+{
+    if (x->ignored > 0)
+        x->ignored--;
+    else if (x->depth > 0)
+        x->depth--;
+}
+
+/*
+ * Add a track in a playlist, given the pathname of a record which is
+ * already in the library
+ */
+
+static int add_to_node(struct xml_import *x, const char *pathname)
+{
+    struct record *re;
+
+    if (x->depth == 0 || x->ignored > 0)
+        return 0;
+
+    re = library_find(x->im->lib, pathname);
+    if (re == NULL) {
+        debug("%s: Not in the collection", pathname);
+        return 0;
+    }
+
+    if (listing_add(x->node[x->depth - 1]->listing, re) == NULL)
+        return -1;
+
+    return 0;
+}
+
+static int track_id_cmp(const void *a, const void *b)
+{
+    const struct track_id *x = a, *y = b;
+
+    if (x->id < y->id)
+        return -1;
+    if (x->id > y->id)
+        return 1;
+
+    return 0;
+}
+
+/*
+ * Rekordbox, eg.
+ *
+ * <DJ_PLAYLISTS>
+ *   <COLLECTION>
+ *     <TRACK TrackID="1" Name="Title" Artist="Artist" AverageBpm="120.00"
+ *            Location="file://localhost/music/track.mp3"/>
+ *   </COLLECTION>
+ *   <PLAYLISTS>
+ *     <NODE Type="0" Name="ROOT">
+ *       <NODE Type="1" Name="Playlist" KeyType="0">
+ *         <TRACK Key="1"/>
+ *       </NODE>
+ *     </NODE>
+ *   </PLAYLISTS>
+ * </DJ_PLAYLISTS>
+ */
+
+static int rekordbox_track(struct xml_import *x, char *attr[])
+{
+    const char *id, *location, *artist, *title;
+    struct record *re;
+    char *path;
+
+    id = xml_attr(attr, "TrackID");
+    location = xml_attr(attr, "Location");
+    if (id == NULL || location == NULL)
+        return 0;
+
+    path = url_to_path(location);
+    if (path == NULL)
+        return 0; /* eg. a stream */
+
+    artist = xml_attr(attr, "Artist");
+    title = xml_attr(attr, "Name");
+
+    if (title == NULL || title[0] == '\0')
+        re = add_file(x->im, x->im->crate, path);
+    else
+        re = add(x->im, x->im->crate, path, artist ? artist : "", title,
+                 parse_bpm(xml_attr(attr, "AverageBpm")));
+
+    free(path);
+
+    if (re == NULL)
+        return -1;
+
+    if (x->tracks == x->size) {
+        struct track_id *t;
+        size_t size;
+
+        size = x->size ? x->size * 2 : 1024;
+        t = realloc(x->track, sizeof *t * size);
+        if (t == NULL) {
+            perror("realloc");
+            return -1;
+        }
+
+        x->track = t;
+        x->size = size;
+    }
+
+    x->track[x->tracks].id = strtoul(id, NULL, 10);
+    x->track[x->tracks].record = re->id;
+    x->tracks++;
+
+    return 0;
+}
+
+static int rekordbox_entry(struct xml_import *x, char *attr[])
+{
+    const char *key;
+    struct track_id t, *found;
+
+    key = xml_attr(attr, "Key");
+    if (key == NULL)
+        return 0;
+
+    if (x->by_location) {
+        char *path;
+        int r;
+
+        path = url_to_path(key);
+        if (path == NULL)
+            return 0;
+
+        r = add_to_node(x, path);
+        free(path);
+        return r;
+    }
+
+    if (x->depth == 0 || x->ignored > 0)
+        return 0;
+
+    t.id = strtoul(key, NULL, 10);
+    found = bsearch(&t, x->track, x->tracks, sizeof t, track_id_cmp);
+    if (found == NULL)
+        return 0;
+
+    if (listing_add(x->node[x->depth - 1]->listing,
+                    record_get(found->record)) == NULL)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int rekordbox_start(struct xml_handler *h, const char *name,
+                           char *attr[])
+{
+    struct xml_import *x = container_of(h, struct xml_import, handler);
+
+    if (strcmp(name, "COLLECTION") == 0) {
+        x->collection = true;
+    } else if (strcmp(name, "PLAYLISTS") == 0) {
+        x->playlists = true;
+    } else if (strcmp(name, "TRACK") == 0) {
+        if (x->collection)
+            return rekordbox_track(x, attr);
+        if (x->playlists)
+            return rekordbox_entry(x, attr);
+    } else if (strcmp(name, "NODE") == 0 && x->playlists) {
+        const char *type;
+
+        type = xml_attr(attr, "KeyType");
+        x->by_location = (type != NULL && strcmp(type, "1") == 0);
+
+        return push_node(x, xml_attr(attr, "Name"));
+    }
+
+    return 0;
+}
+
+static int rekordbox_end(struct xml_handler *h, const char *name)
+{
+    struct xml_import *x = container_of(h, struct xml_import, handler);
+
+    if (strcmp(name, "COLLECTION") == 0) {
+        x->collection = false;
+        qsort(x->track, x->tracks, sizeof *x->track, track_id_cmp);
+    } else if (strcmp(name, "PLAYLISTS") == 0) {
+        x->playlists = false;
+    } else if (strcmp(name, "NODE") == 0 && x->playlists) {
+        pop_node(x);
+    }
+
+    return 0;
+}
+
+/*
+ * Convert a path in Traktor's notation to a pathname, eg.
+ * "/:Users/:me/:Music/:" to "/Users/me/Music/"
+ *
+ * Return: pointer to the end of the pathname
+ */
+
+static char* traktor_path(char *out, const char *s)
+{
+    while (*s != '\0') {
+        *out++ = *s;
+        s += (s[0] == '/' && s[1] == ':') ? 2 : 1;
+    }
+
+    *out = '\0';
+    return out;
+}
+
+/*
+ * Traktor, eg.
+ *
+ * <NML>
+ *   <COLLECTION>
+ *     <ENTRY TITLE="Title" ARTIST="Artist">
+ *       <LOCATION VOLUME="Macintosh HD" DIR="/:music/:" FILE="track.mp3"/>
+ *       <TEMPO BPM="120.000000"/>
+ *     </ENTRY>
+ *   </COLLECTION>
+ *   <PLAYLISTS>
+ *     <NODE TYPE="FOLDER" NAME="$ROOT">
+ *       <SUBNODES>
+ *         <NODE TYPE="PLAYLIST" NAME="Playlist">
+ *           <PLAYLIST>
+ *             <ENTRY>
+ *               <PRIMARYKEY TYPE="TRACK"
+ *                           KEY="Macintosh HD/:music/:track.mp3"/>
+ *             </ENTRY>
+ *           </PLAYLIST>
+ *         </NODE>
+ *       </SUBNODES>
+ *     </NODE>
+ *   </PLAYLISTS>
+ * </NML>
+ *
+ * The volume is only used where it is a drive letter.
+ */
+
+static int traktor_location(struct xml_import *x, char *attr[])
+{
+    const char *volume, *dir, *file;
+    char *s;
+
+    volume = xml_attr(attr, "VOLUME");
+    dir = xml_attr(attr, "DIR");
+    file = xml_attr(attr, "FILE");
+    if (dir == NULL || file == NULL)
+        return 0;
+
+    if (volume == NULL || volume[0] == '\0'
+        || volume[strlen(volume) - 1] != ':')
+    {
+        volume = "";
+    }
+
+    free(x->path);
+    x->path = malloc(strlen(volume) + strlen(dir) + strlen(file) + 1);
+    if (x->path == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    s = stpcpy(x->path, volume);
+    s = traktor_path(s, dir);
+    strcpy(s, file);
+
+    return 0;
+}
+
+static int traktor_key(struct xml_import *x, char *attr[])
+{
+    const char *type, *key, *volume;
+    char *path, *s;
+    size_t len;
+
+    type = xml_attr(attr, "TYPE");
+    key = xml_attr(attr, "KEY");
+    if (type == NULL || strcmp(type, "TRACK") != 0 || key == NULL)
+        return 0;
+
+    /* Volume, then the path */
+
+    s = strstr(key, "/:");
+    if (s == NULL)
+        return 0;
+
+    volume = key;
+    len = s - key;
+
+    path = alloca(strlen(key) + 1);
+    if (len > 0 && key[len - 1] == ':') {
+        memcpy(path, volume, len);
+        traktor_path(path + len, s);
+    } else {
+        traktor_path(path, s);
+    }
+
+    return add_to_node(x, path);
+}
+
+/*
+ * Return: copy of the string with responsibility, or NULL if
+ * none or on error
+ */
+
+static char* copy_attr(char *attr[], const char *name)
+{
+    const char *s;
+    char *copy;
+
+    s = xml_attr(attr, name);
+    if (s == NULL)
+        return NULL;
+
+    copy = strdup(s);
+    if (copy == NULL)
+        perror("strdup");
+
+    return copy;
+}
+
+static void traktor_reset(struct xml_import *x)
+{
+    free(x->artist);
+    free(x->title);
+    free(x->path);
+    x->artist = NULL;
+    x->title = NULL;
+    x->path = NULL;
+    x->bpm = 0.0;
+}
+
+static int traktor_start(struct xml_handler *h, const char *name,
+                         char *attr[])
+{
+    struct xml_import *x = container_of(h, struct xml_import, handler);
+
+    if (strcmp(name, "COLLECTION") == 0) {
+        x->collection = true;
+    } else if (strcmp(name, "PLAYLISTS") == 0) {
+        x->playlists = true;
+    } else if (x->collection) {
+        if (strcmp(name, "ENTRY") == 0) {
+            traktor_reset(x);
+            x->artist = copy_attr(attr, "ARTIST");
+            x->title = copy_attr(attr, "TITLE");
+        } else if (strcmp(name, "LOCATION") == 0) {
+            return traktor_location(x, attr);
+        } else if (strcmp(name, "TEMPO") == 0) {
+            x->bpm = parse_bpm(xml_attr(attr, "BPM"));
+        }
+    } else if (x->playlists) {
+        if (strcmp(name, "NODE") == 0)
+            return push_node(x, xml_attr(attr, "NAME"));
+        if (strcmp(name, "PRIMARYKEY") == 0)
+            return traktor_key(x, attr);
+    }
+
+    return 0;
+}
+
+static int traktor_end(struct xml_handler *h, const char *name)
+{
+    struct xml_import *x = container_of(h, struct xml_import, handler);
+
+    if (strcmp(name, "COLLECTION") == 0) {
+        x->collection = false;
+    } else if (strcmp(name, "PLAYLISTS") == 0) {
+        x->playlists = false;
+    } else if (x->collection && strcmp(name, "ENTRY") == 0) {
+        struct record *re;
+
+        if (x->path == NULL)
+            return 0;
+
+        if (x->title == NULL || x->title[0] == '\0') {
+            re = add_file(x->im, x->im->crate, x->path);
+        } else {
+            re = add(x->im, x->im->crate, x->path,
+                     x->artist ? x->artist : "", x->title, x->bpm);
+        }
+
+        traktor_reset(x);
+
+        if (re == NULL)
+            return -1;
+    } else if (x->playlists && strcmp(name, "NODE") == 0) {
+        pop_node(x);
+    }
+
+    return 0;
+}
+
+static int unknown_root(struct import *im)
+{
+    fprintf(stderr, "%s: Not a library of Rekordbox or Traktor\n",
+            im->pathname);
+    return -1;
+}
+
+/*
+ * Choose the format by the root element, since both are commonly
+ * exported with the extension .xml
+ */
+
+static int root_start(struct xml_handler *h, const char *name, char *attr[])
+{
+    struct xml_import *x = container_of(h, struct xml_import, handler);
+
+    if (strcmp(name, "DJ_PLAYLISTS") == 0) {
+        h->start = rekordbox_start;
+        h->end = rekordbox_end;
+    } else if (strcmp(name, "NML") == 0) {
+        h->start = traktor_start;
+        h->end = traktor_end;
+    } else {
+        return unknown_root(x->im);
+    }
+
+    return h->start(h, name, attr);
+}
+
+static int root_end(struct xml_handler *h, const char *name)
+{
+    return 0;
+}
+
+/*
+ * Import a library in XML, from Rekordbox or Traktor
+ *
+ * Return: 0 on success, -1 on error
+ */
+
+static int import_xml(struct import *im)
+{
+    struct xml_import x;
+    int r;
+
+    x.handler.start = root_start;
+    x.handler.end = root_end;
+
+    x.im = im;
+    x.collection = false;
+    x.playlists = false;
+    x.depth = 0;
+    x.ignored = 0;
+    x.by_location = false;
+    x.track = NULL;
+    x.tracks = 0;
+    x.size = 0;
+    x.artist = NULL;
+    x.title = NULL;
+    x.path = NULL;
+    x.bpm = 0.0;
+
+    r = xml_parse(im->pathname, &x.handler);
+    if (r == 0 && x.handler.start == root_start) /* no elements */
+        r = unknown_root(im);
+
+    traktor_reset(&x);
+    free(x.track);
+
+    return r;
+}
+
+static const struct {
+    const char *extension;
+    enum {
+        M3U,
+        PLS,
+        XML,
+    } format;
+} formats[] = {
+    { ".m3u", M3U },
+    { ".m3u8", M3U },
+    { ".pls", PLS },
+    { ".xml", XML },
+    { ".nml", XML },
+};
+
+/*
+ * Return: index into formats of the file, or -1 if not known
+ */
+
+static int format(const char *pathname)
+{
+    const char *s;
+    int n;
+
+    s = strrchr(pathname, '.');
+    if (s == NULL)
+        return -1;
+
+    for (n = 0; n < ARRAY_SIZE(formats); n++) {
+        if (strcasecmp(s, formats[n].extension) == 0)
+            return n;
+    }
+
+    return -1;
+}
+
+struct xml_sniff {
+    struct xml_handler handler;
+    bool known;
+};
+
+/*
+ * Stop at the root element of an XML file, to see what it is
+ */
+
+static int sniff_start(struct xml_handler *h, const char *name, char *attr[])
+{
+    struct xml_sniff *s = container_of(h, struct xml_sniff, handler);
+
+    s->known = (strcmp(name, "DJ_PLAYLISTS") == 0
+                || strcmp(name, "NML") == 0);
+
+    return -1; /* no need to read any further */
+}
+
+static int sniff_end(struct xml_handler *h, const char *name)
+{
+    return -1;
+}
+
+/*
+ * Return: true if the file is in a format which can be imported
+ *
+ * An XML file is only known by its root element; any other is left
+ * to the scanner, eg. one given with -s.
+ */
+
+bool playlist_is_known(const char *pathname)
+{
+    struct xml_sniff s;
+    int n;
+
+    n = format(pathname);
+    if (n == -1)
+        return false;
+
+    if (formats[n].format != XML)
+        return true;
+
+    s.handler.start = sniff_start;
+    s.handler.end = sniff_end;
+    s.known = false;
+
+    (void)xml_parse(pathname, &s.handler);
+    return s.known;
+}
+
+/*
+ * Import a playlist, or library of other software, as crates
+ *
+ * The whole file becomes a crate, named after the file, and any
+ * playlists within it are crates in a folder of that name. Records
+ * are sorted into the library in one pass at the end.
+ *
+ * Return: 0 on success, -1 on error
+ */
+
+int playlist_import(struct library *lib, const char *pathname)
+{
+    struct import im;
+    char *name;
+    FILE *f;
+    int n, r;
+
+    n = format(pathname);
+    if (n == -1) {
+        fprintf(stderr, "%s: Not a known format of playlist\n", pathname);
+        return -1;
+    }
+
+    name = strdupa(pathname);
+    name = library_unique_name(lib, basename(name));
+    if (name == NULL)
+        return -1;
+
+    im.lib = lib;
+    im.pathname = pathname;
+    im.crate = library_local(lib, NULL, name);
+    free(name);
+    if (im.crate == NULL)
+        return -1;
+    im.deferred = NULL;
+    im.crates = 0;
+    im.size = 0;
+
+    if (defer(&im, im.crate) == -1)
+        return -1;
+    listing_defer(&lib->storage);
+
+    switch (formats[n].format) {
+    case M3U:
+    case PLS:
+        f = fopen(pathname, "r");
+        if (f == NULL) {
+            perror(pathname);
+            r = -1;
+            break;
+        }
+
+        if (formats[n].format == M3U)
+            r = import_m3u(&im, f);
+        else
+            r = import_pls(&im, f);
+
+        fclose(f);
+        break;
+
+    case XML:
+        r = import_xml(&im);
+        break;
+
+    default:
+        abort();
+    }
+
+    if (listing_commit(&lib->storage) == -1)
+        r = -1;
+    if (commit(&im) == -1)
+        r = -1;
+
+    return r;
+}
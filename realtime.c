@@ -27,6 +27,7 @@
 #include "device.h"
 #include "realtime.h"
 #include "thread.h"
+#include "trace.h"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
 
@@ -96,11 +97,15 @@ static void rt_main(struct rt *rt)
             }
         }
 
+        TRACE(rt_period_start, rt, r);
+
         for (n = 0; n < rt->nctl; n++)
             controller_handle(rt->ctl[n]);
 
         for (n = 0; n < rt->ndv; n++)
             device_handle(rt->dv[n]);
+
+        TRACE(rt_period_end, rt, r);
     }
 }
 
@@ -36,9 +36,15 @@
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
 
+/* Handlers are called at this interval, for work such as following
+ * the realtime thread, which cannot wake us */
+
+#define HANDLER_INTERVAL 100 /* ms */
+
 static int event[2]; /* pipe to wake up service thread */
 static struct list tracks = LIST_INIT(tracks),
-    excrates = LIST_INIT(excrates);
+    excrates = LIST_INIT(excrates),
+    handlers = LIST_INIT(handlers);
 mutex lock;
 
 int rig_init()
@@ -101,10 +107,11 @@ int rig_main()
     mutex_lock(&lock);
 
     for (;;) { /* exit via EVENT_QUIT */
-        int r;
+        int r, timeout;
         struct pollfd *pe;
         struct track *track, *xtrack;
         struct excrate *excrate, *xexcrate;
+        struct rig_handler *handler, *xhandler;
 
         pe = &pt[1];
 
@@ -124,9 +131,11 @@ int rig_main()
             pe++;
         }
 
+        timeout = list_empty(&handlers) ? -1 : HANDLER_INTERVAL;
+
         mutex_unlock(&lock);
 
-        r = poll(pt, pe - pt, -1);
+        r = poll(pt, pe - pt, timeout);
         if (r == -1) {
             if (errno == EINTR) {
                 mutex_lock(&lock);
@@ -174,6 +183,9 @@ int rig_main()
 
         list_for_each_safe(excrate, xexcrate, &excrates, rig)
             excrate_handle(excrate);
+
+        list_for_each_safe(handler, xhandler, &handlers, rig)
+            handler->handle(handler);
     }
  finish:
 
@@ -233,3 +245,24 @@ void rig_post_excrate(struct excrate *e)
     post_event(EVENT_WAKE);
 }
 
+
+/*
+ * Call a handler at intervals, until it is removed
+ */
+
+void rig_post_handler(struct rig_handler *h)
+{
+    list_add(&h->rig, &handlers);
+    post_event(EVENT_WAKE);
+}
+
+/*
+ * Pre: rig lock is held
+ * Post: handler is not called again until it is posted
+ */
+
+void rig_remove_handler(struct rig_handler *h)
+{
+    list_del(&h->rig);
+    list_init(&h->rig);
+}
@@ -21,8 +21,16 @@
 #define RIG_H
 
 #include "excrate.h"
+#include "list.h"
 #include "track.h"
 
+/* Something handled at intervals, such as a deck with a play queue */
+
+struct rig_handler {
+    struct list rig;
+    void (*handle)(struct rig_handler *h);
+};
+
 int rig_init();
 void rig_clear();
 
@@ -35,5 +43,7 @@ void rig_unlock();
 
 void rig_post_track(struct track *t);
 void rig_post_excrate(struct excrate *e);
+void rig_post_handler(struct rig_handler *h);
+void rig_remove_handler(struct rig_handler *h);
 
 #endif
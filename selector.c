@@ -20,8 +20,15 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include "metrics.h"
 #include "selector.h"
 
+static void count_search(double start)
+{
+    metric_inc(&metric_searches);
+    metric_add(&metric_search_seconds, metrics_now() - start);
+}
+
 /*
  * Scroll to our target entry if it can be found, otherwise leave our
  * position unchanged
@@ -45,7 +52,7 @@ static void retain_target(struct selector *sel)
     case SORT_PLAYLIST:
         /* Linear search */
         for (n = 0; n < l->entries; n++) {
-            if (l->record[n] == sel->target)
+            if (index_record(l, n) == sel->target)
                 break;
         }
         break;
@@ -73,7 +80,9 @@ static void hunt_target(struct selector *s)
     l = s->view_index;
     n = listbox_current(&s->records);
 
-    if (n < l->entries && l->record[n + 1] == s->target) {
+    if (n < l->entries && n + 1 < l->entries
+        && index_record(l, n + 1) == s->target)
+    {
         struct listbox *x;
 
         /* Retain selection in the same position on screen
@@ -97,7 +106,7 @@ static struct crate* current_crate(struct selector *sel)
     n = listbox_current(&sel->crates);
     assert(n != -1);
 
-    return sel->library->crate[n];
+    return library_crate(sel->library, n);
 }
 
 /*
@@ -124,6 +133,62 @@ static struct index* initial(struct selector *sel)
     }
 }
 
+/*
+ * Search the current crate from the start, into the view index
+ *
+ * A range of BPM is found using the crate's index sorted by BPM, so
+ * only the records in the range are visited. Do not disrupt the
+ * running process on memory allocation failure, leave the view index
+ * incomplete.
+ */
+
+static void search(struct selector *sel)
+{
+    struct listing *l;
+    double start;
+
+    start = metrics_now();
+
+    if (!sel->match.bpm || sel->sort == SORT_PLAYLIST) {
+        (void)index_match(initial(sel), sel->view_index, &sel->match);
+        count_search(start);
+        return;
+    }
+
+    l = current_crate(sel)->listing;
+
+    if (index_match_bpm(&l->by_bpm, sel->view_index, &sel->match) != -1) {
+        if (sel->sort != SORT_BPM)
+            index_sort(sel->view_index, sel->sort);
+    }
+
+    count_search(start);
+}
+
+/*
+ * Re-order the view index to the current sort, without repeating
+ * the search
+ *
+ * The view holds the result of the search; take the records of the
+ * crate in the new order and keep those which are in the view.
+ */
+
+static void reorder(struct selector *sel)
+{
+    struct index *tmp;
+
+    if (index_filter(initial(sel), sel->swap_index, sel->view_index,
+                     &sel->matched) == -1)
+    {
+        search(sel);
+        return;
+    }
+
+    tmp = sel->view_index;
+    sel->view_index = sel->swap_index;
+    sel->swap_index = tmp;
+}
+
 static void notify(struct selector *s)
 {
     fire(&s->changed, NULL);
@@ -136,7 +201,7 @@ static void notify(struct selector *s)
 
 static void do_content_change(struct selector *sel)
 {
-    (void)index_match(initial(sel), sel->view_index, &sel->match);
+    search(sel);
     listbox_set_entries(&sel->records, sel->view_index->entries);
     retain_target(sel);
     notify(sel);
@@ -237,6 +302,8 @@ void selector_init(struct selector *sel, struct library *lib)
     sel->sort = SORT_ARTIST;
     sel->search[0] = '\0';
     sel->search_len = 0;
+    match_compile(&sel->match, sel->search);
+    record_set_init(&sel->matched);
     sel->target = NULL;
 
     index_init(&sel->index_a);
@@ -261,6 +328,7 @@ void selector_clear(struct selector *sel)
     ignore(&sel->on_addition);
     index_clear(&sel->index_a);
     index_clear(&sel->index_b);
+    record_set_clear(&sel->matched);
 }
 
 /*
@@ -291,7 +359,7 @@ struct record* selector_current(struct selector *sel)
     if (i == -1) {
         return NULL;
     } else {
-        return sel->view_index->record[i];
+        return index_record(sel->view_index, i);
     }
 }
 
@@ -408,7 +476,11 @@ void selector_toggle_order(struct selector *sel)
 {
     set_target(sel);
     sel->sort = (sel->sort + 1) % SORT_END;
-    do_content_change(sel);
+    reorder(sel);
+
+    listbox_set_entries(&sel->records, sel->view_index->entries);
+    retain_target(sel);
+    notify(sel);
 }
 
 /*
@@ -455,11 +527,22 @@ void selector_search_refine(struct selector *sel, char key)
     sel->search[++sel->search_len] = '\0';
     match_compile(&sel->match, sel->search);
 
-    (void)index_match(sel->view_index, sel->swap_index, &sel->match);
+    /* A field filter does not necessarily narrow the search as it is
+     * typed, eg. "bpm:12" then "bpm:120" */
 
-    tmp = sel->view_index;
-    sel->view_index = sel->swap_index;
-    sel->swap_index = tmp;
+    if (sel->match.fields) {
+        search(sel);
+    } else {
+        double start;
+
+        start = metrics_now();
+        (void)index_match(sel->view_index, sel->swap_index, &sel->match);
+        count_search(start);
+
+        tmp = sel->view_index;
+        sel->view_index = sel->swap_index;
+        sel->swap_index = tmp;
+    }
 
     listbox_set_entries(&sel->records, sel->view_index->entries);
     set_target(sel);
@@ -42,6 +42,7 @@ struct selector {
     size_t search_len;
     char search[256];
     struct match match; /* the compiled search, kept in-sync */
+    struct record_set matched; /* workspace for re-ordering */
 
     struct event changed;
 };
@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Checkpoint of the decks, so that a restart picks up where it left
+ * off
+ *
+ * The file is written at intervals, only when something has changed,
+ * and replaced in one step so that a crash never leaves it partly
+ * written. It is text, with a line for each deck and for each cue
+ * point which is set.
+ */
+
+#define _GNU_SOURCE /* asprintf(), open_memstream() */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cues.h"
+#include "deck.h"
+#include "fields.h"
+#include "player.h"
+#include "rig.h"
+#include "session.h"
+#include "thread.h"
+#include "timecoder.h"
+#include "xwax.h"
+
+#define VERSION "xwax session 1"
+
+#define INTERVAL 1 /* seconds between checkpoints */
+
+/* Writing of the file, see session_start() */
+
+static char *pathname, *tmp;
+static char *last; /* contents of the file, or NULL */
+static size_t last_len;
+static struct periodic periodic;
+
+/*
+ * Find the record of the given pathname, or add it to the library if
+ * the scan has not reached it yet
+ *
+ * Return: pointer to record, or NULL on error
+ */
+
+static struct record* find_record(struct library *lib, const char *pathname,
+                                  const char *artist, const char *title)
+{
+    char *line;
+    struct record *d, *x;
+
+    x = library_find(lib, pathname);
+    if (x != NULL)
+        return x;
+
+    /* The record is made as if from the output of a scan, which has
+     * no way to give these characters */
+
+    if (strpbrk(pathname, "\t\n") != NULL || strpbrk(artist, "\t\n") != NULL
+        || strpbrk(title, "\t\n") != NULL)
+    {
+        fprintf(stderr, "%s: Ignoring unsupported record\n", pathname);
+        return NULL;
+    }
+
+    if (asprintf(&line, "%s\t%s\t%s", pathname, artist, title) == -1) {
+        perror("asprintf");
+        return NULL;
+    }
+
+    d = get_record(line);
+    if (d == NULL) {
+        free(line);
+        return NULL;
+    }
+
+    x = listing_add(&lib->storage, d);
+    if (x != d) { /* out of memory */
+        free(d->pathname);
+        free(d->match);
+        record_discard(d);
+    }
+
+    return x;
+}
+
+/*
+ * Restore one deck from its line in the file
+ *
+ * Everything is set before the record is loaded, so that the deck
+ * picks up the timecode from where it was.
+ */
+
+static void restore_deck(struct library *lib, char *x[])
+{
+    unsigned long n;
+    struct deck *d;
+    struct timecode_def *def;
+    struct record *re;
+
+    n = strtoul(x[0], NULL, 10);
+    if (n >= ndeck) {
+        fprintf(stderr, "Session has more decks than are given; "
+                "ignoring deck %lu\n", n);
+        return;
+    }
+
+    d = &deck[n];
+
+    def = timecoder_find_definition(x[1]);
+    if (def == NULL)
+        fprintf(stderr, "Session has unknown timecode '%s'\n", x[1]);
+    else
+        timecoder_set_definition(&d->timecoder, def);
+
+    player_set_timecode_control(&d->player, atoi(x[2]) != 0);
+    player_restore(&d->player, strtod(x[4], NULL), strtod(x[3], NULL));
+
+    if (x[7][0] == '\0') /* no record */
+        return;
+
+    fields_unescape(x[5]);
+    fields_unescape(x[6]);
+    fields_unescape(x[7]);
+
+    re = find_record(lib, x[7], x[5], x[6]);
+    if (re == NULL)
+        return;
+
+    fprintf(stderr, "Restoring deck %lu: %s\n", n, re->pathname);
+    deck_load(d, re);
+}
+
+static void restore_cue(char *x[])
+{
+    unsigned long n;
+    unsigned int label;
+
+    n = strtoul(x[0], NULL, 10);
+    label = strtoul(x[1], NULL, 10);
+
+    if (n >= ndeck || label >= MAX_CUES)
+        return;
+
+    cues_set(&deck[n].cues, label, strtod(x[2], NULL));
+}
+
+/*
+ * Restore the decks from a file, if it exists
+ *
+ * The records are all loaded before returning, so they are imported
+ * side by side and a rig is ready in the time of the slowest import.
+ *
+ * Pre: decks are initialised, and the realtime thread is not running
+ * Return: 0 on success, or -1 on error
+ */
+
+int session_restore(struct library *lib, const char *pathname)
+{
+    FILE *f;
+    char *line;
+    size_t len;
+    ssize_t z;
+
+    f = fopen(pathname, "r");
+    if (f == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        perror(pathname);
+        return -1;
+    }
+
+    line = NULL;
+    len = 0;
+
+    z = getline(&line, &len, f);
+    if (z > 0 && line[z - 1] == '\n')
+        line[--z] = '\0';
+
+    if (z == -1 || strcmp(line, VERSION) != 0) {
+        fprintf(stderr, "%s: Not a session file; ignoring it\n", pathname);
+        goto done;
+    }
+
+    while ((z = getline(&line, &len, f)) != -1) {
+        char *x[8];
+
+        if (z > 0 && line[z - 1] == '\n')
+            line[--z] = '\0';
+
+        if (!strncmp(line, "deck\t", 5) && fields_split(line + 5, x, 8)) {
+            restore_deck(lib, x);
+        } else if (!strncmp(line, "cue\t", 4)
+                   && fields_split(line + 4, x, 3))
+        {
+            restore_cue(x);
+        } else {
+            fprintf(stderr, "%s: Ignoring malformed entry\n", pathname);
+        }
+    }
+
+done:
+    free(line);
+    fclose(f);
+    return 0;
+}
+
+/*
+ * Take the state of the decks as the contents of the file
+ *
+ * The position is needed only without timecode control; otherwise it
+ * follows the needle, and is not written so that the file changes only
+ * when something is done at a deck.
+ *
+ * The text of the record is escaped, so any character it has cannot
+ * break the line.
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int snapshot(char **buf, size_t *len)
+{
+    FILE *f;
+    size_t n;
+
+    f = open_memstream(buf, len);
+    if (f == NULL) {
+        perror("open_memstream");
+        return -1;
+    }
+
+    fputs(VERSION "\n", f);
+
+    rig_lock();
+
+    for (n = 0; n < ndeck; n++) {
+        struct deck *d;
+        struct player *pl;
+        const struct record *re;
+        unsigned int c;
+
+        d = &deck[n];
+        pl = &d->player;
+        re = d->record;
+
+        fprintf(f, "deck\t%zu\t%s\t%d\t%.17g\t%.17g\t", n,
+                timecoder_get_definition(&d->timecoder)->name,
+                pl->timecode_control, pl->offset,
+                pl->timecode_control ? 0.0 : pl->position);
+
+        fields_escape(f, re->artist);
+        fputc('\t', f);
+        fields_escape(f, re->title);
+        fputc('\t', f);
+        fields_escape(f, re->pathname);
+        fputc('\n', f);
+
+        for (c = 0; c < MAX_CUES; c++) {
+            double p;
+
+            p = cues_get(&d->cues, c);
+            if (p != CUE_UNSET)
+                fprintf(f, "cue\t%zu\t%u\t%.17g\n", n, c, p);
+        }
+    }
+
+    rig_unlock();
+
+    if (ferror(f) | (fclose(f) != 0)) {
+        perror("snapshot");
+        free(*buf);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Replace the file with the given contents
+ *
+ * The new file is flushed to the disk before it replaces the old, so
+ * that after a crash the file is either the old or the new one.
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int write_file(const char *buf, size_t len)
+{
+    FILE *f;
+
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        perror(tmp);
+        return -1;
+    }
+
+    if (fwrite(buf, 1, len, f) != len || fflush(f) != 0
+        || fsync(fileno(f)) == -1)
+    {
+        perror(tmp);
+        fclose(f);
+        goto fail;
+    }
+
+    if (fclose(f) != 0) {
+        perror(tmp);
+        goto fail;
+    }
+
+    if (rename(tmp, pathname) == -1) {
+        perror("rename");
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    (void)unlink(tmp);
+    return -1;
+}
+
+/*
+ * Write the file if the state of the decks has changed since it was
+ * last written
+ */
+
+static void checkpoint(void)
+{
+    char *buf;
+    size_t len;
+
+    if (snapshot(&buf, &len) == -1)
+        return;
+
+    if (last != NULL && len == last_len && !memcmp(buf, last, len)) {
+        free(buf);
+        return;
+    }
+
+    if (write_file(buf, len) == -1) {
+        free(buf);
+        return;
+    }
+
+    free(last);
+    last = buf;
+    last_len = len;
+}
+
+/*
+ * Checkpoint the decks to a file at a regular interval
+ *
+ * Return: 0 on success, otherwise -1
+ */
+
+int session_start(const char *path)
+{
+    pathname = strdup(path);
+    if (pathname == NULL) {
+        perror("strdup");
+        return -1;
+    }
+
+    if (asprintf(&tmp, "%s.%d", path, getpid()) == -1) {
+        perror("asprintf");
+        free(pathname);
+        return -1;
+    }
+
+    last = NULL;
+
+    if (periodic_start(&periodic, checkpoint, INTERVAL) == -1) {
+        free(tmp);
+        free(pathname);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Stop the checkpoints, writing a final one
+ */
+
+void session_stop(void)
+{
+    periodic_stop(&periodic);
+    checkpoint();
+
+    free(last);
+    free(tmp);
+    free(pathname);
+}
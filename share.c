@@ -0,0 +1,1171 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Shared memory export of the state, and a command socket
+ *
+ * A separate process can map the state and draw its own interface
+ * at its own rate; it never takes any lock in this process. The
+ * state is updated at a fixed rate, and protected by a sequence
+ * count (see share_read()).
+ *
+ * Commands arrive on a Unix socket, one per line, and are carried
+ * out with the rig lock held, as if from a keyboard. A client can
+ * also ask for the position of the decks to be pushed to it at a
+ * given rate; this is enough to run xwax with no interface at all.
+ */
+
+#define _GNU_SOURCE /* accept4(), open_memstream() */
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "library.h"
+#include "metrics.h"
+#include "rig.h"
+#include "share.h"
+#include "status.h"
+#include "xwax.h"
+
+#define RATE 100 /* updates per second */
+#define MAX_CLIENTS 8
+#define MAX_LINE 4096
+#define MAX_WATCH 1000 /* updates per second */
+#define MAX_CROSSFADE 60.0 /* seconds */
+#define MAX_GAIN 4.0 /* of a stem, about +12dB */
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+
+struct client {
+    int fd; /* or -1 */
+    size_t len;
+    char line[MAX_LINE];
+
+    /* Output which the client has not yet taken */
+
+    char *out; /* or NULL */
+    size_t sent, pending;
+
+    /* Updates pushed to the client, see "watch" */
+
+    double period, next; /* or zero */
+    unsigned int status; /* as sent */
+
+    struct index results; /* of the last "search" */
+};
+
+static struct library *library;
+static struct share_state *state;
+static char *shm_name, *sock_path;
+static int sock, event[2]; /* pipe to stop the thread */
+static struct client client[MAX_CLIENTS];
+static pthread_t ph;
+
+static struct observer on_status;
+static unsigned int status_count; /* number of changes */
+
+/* Change in the track of each deck, see export_deck() */
+
+static const struct track *last_track[SHARE_DECKS];
+static const struct record *last_record[SHARE_DECKS];
+static unsigned int last_length[SHARE_DECKS];
+
+static void status_change(struct observer *o, void *x)
+{
+    status_count++;
+}
+
+/*
+ * Copy a string into a fixed-size field
+ */
+
+static void text(char *dest, const char *src, size_t size)
+{
+    size_t len;
+
+    len = strnlen(src, size - 1);
+    memcpy(dest, src, len);
+    dest[len] = '\0';
+}
+
+/*
+ * Pre: rig lock is held
+ */
+
+static void export_deck(struct share_deck *s, size_t n)
+{
+    unsigned int c;
+    int position;
+    struct deck *d;
+    struct player *pl;
+    struct timecoder *tc;
+    struct track *t;
+
+    d = &deck[n];
+    pl = &d->player;
+    tc = pl->timecoder;
+    t = pl->track;
+
+    s->flags = 0;
+    if (track_is_importing(t))
+        s->flags |= SHARE_IMPORTING;
+    if (pl->timecode_control)
+        s->flags |= SHARE_TIMECODE;
+    if (tc->present)
+        s->flags |= SHARE_PRESENT;
+    if (pl->recalibrate)
+        s->flags |= SHARE_RECALIBRATE;
+    if (deck_is_locked(d))
+        s->flags |= SHARE_LOCKED;
+
+    s->rate = t->rate;
+    s->length = t->length;
+    s->timecode = pl->timecode_control ?
+        timecoder_get_position(tc, NULL) : -1;
+
+    s->position = player_get_elapsed(pl);
+    s->pitch = pl->pitch;
+    s->sync_pitch = pl->sync_pitch;
+    s->last_difference = pl->last_difference;
+    s->level[0] = tc->primary.level;
+    s->level[1] = tc->secondary.level;
+    s->noise[0] = tc->primary.noise;
+    s->noise[1] = tc->secondary.noise;
+
+    for (c = 0; c < SHARE_CUES; c++)
+        s->cue[c] = cues_get(&d->cues, c);
+
+    text(s->timecoder, tc->def->name, sizeof s->timecoder);
+
+    /* The overview is rebuilt only as the track changes */
+
+    if (t != last_track[n] || d->record != last_record[n]
+        || t->length != last_length[n])
+    {
+        if (t != last_track[n] || d->record != last_record[n]) {
+            s->track++;
+
+            text(s->pathname, d->record->pathname, sizeof s->pathname);
+            text(s->artist, d->record->artist, sizeof s->artist);
+            text(s->title, d->record->title, sizeof s->title);
+            s->bpm = d->record->bpm;
+        }
+
+        for (c = 0; c < SHARE_OVERVIEW; c++) {
+            unsigned int sp;
+
+            sp = (unsigned long long)t->length * c / SHARE_OVERVIEW;
+            s->overview[c] = (sp < t->length) ? track_get_overview(t, sp) : 0;
+        }
+
+        last_track[n] = t;
+        last_record[n] = d->record;
+        last_length[n] = t->length;
+    }
+
+    position = s->position * t->rate;
+
+    for (c = 0; c < SHARE_CLOSEUP; c++) {
+        long long sp;
+
+        sp = position + ((long long)c - SHARE_CLOSEUP / 2) * TRACK_PPM_RES;
+        if (sp >= 0 && sp < t->length)
+            s->closeup[c] = track_get_ppm(t, sp);
+        else
+            s->closeup[c] = 0;
+    }
+}
+
+/*
+ * Pre: rig lock is held
+ */
+
+static void export_crate(struct share_crate *s, struct crate *c)
+{
+    s->flags = 0;
+    if (c->is_fixed)
+        s->flags |= SHARE_FIXED;
+    if (c->is_busy)
+        s->flags |= SHARE_BUSY;
+
+    s->depth = c->depth;
+    s->records = c->listing->by_order.entries;
+    text(s->name, c->name, sizeof s->name);
+}
+
+/*
+ * Write the current state for any readers
+ *
+ * Readers see the sequence count as odd for the duration, and
+ * know to retry.
+ */
+
+static void export(void)
+{
+    size_t n;
+
+    rig_lock();
+
+    deck_commit_detected(deck, ndeck);
+
+    __atomic_store_n(&state->seq, state->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    state->decks = ndeck;
+    for (n = 0; n < ndeck && n < SHARE_DECKS; n++)
+        export_deck(&state->deck[n], n);
+
+    state->crates = library->crates;
+    for (n = 0; n < library->crates && n < SHARE_CRATES; n++)
+        export_crate(&state->crate[n], library_crate(library, n));
+
+    state->status_level = status_level();
+    text(state->status, status(), sizeof state->status);
+
+    state->frame++;
+    __atomic_store_n(&state->seq, state->seq + 1, __ATOMIC_RELEASE);
+
+    rig_unlock();
+}
+
+/*
+ * Parse a deck number from the command line
+ *
+ * Return: deck, or NULL if not valid
+ */
+
+static struct deck* parse_deck(const char *s)
+{
+    char *end;
+    unsigned long n;
+
+    if (s == NULL)
+        return NULL;
+
+    n = strtoul(s, &end, 10);
+    if (end == s || *end != '\0' || n >= ndeck)
+        return NULL;
+
+    return &deck[n];
+}
+
+static int parse_number(const char *s, unsigned int max)
+{
+    char *end;
+    unsigned long n;
+
+    if (s == NULL)
+        return -1;
+
+    n = strtoul(s, &end, 10);
+    if (end == s || *end != '\0' || n >= max)
+        return -1;
+
+    return n;
+}
+
+/*
+ * Print a line of the position and state of a deck
+ *
+ * Pre: rig lock is held
+ */
+
+static void print_deck(FILE *out, size_t n)
+{
+    char flags[8], *f;
+    struct deck *d;
+    struct player *pl;
+    struct track *t;
+
+    d = &deck[n];
+    pl = &d->player;
+    t = pl->track;
+
+    f = flags;
+    if (pl->timecode_control)
+        *f++ = 't';
+    if (pl->timecoder->present)
+        *f++ = 'p';
+    if (track_is_importing(t))
+        *f++ = 'i';
+    if (deck_is_locked(d))
+        *f++ = 'l';
+    if (t->stems > 0)
+        *f++ = 's';
+    if (deck_queued(d) > 0)
+        *f++ = 'q';
+    if (f == flags)
+        *f++ = '-';
+    *f = '\0';
+
+    fprintf(out, "deck %zu %.3f %.3f %+.4f %d %s\n",
+            n, player_get_elapsed(pl), (double)t->length / t->rate,
+            pl->pitch,
+            pl->timecode_control ? timecoder_get_position(pl->timecoder, NULL)
+                                 : -1,
+            flags);
+}
+
+static void print_records(FILE *out, const struct index *i)
+{
+    size_t n;
+
+    for (n = 0; n < i->entries; n++) {
+        struct record *re;
+
+        re = index_record(i, n);
+        fprintf(out, "%s\t%s\t%s", re->pathname, re->artist, re->title);
+        if (re->bpm != 0.0)
+            fprintf(out, "\t%g", re->bpm);
+        fputc('\n', out);
+    }
+}
+
+/*
+ * Search a crate, in the same way as the selector
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ */
+
+static int search(struct crate *crate, struct index *results,
+                  const char *query)
+{
+    struct listing *l;
+    struct match m;
+    double start;
+    int r;
+
+    start = metrics_now();
+
+    l = crate->listing;
+    match_compile(&m, query);
+
+    if (!m.bpm) {
+        r = index_match(&l->by_artist, results, &m);
+    } else {
+        r = index_match_bpm(&l->by_bpm, results, &m);
+        if (r == 0)
+            index_sort(results, SORT_ARTIST);
+    }
+
+    metric_inc(&metric_searches);
+    metric_add(&metric_search_seconds, metrics_now() - start);
+
+    return r;
+}
+
+/*
+ * Carry out a single command, writing any results
+ *
+ * Pre: rig lock is held
+ * Return: NULL on success, otherwise the reason for failure
+ */
+
+static const char* command(struct client *c, FILE *out, char *line)
+{
+    char *verb, *arg[2], *rest;
+    struct deck *d;
+    int n;
+
+    verb = strtok_r(line, " ", &rest);
+    if (verb == NULL)
+        return "no command";
+
+    arg[0] = strtok_r(NULL, " ", &rest);
+    d = parse_deck(arg[0]);
+
+    if (!strcmp(verb, "load")) {
+        struct record *re;
+
+        if (d == NULL)
+            return "bad deck";
+        if (*rest == '\0')
+            return "no pathname";
+
+        re = library_find(library, rest);
+        if (re == NULL)
+            return "not in library";
+
+        deck_load(d, re);
+
+    } else if (!strcmp(verb, "pick")) {
+        if (d == NULL)
+            return "bad deck";
+
+        arg[1] = strtok_r(NULL, " ", &rest);
+        n = parse_number(arg[1], c->results.entries);
+        if (n == -1)
+            return "bad result";
+
+        deck_load(d, index_record(&c->results, n));
+
+    } else if (!strcmp(verb, "queue")) {
+        struct record *re;
+
+        if (d == NULL)
+            return "bad deck";
+        if (*rest == '\0')
+            return "no pathname";
+
+        re = library_find(library, rest);
+        if (re == NULL)
+            return "not in library";
+
+        if (deck_queue(d, re) == -1)
+            return "out of memory";
+
+    } else if (!strcmp(verb, "queue-pick")) {
+        if (d == NULL)
+            return "bad deck";
+
+        arg[1] = strtok_r(NULL, " ", &rest);
+        n = parse_number(arg[1], c->results.entries);
+        if (n == -1)
+            return "bad result";
+
+        if (deck_queue(d, index_record(&c->results, n)) == -1)
+            return "out of memory";
+
+    } else if (!strcmp(verb, "queue-crate")) {
+        if (d == NULL)
+            return "bad deck";
+
+        arg[1] = strtok_r(NULL, " ", &rest);
+        n = parse_number(arg[1], library->crates);
+        if (n == -1)
+            return "bad crate";
+
+        if (deck_queue_index(d, &library_crate(library, n)->listing->by_artist)
+            == -1)
+        {
+            return "out of memory";
+        }
+
+    } else if (!strcmp(verb, "unqueue")) {
+        if (d == NULL)
+            return "bad deck";
+        deck_unqueue(d);
+
+    } else if (!strcmp(verb, "crossfade")) {
+        char *end;
+        double seconds;
+
+        if (d == NULL)
+            return "bad deck";
+        if (*rest == '\0')
+            return "bad length";
+
+        seconds = strtod(rest, &end);
+        if (end == rest || *end != '\0' || !isfinite(seconds)
+            || seconds < 0.0)
+        {
+            return "bad length";
+        }
+
+        if (seconds > MAX_CROSSFADE)
+            seconds = MAX_CROSSFADE;
+
+        player_set_crossfade(&d->player, seconds);
+
+    } else if (!strcmp(verb, "recue")) {
+        if (d == NULL)
+            return "bad deck";
+        deck_recue(d);
+
+    } else if (!strcmp(verb, "cue") || !strcmp(verb, "unset")) {
+        if (d == NULL)
+            return "bad deck";
+
+        arg[1] = strtok_r(NULL, " ", &rest);
+        n = parse_number(arg[1], SHARE_CUES);
+        if (n == -1)
+            return "bad cue";
+
+        if (verb[0] == 'c')
+            deck_cue(d, n);
+        else
+            deck_unset_cue(d, n);
+
+    } else if (!strcmp(verb, "seek")) {
+        char *end;
+        double seconds;
+
+        if (d == NULL)
+            return "bad deck";
+
+        arg[1] = strtok_r(NULL, " ", &rest);
+        if (arg[1] == NULL)
+            return "bad position";
+
+        seconds = strtod(arg[1], &end);
+        if (end == arg[1] || *end != '\0' || !isfinite(seconds))
+            return "bad position";
+
+        if (deck_is_locked(d))
+            return "deck is locked";
+
+        player_seek_to(&d->player, seconds);
+
+    } else if (!strcmp(verb, "gain")) {
+        char *end;
+        double gain;
+
+        if (d == NULL)
+            return "bad deck";
+
+        arg[1] = strtok_r(NULL, " ", &rest);
+        n = parse_number(arg[1], TRACK_MAX_STEMS);
+        if (n == -1)
+            return "bad stem";
+
+        if (*rest == '\0')
+            return "bad gain";
+
+        gain = strtod(rest, &end);
+        if (end == rest || *end != '\0' || !isfinite(gain)
+            || gain < 0.0 || gain > MAX_GAIN)
+        {
+            return "bad gain";
+        }
+
+        player_set_gain(&d->player, n, gain);
+
+    } else if (!strcmp(verb, "timecode")) {
+        if (d == NULL)
+            return "bad deck";
+        (void)player_toggle_timecode_control(&d->player);
+
+    } else if (!strcmp(verb, "clone")) {
+        struct deck *from;
+
+        if (d == NULL)
+            return "bad deck";
+
+        from = parse_deck(strtok_r(NULL, " ", &rest));
+        if (from == NULL)
+            return "bad deck";
+
+        deck_clone(d, from);
+
+    } else if (!strcmp(verb, "decks")) {
+        size_t i;
+
+        for (i = 0; i < ndeck; i++)
+            print_deck(out, i);
+
+    } else if (!strcmp(verb, "status")) {
+        fprintf(out, "status %d %s\n", status_level(), status());
+
+    } else if (!strcmp(verb, "watch")) {
+        n = parse_number(arg[0], MAX_WATCH + 1);
+        if (n == -1)
+            return "bad rate";
+
+        if (n == 0) {
+            c->period = 0.0;
+        } else {
+            c->period = 1.0 / n;
+            c->next = metrics_now();
+            c->status = status_count - 1; /* send the current status */
+        }
+
+    } else if (!strcmp(verb, "crates")) {
+        size_t i;
+
+        for (i = 0; i < library->crates; i++) {
+            struct crate *cr;
+
+            cr = library_crate(library, i);
+            fprintf(out, "%zu\t%zu\t%u\t%s\n", i,
+                    cr->listing->by_order.entries, cr->depth, cr->name);
+        }
+
+    } else if (!strcmp(verb, "records")) {
+        n = parse_number(arg[0], library->crates);
+        if (n == -1)
+            return "bad crate";
+
+        print_records(out, &library_crate(library, n)->listing->by_artist);
+
+    } else if (!strcmp(verb, "search")) {
+        n = parse_number(arg[0], library->crates);
+        if (n == -1)
+            return "bad crate";
+
+        if (search(library_crate(library, n), &c->results, rest) == -1)
+            return "out of memory";
+
+        print_records(out, &c->results);
+
+    } else if (!strcmp(verb, "metrics")) {
+        if (metrics_write(out) == -1)
+            return "failed";
+
+    } else if (!strcmp(verb, "quit")) {
+        if (rig_quit() == -1)
+            return "failed";
+
+    } else {
+        return "unknown command";
+    }
+
+    return NULL;
+}
+
+/*
+ * Send as much of the pending output as the client will take,
+ * without waiting
+ *
+ * Return: 0 on success, or -1 if the client should be dropped
+ */
+
+static int flush(struct client *c)
+{
+    while (c->pending > 0) {
+        ssize_t r;
+
+        r = send(c->fd, c->out + c->sent, c->pending, MSG_NOSIGNAL);
+        if (r == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+
+        c->sent += r;
+        c->pending -= r;
+    }
+
+    free(c->out);
+    c->out = NULL;
+    c->sent = 0;
+
+    return 0;
+}
+
+/*
+ * Queue output to the client, and send what it will take now
+ *
+ * Return: 0 on success, or -1 if the client should be dropped
+ * Post: buf is owned by the client
+ */
+
+static int queue(struct client *c, char *buf, size_t len)
+{
+    if (c->out == NULL) {
+        c->out = buf;
+        c->sent = 0;
+        c->pending = len;
+    } else {
+        char *out;
+
+        out = realloc(c->out, c->sent + c->pending + len);
+        if (out == NULL) {
+            perror("realloc");
+            free(buf);
+            return -1;
+        }
+
+        memcpy(out + c->sent + c->pending, buf, len);
+        free(buf);
+
+        c->out = out;
+        c->pending += len;
+    }
+
+    return flush(c);
+}
+
+/*
+ * Reply to a single command from a client
+ *
+ * Results are gathered with the rig lock held, but sent without it
+ * and without waiting; any the client does not take is sent as it
+ * becomes ready. No more commands are read from a client until then,
+ * so a slow client holds up neither xwax nor the other clients.
+ *
+ * Return: 0 on success, or -1 if the client should be dropped
+ */
+
+static int reply(struct client *c, char *line)
+{
+    char *buf;
+    const char *err;
+    size_t len;
+    FILE *out;
+
+    out = open_memstream(&buf, &len);
+    if (out == NULL) {
+        perror("open_memstream");
+        return -1;
+    }
+
+    rig_lock();
+    err = command(c, out, line);
+    rig_unlock();
+
+    if (err == NULL)
+        fputs("ok\n", out);
+    else
+        fprintf(out, "error %s\n", err);
+
+    if (fclose(out) != 0) {
+        perror("fclose");
+        free(buf);
+        return -1;
+    }
+
+    return queue(c, buf, len);
+}
+
+/*
+ * Push the position of every deck, and any change of status, to a
+ * client which is watching
+ *
+ * An update is skipped if the client has yet to take the last one;
+ * the positions would be out of date by the time it did.
+ *
+ * Return: 0 on success, or -1 if the client should be dropped
+ */
+
+static int push(struct client *c)
+{
+    char *buf;
+    size_t len, n;
+    FILE *out;
+
+    if (c->out != NULL)
+        return 0;
+
+    out = open_memstream(&buf, &len);
+    if (out == NULL) {
+        perror("open_memstream");
+        return -1;
+    }
+
+    rig_lock();
+
+    for (n = 0; n < ndeck; n++)
+        print_deck(out, n);
+
+    if (c->status != status_count) {
+        fprintf(out, "status %d %s\n", status_level(), status());
+        c->status = status_count;
+    }
+
+    rig_unlock();
+
+    if (fclose(out) != 0) {
+        perror("fclose");
+        free(buf);
+        return -1;
+    }
+
+    return queue(c, buf, len);
+}
+
+static void drop(struct client *c)
+{
+    if (close(c->fd) == -1)
+        abort();
+    c->fd = -1;
+    free(c->out);
+    index_clear(&c->results);
+}
+
+static void accept_client(void)
+{
+    struct client *c;
+    int fd;
+
+    fd = accept4(sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+        perror("accept4");
+        return;
+    }
+
+    for (c = client; c < client + ARRAY_SIZE(client); c++) {
+        if (c->fd == -1)
+            break;
+    }
+
+    if (c == client + ARRAY_SIZE(client)) {
+        fprintf(stderr, "Too many share clients.\n");
+        if (close(fd) == -1)
+            abort();
+        return;
+    }
+
+    c->fd = fd;
+    c->len = 0;
+    c->out = NULL;
+    c->period = 0.0;
+    index_init(&c->results);
+}
+
+/*
+ * Take input from the client, and act on any complete lines
+ */
+
+static void handle_client(struct client *c)
+{
+    ssize_t z;
+    char *start, *end;
+
+    z = read(c->fd, c->line + c->len, sizeof c->line - c->len);
+    if (z == -1 && errno == EAGAIN)
+        return;
+    if (z <= 0) {
+        drop(c);
+        return;
+    }
+
+    c->len += z;
+    start = c->line;
+
+    for (;;) {
+        end = memchr(start, '\n', c->line + c->len - start);
+        if (end == NULL)
+            break;
+
+        *end = '\0';
+        if (end > start && end[-1] == '\r')
+            end[-1] = '\0';
+
+        if (reply(c, start) == -1) {
+            drop(c);
+            return;
+        }
+
+        start = end + 1;
+    }
+
+    c->len -= start - c->line;
+    memmove(c->line, start, c->len);
+
+    if (c->len == sizeof c->line) { /* line is too long */
+        drop(c);
+        return;
+    }
+}
+
+/*
+ * The thread which exports the state and serves the clients
+ */
+
+static void* launch(void *p)
+{
+    double next;
+
+    next = metrics_now();
+
+    for (;;) {
+        struct pollfd pt[2 + MAX_CLIENTS], *pe, *px;
+        struct client *c;
+        double t, wake;
+        int r;
+
+        t = metrics_now();
+        if (t >= next) {
+            export();
+            next += 1.0 / RATE;
+            if (next < t) /* fell behind */
+                next = t + 1.0 / RATE;
+        }
+
+        wake = next;
+
+        for (c = client; c < client + ARRAY_SIZE(client); c++) {
+            if (c->fd == -1 || c->period == 0.0)
+                continue;
+
+            if (t >= c->next) {
+                if (push(c) == -1) {
+                    drop(c);
+                    continue;
+                }
+
+                c->next += c->period;
+                if (c->next < t)
+                    c->next = t + c->period;
+            }
+
+            if (c->next < wake)
+                wake = c->next;
+        }
+
+        pt[0].fd = event[0];
+        pt[0].events = POLLIN;
+        pt[1].fd = sock;
+        pt[1].events = POLLIN;
+        pe = &pt[2];
+
+        /* A client which has output waiting is only given more
+         * as it takes it */
+
+        for (c = client; c < client + ARRAY_SIZE(client); c++) {
+            if (c->fd == -1)
+                continue;
+            pe->fd = c->fd;
+            pe->events = (c->out != NULL) ? POLLOUT : POLLIN;
+            pe++;
+        }
+
+        px = pe;
+
+        r = poll(pt, pe - pt, (wake - t) * 1000 + 1);
+        if (r == -1) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+
+        if (pt[0].revents != 0)
+            break;
+
+        if (pt[1].revents & POLLIN)
+            accept_client();
+
+        /* Clients are in the same order as they were polled */
+
+        pe = &pt[2];
+
+        for (c = client; c < client + ARRAY_SIZE(client); c++) {
+            if (pe == px)
+                break;
+            if (c->fd != pe->fd) /* accepted since the poll */
+                continue;
+
+            if (pe->revents & POLLOUT) {
+                if (flush(c) == -1)
+                    drop(c);
+            } else if (pe->revents != 0) {
+                handle_client(c);
+            }
+
+            pe++;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Return: the directory for the command socket
+ */
+
+static const char* runtime_dir(void)
+{
+    const char *d;
+
+    d = getenv("XDG_RUNTIME_DIR");
+    if (d == NULL || d[0] == '\0')
+        d = "/tmp";
+
+    return d;
+}
+
+/*
+ * Export the state with the given name
+ *
+ * The state appears as shared memory "/<name>" (see shm_open(3)),
+ * and commands are taken at a socket "<name>.sock" in the user's
+ * runtime directory. Any leftovers of a previous run are replaced.
+ *
+ * Return: 0 on success, otherwise -1
+ */
+
+int share_start(struct library *lib, const char *name)
+{
+    int fd;
+    size_t n;
+    struct sockaddr_un addr;
+
+    if (name[0] == '\0' || strchr(name, '/') != NULL) {
+        fprintf(stderr, "Share name '%s' is not valid.\n", name);
+        return -1;
+    }
+
+    library = lib;
+
+    if (asprintf(&shm_name, "/%s", name) == -1) {
+        perror("asprintf");
+        return -1;
+    }
+
+    if (asprintf(&sock_path, "%s/%s.sock", runtime_dir(), name) == -1) {
+        perror("asprintf");
+        goto fail_name;
+    }
+
+    if (strlen(sock_path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "%s: Pathname is too long\n", sock_path);
+        goto fail_path;
+    }
+
+    /* Shared memory */
+
+    (void)shm_unlink(shm_name);
+
+    fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        perror("shm_open");
+        goto fail_path;
+    }
+
+    if (ftruncate(fd, sizeof *state) == -1) {
+        perror("ftruncate");
+        if (close(fd) == -1)
+            abort();
+        goto fail_shm;
+    }
+
+    state = mmap(NULL, sizeof *state, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+    if (close(fd) == -1)
+        abort();
+    if (state == MAP_FAILED) {
+        perror("mmap");
+        goto fail_shm;
+    }
+
+    state->magic = SHARE_MAGIC;
+    state->version = SHARE_VERSION;
+    state->size = sizeof *state;
+
+    for (n = 0; n < SHARE_DECKS; n++) {
+        last_track[n] = NULL;
+        last_record[n] = NULL;
+    }
+
+    /* Command socket */
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        perror("socket");
+        goto fail_mmap;
+    }
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock_path);
+
+    (void)unlink(sock_path);
+
+    if (bind(sock, (struct sockaddr*)&addr, sizeof addr) == -1) {
+        perror("bind");
+        goto fail_sock;
+    }
+
+    if (listen(sock, MAX_CLIENTS) == -1) {
+        perror("listen");
+        goto fail_bind;
+    }
+
+    for (n = 0; n < ARRAY_SIZE(client); n++)
+        client[n].fd = -1;
+
+    if (pipe(event) == -1) {
+        perror("pipe");
+        goto fail_bind;
+    }
+
+    fprintf(stderr, "Sharing state at %s, commands at %s\n",
+            shm_name, sock_path);
+
+    watch(&on_status, &status_changed, status_change);
+
+    if (pthread_create(&ph, NULL, launch, NULL)) {
+        perror("pthread_create");
+        goto fail_watch;
+    }
+
+    return 0;
+
+fail_watch:
+    ignore(&on_status);
+    if (close(event[0]) == -1)
+        abort();
+    if (close(event[1]) == -1)
+        abort();
+fail_bind:
+    (void)unlink(sock_path);
+fail_sock:
+    if (close(sock) == -1)
+        abort();
+fail_mmap:
+    if (munmap(state, sizeof *state) == -1)
+        abort();
+fail_shm:
+    (void)shm_unlink(shm_name);
+fail_path:
+    free(sock_path);
+fail_name:
+    free(shm_name);
+    return -1;
+}
+
+/*
+ * Stop the export, and remove it from the system
+ */
+
+void share_stop(void)
+{
+    size_t n;
+
+    if (write(event[1], "", 1) == -1)
+        abort();
+
+    if (pthread_join(ph, NULL) != 0)
+        abort();
+
+    ignore(&on_status);
+
+    for (n = 0; n < ARRAY_SIZE(client); n++) {
+        if (client[n].fd != -1)
+            drop(&client[n]);
+    }
+
+    if (close(event[0]) == -1)
+        abort();
+    if (close(event[1]) == -1)
+        abort();
+
+    if (unlink(sock_path) == -1)
+        perror("unlink");
+    if (close(sock) == -1)
+        abort();
+    free(sock_path);
+
+    if (munmap(state, sizeof *state) == -1)
+        abort();
+    if (shm_unlink(shm_name) == -1)
+        perror("shm_unlink");
+    free(shm_name);
+}
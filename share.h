@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Export the state of the decks and library to other processes
+ *
+ * The layout of the shared memory is given here, so that a separate
+ * interface can include this file. Nothing here depends on the
+ * rest of xwax.
+ */
+
+#ifndef SHARE_H
+#define SHARE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SHARE_MAGIC 0x78776178 /* "xwax" */
+#define SHARE_VERSION 1
+
+#define SHARE_DECKS 4
+#define SHARE_CUES 16
+#define SHARE_CRATES 256
+#define SHARE_TEXT 256
+#define SHARE_PATH 4096
+#define SHARE_OVERVIEW 1024 /* across the whole track */
+#define SHARE_CLOSEUP 1024 /* PPM values, centred on the playhead */
+
+/* Flags of a deck */
+
+#define SHARE_IMPORTING  0x01
+#define SHARE_TIMECODE   0x02 /* under timecode control */
+#define SHARE_PRESENT    0x04 /* timecode signal is present */
+#define SHARE_RECALIBRATE 0x08
+#define SHARE_LOCKED     0x10 /* protected from certain operations */
+
+/* Flags of a crate */
+
+#define SHARE_FIXED 0x01
+#define SHARE_BUSY  0x02
+
+struct share_deck {
+    uint32_t track, /* changes when a new track is loaded */
+        flags,
+        rate, /* of the track */
+        length; /* of the track, in samples */
+    int32_t timecode; /* or -1 if not known */
+
+    double position, /* seconds, relative to the start of the track */
+        pitch, sync_pitch, last_difference, bpm,
+        level[2], noise[2], /* of the timecode input */
+        cue[SHARE_CUES]; /* seconds, or HUGE_VAL if unset */
+
+    char timecoder[32], /* name of the timecode definition */
+        pathname[SHARE_PATH], artist[SHARE_TEXT], title[SHARE_TEXT];
+
+    unsigned char overview[SHARE_OVERVIEW],
+        closeup[SHARE_CLOSEUP]; /* one every TRACK_PPM_RES samples */
+};
+
+struct share_crate {
+    uint32_t flags, depth, records;
+    char name[SHARE_TEXT];
+};
+
+struct share_state {
+    uint32_t magic, version,
+        size, /* of this structure */
+        seq; /* odd whilst the state is being written */
+    uint64_t frame; /* number of updates */
+
+    uint32_t decks, crates; /* crates may exceed SHARE_CRATES */
+    int32_t status_level;
+    char status[SHARE_TEXT];
+
+    struct share_deck deck[SHARE_DECKS];
+    struct share_crate crate[SHARE_CRATES];
+};
+
+/*
+ * Take a consistent copy of the shared state
+ *
+ * For use by a reader; the writer never waits for a reader.
+ *
+ * Return: true on success, or false if the caller should try again
+ */
+
+static inline bool share_read(const struct share_state *s,
+                              struct share_state *copy)
+{
+    uint32_t seq;
+
+    seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1)
+        return false;
+
+    memcpy(copy, s, sizeof *copy);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq;
+}
+
+struct library;
+
+int share_start(struct library *lib, const char *name);
+void share_stop(void);
+
+#endif
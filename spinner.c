@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spinner.h"
+
+/*
+ * Calculate a lookup which maps a position on screen to an angle,
+ * relative to the centre of the spinner
+ */
+
+static void calculate_angle_lut(unsigned short *lut, int size)
+{
+    int r, c, nr, nc;
+    float theta, rat;
+
+    for (r = 0; r < size; r++) {
+        nr = r - size / 2;
+
+        for (c = 0; c < size; c++) {
+            nc = c - size / 2;
+
+            if (nr == 0)
+                theta = M_PI_2;
+
+            else if (nc == 0) {
+                theta = 0;
+
+                if (nr < 0)
+                    theta = M_PI;
+
+            } else {
+                rat = (float)(nc) / -nr;
+                theta = atanf(rat);
+
+                if (rat < 0)
+                    theta += M_PI;
+            }
+
+            if (nc <= 0)
+                theta += M_PI;
+
+            /* The angles stored in the lookup table range from 0 to
+             * 1023 (where 1024 is 360 degrees) */
+
+            lut[r * size + c]
+                = ((int)(theta * 1024 / (M_PI * 2)) + 1024) % 1024;
+        }
+    }
+}
+
+/*
+ * Return: true if the pixel at the given angle is in the dark half
+ * of the spinner when it is rotated to 'angle'
+ */
+
+static bool is_dark(int angle, unsigned short pangle)
+{
+    return (angle - pangle + SPINNER_ANGLES) % SPINNER_ANGLES
+        < SPINNER_ANGLES / 2;
+}
+
+/*
+ * Initialise a spinner of the given size
+ *
+ * For each angle and row, the run is the column where the row
+ * changes from one half to the other (or the size, if it does not)
+ * shifted left by one, and the lowest bit is set if the row starts
+ * in the dark half.
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+int spinner_init(struct spinner *s, int size)
+{
+    int a, r, c;
+    unsigned short *lut;
+
+    lut = malloc(size * size * (sizeof *lut));
+    if (lut == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    s->run = malloc(SPINNER_ANGLES * size * (sizeof *s->run));
+    if (s->run == NULL) {
+        perror("malloc");
+        free(lut);
+        return -1;
+    }
+
+    calculate_angle_lut(lut, size);
+
+    /* A line through the centre crosses each row at most once, so
+     * a row is always two runs */
+
+    for (a = 0; a < SPINNER_ANGLES; a++) {
+        for (r = 0; r < size; r++) {
+            const unsigned short *row;
+            bool dark;
+
+            row = &lut[r * size];
+            dark = is_dark(a, row[0]);
+
+            for (c = 1; c < size; c++) {
+                if (is_dark(a, row[c]) != dark)
+                    break;
+            }
+
+            s->run[a * size + r] = c << 1 | dark;
+        }
+    }
+
+    free(lut);
+    s->size = size;
+
+    return 0;
+}
+
+void spinner_clear(struct spinner *s)
+{
+    free(s->run);
+}
+
+/*
+ * Fill a run of pixels with the same value
+ */
+
+static void fill(unsigned char *p, const unsigned char *px, int bpp, int n)
+{
+    int c;
+
+    if (bpp == 4) {
+        uint32_t v;
+
+        memcpy(&v, px, sizeof v);
+        for (c = 0; c < n; c++)
+            memcpy(p + c * 4, &v, sizeof v);
+    } else {
+        for (c = 0; c < n; c++)
+            memcpy(p + c * bpp, px, bpp);
+    }
+}
+
+/*
+ * Draw the spinner at the given angle
+ *
+ * The spinner is clipped to the given width and height. The dark and
+ * light pixels are given in the format of the destination, which has
+ * 'bpp' bytes per pixel.
+ */
+
+void spinner_draw(const struct spinner *s, unsigned char *pixels,
+                  int pitch, int bpp, int w, int h, int angle,
+                  const unsigned char *dark, const unsigned char *light)
+{
+    int r;
+    const uint16_t *run;
+
+    if (w > s->size)
+        w = s->size;
+    if (h > s->size)
+        h = s->size;
+
+    angle %= SPINNER_ANGLES;
+    if (angle < 0)
+        angle += SPINNER_ANGLES;
+
+    run = &s->run[angle * s->size];
+
+    for (r = 0; r < h; r++) {
+        unsigned char *p;
+        const unsigned char *left, *right;
+        int split;
+
+        p = pixels + r * pitch;
+        split = run[r] >> 1;
+
+        if (run[r] & 1) {
+            left = dark;
+            right = light;
+        } else {
+            left = light;
+            right = dark;
+        }
+
+        if (split > w)
+            split = w;
+
+        fill(p, left, bpp, split);
+        fill(p + split * bpp, right, bpp, w - split);
+    }
+}
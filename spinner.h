@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef SPINNER_H
+#define SPINNER_H
+
+#include <stdint.h>
+
+#define SPINNER_ANGLES 1024 /* in one revolution */
+
+/*
+ * The spinner, which shows the rotational position of a record as a
+ * circle of two halves
+ *
+ * At any angle, each row of the spinner is in two runs: one of each
+ * half. These are worked out for every angle up-front, so drawing is
+ * a fill of two runs per row.
+ */
+
+struct spinner {
+    int size; /* width and height, in pixels */
+    uint16_t *run; /* for each angle and row, see spinner_init() */
+};
+
+int spinner_init(struct spinner *s, int size);
+void spinner_clear(struct spinner *s);
+
+void spinner_draw(const struct spinner *s, unsigned char *pixels,
+                  int pitch, int bpp, int w, int h, int angle,
+                  const unsigned char *dark, const unsigned char *light);
+
+#endif
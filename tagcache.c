@@ -0,0 +1,368 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Cache of the tags of audio files, so that a rescan need only read
+ * the files which have changed
+ *
+ * An entry is valid while the file has the same device, inode,
+ * modification time and size. The cache is saved as text, one file
+ * per line; only the entries used since loading are saved, so files
+ * which have gone are forgotten.
+ */
+
+#define _GNU_SOURCE /* asprintf() */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fields.h"
+#include "hash.h"
+#include "tagcache.h"
+
+#define VERSION "xwax tags 1"
+
+void tagcache_init(struct tagcache *c)
+{
+    c->entry = NULL;
+    c->entries = 0;
+    c->size = 0;
+    c->slot = NULL;
+    c->slots = 0;
+}
+
+void tagcache_clear(struct tagcache *c)
+{
+    size_t n;
+
+    for (n = 0; n < c->entries; n++)
+        free(c->entry[n].pathname);
+
+    free(c->entry);
+    free(c->slot);
+}
+
+/*
+ * Return: slot of the given pathname, or the empty slot where it
+ * belongs
+ *
+ * Pre: table has at least one empty slot
+ */
+
+static size_t* find(const struct tagcache *c, const char *pathname)
+{
+    size_t n;
+
+    n = fnv1a_32(pathname) & (c->slots - 1);
+
+    while (c->slot[n] != 0) {
+        if (strcmp(c->entry[c->slot[n] - 1].pathname, pathname) == 0)
+            break;
+        n = (n + 1) & (c->slots - 1);
+    }
+
+    return &c->slot[n];
+}
+
+/*
+ * Make space for another entry, keeping the table no more than half
+ * full
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ */
+
+static int reserve(struct tagcache *c)
+{
+    if (c->entries == c->size) {
+        struct tagcache_entry *e;
+        size_t size;
+
+        size = c->size ? c->size * 2 : 1024;
+        e = realloc(c->entry, sizeof *e * size);
+        if (e == NULL) {
+            perror("realloc");
+            return -1;
+        }
+
+        c->entry = e;
+        c->size = size;
+    }
+
+    if ((c->entries + 1) * 2 > c->slots) {
+        size_t n, slots, *slot, *old;
+
+        slots = c->slots ? c->slots * 2 : 2048;
+        slot = calloc(slots, sizeof *slot);
+        if (slot == NULL) {
+            perror("calloc");
+            return -1;
+        }
+
+        old = c->slot;
+        c->slot = slot;
+        c->slots = slots;
+
+        for (n = 0; n < c->entries; n++)
+            *find(c, c->entry[n].pathname) = n + 1;
+
+        free(old);
+    }
+
+    return 0;
+}
+
+/*
+ * Add an entry, or replace the existing one for the same pathname
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ */
+
+static int add(struct tagcache *c, const char *pathname, const char *artist,
+               const char *title, double bpm, const struct stat *st)
+{
+    struct tagcache_entry *e;
+    size_t *slot, p, a, t;
+    char *buf;
+
+    if (reserve(c) == -1)
+        return -1;
+
+    p = strlen(pathname) + 1;
+    a = strlen(artist) + 1;
+    t = strlen(title) + 1;
+
+    buf = malloc(p + a + t);
+    if (buf == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    slot = find(c, pathname);
+    if (*slot != 0) {
+        e = &c->entry[*slot - 1];
+        free(e->pathname);
+    } else {
+        e = &c->entry[c->entries++];
+        *slot = c->entries;
+    }
+
+    e->pathname = memcpy(buf, pathname, p);
+    e->artist = memcpy(buf + p, artist, a);
+    e->title = memcpy(buf + p + a, title, t);
+    e->bpm = bpm;
+
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->size = st->st_size;
+    e->mtime = st->st_mtim;
+    e->used = false;
+
+    return 0;
+}
+
+/*
+ * Load the cache from a file, if it exists
+ *
+ * A file from a different version, or with a different identifier,
+ * is ignored.
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+int tagcache_load(struct tagcache *c, const char *pathname, const char *id)
+{
+    FILE *f;
+    char *line, *header;
+    size_t len;
+    ssize_t z;
+    int r;
+
+    f = fopen(pathname, "r");
+    if (f == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        perror(pathname);
+        return -1;
+    }
+
+    if (asprintf(&header, VERSION "\t%s", id) == -1) {
+        perror("asprintf");
+        fclose(f);
+        return -1;
+    }
+
+    line = NULL;
+    len = 0;
+    r = 0;
+
+    z = getline(&line, &len, f);
+    if (z > 0 && line[z - 1] == '\n')
+        line[--z] = '\0';
+
+    if (z == -1 || strcmp(line, header) != 0)
+        goto done;
+
+    while ((z = getline(&line, &len, f)) != -1) {
+        char *x[8], *end;
+        struct stat st;
+        double bpm;
+
+        if (z > 0 && line[z - 1] == '\n')
+            line[--z] = '\0';
+
+        if (!fields_split(line, x, 8)) {
+            fprintf(stderr, "%s: Ignoring malformed entry\n", pathname);
+            continue;
+        }
+
+        st.st_dev = strtoull(x[0], NULL, 10);
+        st.st_ino = strtoull(x[1], NULL, 10);
+        st.st_size = strtoll(x[2], NULL, 10);
+        st.st_mtim.tv_sec = strtoll(x[3], &end, 10);
+        st.st_mtim.tv_nsec = (*end == '.') ? strtol(end + 1, NULL, 10) : 0;
+        bpm = strtod(x[4], NULL);
+
+        if (add(c, x[7], x[5], x[6], bpm, &st) == -1) {
+            r = -1;
+            break;
+        }
+    }
+
+done:
+    free(line);
+    free(header);
+    fclose(f);
+    return r;
+}
+
+/*
+ * Save the entries which have been used to a file, replacing it
+ * in one step
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+int tagcache_save(const struct tagcache *c, const char *pathname,
+                  const char *id)
+{
+    FILE *f;
+    char *tmp;
+    size_t n;
+
+    if (asprintf(&tmp, "%s.%d", pathname, getpid()) == -1) {
+        perror("asprintf");
+        return -1;
+    }
+
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        perror(tmp);
+        free(tmp);
+        return -1;
+    }
+
+    fprintf(f, VERSION "\t%s\n", id);
+
+    for (n = 0; n < c->entries; n++) {
+        const struct tagcache_entry *e;
+
+        e = &c->entry[n];
+        if (!e->used)
+            continue;
+
+        fprintf(f, "%llu\t%llu\t%lld\t%lld.%09ld\t%.17g\t%s\t%s\t%s\n",
+                (unsigned long long)e->dev, (unsigned long long)e->ino,
+                (long long)e->size,
+                (long long)e->mtime.tv_sec, e->mtime.tv_nsec,
+                e->bpm, e->artist, e->title, e->pathname);
+    }
+
+    if (ferror(f) | (fclose(f) != 0)) {
+        perror(tmp);
+        goto fail;
+    }
+
+    if (rename(tmp, pathname) == -1) {
+        perror("rename");
+        goto fail;
+    }
+
+    free(tmp);
+    return 0;
+
+fail:
+    unlink(tmp);
+    free(tmp);
+    return -1;
+}
+
+/*
+ * Find the tags of a file, if they are in the cache and the file has
+ * not changed
+ *
+ * Return: pointer to entry, or NULL if not found
+ */
+
+const struct tagcache_entry* tagcache_lookup(struct tagcache *c,
+                                             const char *pathname,
+                                             const struct stat *st)
+{
+    struct tagcache_entry *e;
+    size_t *slot;
+
+    if (c->slots == 0)
+        return NULL;
+
+    slot = find(c, pathname);
+    if (*slot == 0)
+        return NULL;
+
+    e = &c->entry[*slot - 1];
+
+    if (e->dev != st->st_dev || e->ino != st->st_ino
+        || e->size != st->st_size
+        || e->mtime.tv_sec != st->st_mtim.tv_sec
+        || e->mtime.tv_nsec != st->st_mtim.tv_nsec)
+    {
+        return NULL;
+    }
+
+    e->used = true;
+    return e;
+}
+
+/*
+ * Add the tags of a file to the cache
+ *
+ * Return: 0 on success, or -1 on memory allocation failure
+ */
+
+int tagcache_store(struct tagcache *c, const char *pathname,
+                   const struct stat *st, const struct tags *t)
+{
+    if (add(c, pathname, t->artist, t->title, t->bpm, st) == -1)
+        return -1;
+
+    c->entry[*find(c, pathname) - 1].used = true;
+    return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef TAGCACHE_H
+#define TAGCACHE_H
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "tags.h"
+
+/* The tags of a file, which are valid for as long as the file is
+ * not changed */
+
+struct tagcache_entry {
+    char *pathname; /* a single malloc, including artist and title */
+    const char *artist, *title;
+    double bpm;
+
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+
+    bool used; /* looked up or stored since loading */
+};
+
+/* Persistent cache of tags, by pathname */
+
+struct tagcache {
+    struct tagcache_entry *entry;
+    size_t entries, size;
+
+    size_t *slot; /* entry + 1, or zero if empty */
+    size_t slots; /* power of two */
+};
+
+void tagcache_init(struct tagcache *c);
+void tagcache_clear(struct tagcache *c);
+
+int tagcache_load(struct tagcache *c, const char *pathname, const char *id);
+int tagcache_save(const struct tagcache *c, const char *pathname,
+                  const char *id);
+
+const struct tagcache_entry* tagcache_lookup(struct tagcache *c,
+                                             const char *pathname,
+                                             const struct stat *st);
+int tagcache_store(struct tagcache *c, const char *pathname,
+                   const struct stat *st, const struct tags *t);
+
+#endif
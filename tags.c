@@ -0,0 +1,983 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Reading of artist, title and BPM from the tags of common audio
+ * files: ID3 (MP3), FLAC, Ogg Vorbis and Opus, and MP4
+ *
+ * Only the headers are read, seeking past any other content such as
+ * the audio itself or pictures.
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tags.h"
+
+#define MAX_TEXT 4096 /* of a single tag */
+#define MAX_BLOCK 1048576 /* of metadata which is read in one piece */
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+/* Fields of interest */
+
+enum field {
+    NONE,
+    ARTIST,
+    TITLE,
+    BPM,
+};
+
+/* Content to parse, which is either the file itself or a buffer
+ * where the content needed decoding first */
+
+struct source {
+    int fd;
+    const unsigned char *buf; /* or NULL */
+    uint64_t len;
+};
+
+/*
+ * Read exactly the given number of bytes from a source
+ *
+ * Return: 0 on success, or -1 if not available
+ */
+
+static int get(const struct source *s, uint64_t offset, void *buf,
+               size_t len)
+{
+    if (s->buf != NULL) {
+        if (offset > s->len || len > s->len - offset)
+            return -1;
+        memcpy(buf, s->buf + offset, len);
+        return 0;
+    }
+
+    if (pread(s->fd, buf, len, offset) != len)
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Read up to the given number of bytes from a source into a new
+ * buffer
+ *
+ * Return: buffer with responsibility, or NULL on error
+ */
+
+static unsigned char* get_alloc(const struct source *s, uint64_t offset,
+                                size_t len)
+{
+    unsigned char *buf;
+
+    buf = malloc(len ? len : 1);
+    if (buf == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    if (get(s, offset, buf, len) == -1) {
+        free(buf);
+        return NULL;
+    }
+
+    return buf;
+}
+
+static uint32_t be16(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 8 | p[1];
+}
+
+static uint32_t be24(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+static uint32_t be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16
+        | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t be64(const unsigned char *p)
+{
+    return (uint64_t)be32(p) << 32 | be32(p + 4);
+}
+
+static uint32_t le32(const unsigned char *p)
+{
+    return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16
+        | (uint32_t)p[1] << 8 | p[0];
+}
+
+static uint32_t syncsafe(const unsigned char *p)
+{
+    return (uint32_t)(p[0] & 0x7f) << 21 | (uint32_t)(p[1] & 0x7f) << 14
+        | (uint32_t)(p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+}
+
+/*
+ * Append a character to a UTF-8 string, if there is space
+ *
+ * Return: false if there was no space
+ */
+
+static bool put(char *out, size_t size, size_t *n, unsigned long c)
+{
+    unsigned char b[4];
+    size_t len;
+
+    if (c < 0x80) {
+        b[0] = c;
+        len = 1;
+    } else if (c < 0x800) {
+        b[0] = 0xc0 | (c >> 6);
+        b[1] = 0x80 | (c & 0x3f);
+        len = 2;
+    } else if (c < 0x10000) {
+        b[0] = 0xe0 | (c >> 12);
+        b[1] = 0x80 | ((c >> 6) & 0x3f);
+        b[2] = 0x80 | (c & 0x3f);
+        len = 3;
+    } else {
+        b[0] = 0xf0 | (c >> 18);
+        b[1] = 0x80 | ((c >> 12) & 0x3f);
+        b[2] = 0x80 | ((c >> 6) & 0x3f);
+        b[3] = 0x80 | (c & 0x3f);
+        len = 4;
+    }
+
+    if (*n + len >= size)
+        return false;
+
+    memcpy(out + *n, b, len);
+    *n += len;
+    out[*n] = '\0';
+
+    return true;
+}
+
+/*
+ * Copy text which is already UTF-8, stopping short of any incomplete
+ * character
+ */
+
+static void copy_utf8(char *out, size_t size, const unsigned char *p,
+                      size_t len)
+{
+    size_t n;
+
+    if (len >= size)
+        len = size - 1;
+
+    for (n = 0; n < len && p[n] != '\0'; n++)
+        ;
+
+    /* Don't end part way through a character */
+
+    if (n < len || n == 0) {
+        memcpy(out, p, n);
+    } else {
+        size_t z;
+
+        for (z = n; z > 0 && (p[z - 1] & 0xc0) == 0x80; z--)
+            ;
+        if (z > 0 && p[z - 1] >= 0xc0) {
+            unsigned int need;
+
+            need = (p[z - 1] >= 0xf0) ? 4 : (p[z - 1] >= 0xe0) ? 3 : 2;
+            if (n - (z - 1) < need)
+                n = z - 1;
+        }
+
+        memcpy(out, p, n);
+    }
+
+    out[n] = '\0';
+}
+
+/*
+ * Decode the text of an ID3v2 frame to UTF-8
+ */
+
+static void decode_id3(char *out, size_t size, const unsigned char *p,
+                       size_t len)
+{
+    size_t n;
+    bool be;
+
+    out[0] = '\0';
+
+    if (len < 1)
+        return;
+
+    n = 0;
+
+    switch (p[0]) {
+    case 0: /* ISO-8859-1 */
+        for (p++, len--; len > 0 && *p != '\0'; p++, len--) {
+            if (!put(out, size, &n, *p))
+                break;
+        }
+        break;
+
+    case 1: /* UTF-16 with byte order mark */
+    case 2: /* UTF-16BE */
+        be = (p[0] == 2);
+        p++;
+        len--;
+
+        if (len >= 2 && p[0] == 0xfe && p[1] == 0xff) {
+            be = true;
+            p += 2;
+            len -= 2;
+        } else if (len >= 2 && p[0] == 0xff && p[1] == 0xfe) {
+            be = false;
+            p += 2;
+            len -= 2;
+        }
+
+        while (len >= 2) {
+            unsigned long c;
+
+            c = be ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+            p += 2;
+            len -= 2;
+
+            if (c == 0)
+                break;
+
+            if (c >= 0xd800 && c < 0xdc00 && len >= 2) {
+                unsigned long l;
+
+                l = be ? (p[0] << 8 | p[1]) : (p[1] << 8 | p[0]);
+                if (l >= 0xdc00 && l < 0xe000) {
+                    c = 0x10000 + ((c - 0xd800) << 10) + (l - 0xdc00);
+                    p += 2;
+                    len -= 2;
+                }
+            }
+
+            if (!put(out, size, &n, c))
+                break;
+        }
+        break;
+
+    case 3: /* UTF-8 */
+        copy_utf8(out, size, p + 1, len - 1);
+        break;
+    }
+}
+
+/*
+ * Set a field from text in UTF-8, unless it is already set
+ */
+
+static void set(struct tags *t, enum field f, const char *s)
+{
+    double bpm;
+
+    switch (f) {
+    case ARTIST:
+        if (t->artist[0] == '\0')
+            snprintf(t->artist, sizeof t->artist, "%s", s);
+        break;
+
+    case TITLE:
+        if (t->title[0] == '\0')
+            snprintf(t->title, sizeof t->title, "%s", s);
+        break;
+
+    case BPM:
+        bpm = strtod(s, NULL);
+        if (t->bpm == 0.0 && bpm > 0.0 && bpm < 1000.0)
+            t->bpm = bpm;
+        break;
+
+    case NONE:
+        break;
+    }
+}
+
+/*
+ * Remove the 'unsynchronisation' of ID3v2, in place
+ *
+ * Return: the new length
+ */
+
+static size_t resync(unsigned char *p, size_t len)
+{
+    size_t n, z;
+
+    z = 0;
+
+    for (n = 0; n < len; n++) {
+        p[z++] = p[n];
+        if (p[n] == 0xff && n + 1 < len && p[n + 1] == 0x00)
+            n++;
+    }
+
+    return z;
+}
+
+static enum field id3_field(const unsigned char *id, unsigned int version)
+{
+    static const struct {
+        const char *id[2]; /* ID3v2.2, then later */
+        enum field f;
+    } frames[] = {
+        { { "TP1", "TPE1" }, ARTIST },
+        { { "TT2", "TIT2" }, TITLE },
+        { { "TBP", "TBPM" }, BPM },
+    };
+
+    size_t n;
+
+    for (n = 0; n < ARRAY_SIZE(frames); n++) {
+        const char *s;
+
+        s = frames[n].id[version == 2 ? 0 : 1];
+        if (memcmp(id, s, strlen(s)) == 0)
+            return frames[n].f;
+    }
+
+    return NONE;
+}
+
+/*
+ * Read the frames of an ID3v2 tag
+ */
+
+static void id3_frames(const struct source *s, uint64_t pos, uint64_t end,
+                       unsigned int version, struct tags *t)
+{
+    size_t hlen;
+
+    hlen = (version == 2) ? 6 : 10;
+
+    while (pos + hlen <= end) {
+        unsigned char h[10], *p;
+        uint32_t size, flags;
+        size_t len;
+        enum field f;
+        char text[MAX_TEXT];
+
+        if (get(s, pos, h, hlen) == -1)
+            return;
+        if (h[0] == '\0') /* padding */
+            return;
+
+        switch (version) {
+        case 2:
+            size = be24(h + 3);
+            flags = 0;
+            break;
+        case 3:
+            size = be32(h + 4);
+            flags = be16(h + 8);
+            break;
+        default:
+            size = syncsafe(h + 4);
+            flags = be16(h + 8);
+            break;
+        }
+
+        pos += hlen;
+        if (size > end - pos)
+            return;
+
+        f = id3_field(h, version);
+
+        if (version == 3 && (flags & 0x00c0)) /* compressed, encrypted */
+            f = NONE;
+        if (version == 4 && (flags & 0x000c))
+            f = NONE;
+
+        if (f == NONE) {
+            pos += size;
+            continue;
+        }
+
+        len = (size < MAX_TEXT) ? size : MAX_TEXT;
+        p = get_alloc(s, pos, len);
+        if (p == NULL)
+            return;
+
+        if (version == 3 && (flags & 0x0020) && len >= 1) { /* grouping */
+            memmove(p, p + 1, len - 1);
+            len--;
+        }
+
+        if (version == 4) {
+            if ((flags & 0x0040) && len >= 1) { /* grouping */
+                memmove(p, p + 1, len - 1);
+                len--;
+            }
+            if ((flags & 0x0001) && len >= 4) { /* data length */
+                memmove(p, p + 4, len - 4);
+                len -= 4;
+            }
+            if (flags & 0x0002)
+                len = resync(p, len);
+        }
+
+        decode_id3(text, sizeof text, p, len);
+        free(p);
+        set(t, f, text);
+
+        pos += size;
+    }
+}
+
+/*
+ * Read an ID3v2 tag at the start of the file, if there is one
+ *
+ * Return: length of the tag, or zero if none
+ */
+
+static uint64_t id3v2(int fd, struct tags *t)
+{
+    unsigned char h[10];
+    unsigned int version, flags;
+    uint64_t pos, end, len;
+    struct source s;
+
+    s.fd = fd;
+    s.buf = NULL;
+
+    if (get(&s, 0, h, sizeof h) == -1 || memcmp(h, "ID3", 3) != 0)
+        return 0;
+
+    version = h[3];
+    flags = h[5];
+    len = syncsafe(h + 6);
+
+    pos = sizeof h;
+    end = pos + len;
+
+    if (version < 2 || version > 4)
+        goto done;
+
+    /* Unsynchronisation of the whole tag means it must be decoded
+     * before it can be parsed */
+
+    if (version < 4 && (flags & 0x80)) {
+        unsigned char *buf;
+
+        if (len > MAX_BLOCK)
+            goto done;
+
+        buf = get_alloc(&s, pos, len);
+        if (buf == NULL)
+            goto done;
+
+        s.buf = buf;
+        s.len = resync(buf, len);
+        pos = 0;
+        end = s.len;
+    }
+
+    if (version >= 3 && (flags & 0x40)) { /* extended header */
+        unsigned char x[4];
+
+        if (get(&s, pos, x, sizeof x) == 0)
+            pos += (version == 3) ? be32(x) + 4 : syncsafe(x);
+    }
+
+    id3_frames(&s, pos, end, version, t);
+    free((void*)s.buf);
+
+done:
+    return sizeof h + len + ((flags & 0x10) ? 10 : 0); /* footer */
+}
+
+/*
+ * Read an ID3v1 tag at the end of the file, if there is one
+ */
+
+static void id3v1(int fd, struct tags *t)
+{
+    struct stat st;
+    unsigned char tag[128];
+    struct source s;
+    static const struct {
+        size_t offset;
+        enum field f;
+    } fields[] = {
+        { 3, TITLE },
+        { 33, ARTIST },
+    };
+    size_t n;
+
+    if (fstat(fd, &st) == -1 || st.st_size < sizeof tag)
+        return;
+
+    s.fd = fd;
+    s.buf = NULL;
+
+    if (get(&s, st.st_size - sizeof tag, tag, sizeof tag) == -1)
+        return;
+    if (memcmp(tag, "TAG", 3) != 0)
+        return;
+
+    for (n = 0; n < ARRAY_SIZE(fields); n++) {
+        unsigned char latin[32];
+        char text[64];
+        size_t len;
+
+        latin[0] = 0; /* ISO-8859-1 */
+        memcpy(latin + 1, tag + fields[n].offset, 30);
+
+        for (len = 31; len > 1 && (latin[len - 1] == ' '
+                                   || latin[len - 1] == '\0'); len--)
+            ;
+
+        decode_id3(text, sizeof text, latin, len);
+        set(t, fields[n].f, text);
+    }
+}
+
+/*
+ * Parse a Vorbis comment structure, as used by FLAC, Vorbis and Opus
+ */
+
+static void vorbis_comments(const unsigned char *p, size_t len,
+                            struct tags *t)
+{
+    static const struct {
+        const char *key;
+        enum field f;
+    } keys[] = {
+        { "ARTIST=", ARTIST },
+        { "TITLE=", TITLE },
+        { "BPM=", BPM },
+    };
+
+    size_t pos;
+    uint32_t count;
+
+    if (len < 4)
+        return;
+
+    pos = 4 + (size_t)le32(p); /* vendor */
+    if (pos > len - 4)
+        return;
+
+    count = le32(p + pos);
+    pos += 4;
+
+    while (count-- > 0 && pos <= len - 4) {
+        uint32_t clen;
+        size_t n;
+
+        clen = le32(p + pos);
+        pos += 4;
+        if (clen > len - pos)
+            return;
+
+        for (n = 0; n < ARRAY_SIZE(keys); n++) {
+            size_t klen;
+
+            klen = strlen(keys[n].key);
+            if (clen >= klen
+                && strncasecmp((const char*)p + pos, keys[n].key, klen) == 0)
+            {
+                char text[MAX_TEXT];
+
+                copy_utf8(text, sizeof text, p + pos + klen, clen - klen);
+                set(t, keys[n].f, text);
+                break;
+            }
+        }
+
+        pos += clen;
+    }
+}
+
+/*
+ * Read the comment block of a FLAC file, from the given offset
+ */
+
+static void flac(int fd, uint64_t pos, struct tags *t)
+{
+    struct source s;
+
+    s.fd = fd;
+    s.buf = NULL;
+
+    pos += 4; /* "fLaC" */
+
+    for (;;) {
+        unsigned char h[4];
+        uint32_t len;
+
+        if (get(&s, pos, h, sizeof h) == -1)
+            return;
+
+        len = be24(h + 1);
+        pos += sizeof h;
+
+        if ((h[0] & 0x7f) == 4) { /* VORBIS_COMMENT */
+            unsigned char *p;
+
+            if (len > MAX_BLOCK)
+                return;
+
+            p = get_alloc(&s, pos, len);
+            if (p == NULL)
+                return;
+
+            vorbis_comments(p, len, t);
+            free(p);
+            return;
+        }
+
+        if (h[0] & 0x80) /* last block */
+            return;
+
+        pos += len;
+    }
+}
+
+/*
+ * Read the comment header of an Ogg Vorbis or Opus file, which is
+ * the second packet of the first stream
+ *
+ * A large comment header, eg. with pictures, is parsed as far as it
+ * fits in a block.
+ */
+
+static void ogg(int fd, uint64_t pos, struct tags *t)
+{
+    unsigned char *packet;
+    size_t fill, size;
+    unsigned int n;
+    uint32_t serial;
+    bool first;
+    struct source s;
+
+    packet = NULL;
+    size = 0;
+
+    s.fd = fd;
+    s.buf = NULL;
+
+    fill = 0;
+    n = 0; /* packet number */
+    serial = 0;
+    first = true;
+
+    while (n < 2) {
+        unsigned char h[27], lacing[255], body[255 * 255];
+        size_t len, z, i;
+
+        if (get(&s, pos, h, sizeof h) == -1 || memcmp(h, "OggS", 4) != 0)
+            break;
+        if (get(&s, pos + sizeof h, lacing, h[26]) == -1)
+            break;
+
+        len = 0;
+        for (i = 0; i < h[26]; i++)
+            len += lacing[i];
+
+        if (first) {
+            serial = le32(h + 14);
+            first = false;
+        }
+
+        if (le32(h + 14) != serial) { /* another stream */
+            pos += sizeof h + h[26] + len;
+            continue;
+        }
+
+        if (get(&s, pos + sizeof h + h[26], body, len) == -1)
+            break;
+
+        z = 0;
+
+        for (i = 0; i < h[26] && n < 2; i++) {
+            if (n == 1 && fill + lacing[i] > size && size < MAX_BLOCK) {
+                unsigned char *p;
+
+                size = size ? size * 2 : 4096;
+                p = realloc(packet, size);
+                if (p == NULL) {
+                    perror("realloc");
+                    goto done;
+                }
+                packet = p;
+            }
+
+            if (n == 1) {
+                size_t copy;
+
+                copy = lacing[i];
+                if (copy > size - fill)
+                    copy = size - fill;
+
+                memcpy(packet + fill, body + z, copy);
+                fill += copy;
+            }
+
+            z += lacing[i];
+            if (lacing[i] < 255)
+                n++;
+        }
+
+        pos += sizeof h + h[26] + len;
+    }
+
+done:
+    if (fill >= 7 && memcmp(packet, "\x03vorbis", 7) == 0)
+        vorbis_comments(packet + 7, fill - 7, t);
+    else if (fill >= 8 && memcmp(packet, "OpusTags", 8) == 0)
+        vorbis_comments(packet + 8, fill - 8, t);
+
+    free(packet); /* may be NULL */
+}
+
+/*
+ * Find the next atom of an MP4 file within the given range
+ *
+ * Return: 0 on success, or -1 if there are no more
+ * Post: on success, type is set and the atom's content is in the
+ * range [*body, *next)
+ */
+
+static int next_atom(const struct source *s, uint64_t pos, uint64_t end,
+                     char type[4], uint64_t *body, uint64_t *next)
+{
+    unsigned char h[16];
+    uint64_t size, hlen;
+
+    if (pos > end || end - pos < 8)
+        return -1;
+    if (get(s, pos, h, 8) == -1)
+        return -1;
+
+    size = be32(h);
+    hlen = 8;
+
+    if (size == 1) { /* 64-bit size */
+        if (get(s, pos + 8, h + 8, 8) == -1)
+            return -1;
+        size = be64(h + 8);
+        hlen = 16;
+    } else if (size == 0) { /* to the end */
+        size = end - pos;
+    }
+
+    if (size < hlen || size > end - pos)
+        return -1;
+
+    memcpy(type, h + 4, 4);
+    *body = pos + hlen;
+    *next = pos + size;
+
+    return 0;
+}
+
+/*
+ * Find an atom of the given type within the given range
+ *
+ * Return: 0 on success, or -1 if not found
+ * Post: on success, the atom's content is in the range [*start, *end)
+ */
+
+static int find_atom(const struct source *s, uint64_t *start, uint64_t *end,
+                     const char *type)
+{
+    uint64_t pos, body, next;
+    char t[4];
+
+    pos = *start;
+
+    while (next_atom(s, pos, *end, t, &body, &next) == 0) {
+        if (memcmp(t, type, 4) == 0) {
+            *start = body;
+            *end = next;
+            return 0;
+        }
+        pos = next;
+    }
+
+    return -1;
+}
+
+/*
+ * Read the iTunes-style metadata of an MP4 file
+ */
+
+static void mp4(int fd, struct tags *t)
+{
+    static const struct {
+        const char *type;
+        enum field f;
+    } items[] = {
+        { "\xa9" "ART", ARTIST },
+        { "\xa9" "nam", TITLE },
+        { "tmpo", BPM },
+    };
+
+    struct stat st;
+    struct source s;
+    uint64_t start, end, pos, body, next;
+    unsigned char h[8];
+    char type[4];
+
+    if (fstat(fd, &st) == -1)
+        return;
+
+    s.fd = fd;
+    s.buf = NULL;
+
+    start = 0;
+    end = st.st_size;
+
+    if (find_atom(&s, &start, &end, "moov") == -1)
+        return;
+
+    /* Metadata is usually in moov.udta.meta, sometimes moov.meta */
+
+    pos = start;
+    next = end;
+    if (find_atom(&s, &pos, &next, "udta") == 0) {
+        start = pos;
+        end = next;
+    }
+
+    if (find_atom(&s, &start, &end, "meta") == -1)
+        return;
+
+    /* As a 'full' atom, the content is preceded by a version */
+
+    if (get(&s, start, h, sizeof h) == -1)
+        return;
+    if (memcmp(h + 4, "hdlr", 4) != 0)
+        start += 4;
+
+    if (find_atom(&s, &start, &end, "ilst") == -1)
+        return;
+
+    for (pos = start; next_atom(&s, pos, end, type, &body, &next) == 0;
+         pos = next)
+    {
+        uint64_t dstart, dend;
+        unsigned char *p;
+        size_t n, len;
+        char text[MAX_TEXT];
+
+        for (n = 0; n < ARRAY_SIZE(items); n++) {
+            if (memcmp(type, items[n].type, 4) == 0)
+                break;
+        }
+        if (n == ARRAY_SIZE(items))
+            continue;
+
+        dstart = body;
+        dend = next;
+        if (find_atom(&s, &dstart, &dend, "data") == -1)
+            continue;
+
+        /* Type and locale, then the value */
+
+        if (dend - dstart < 8)
+            continue;
+        dstart += 8;
+
+        len = dend - dstart;
+        if (len >= MAX_TEXT)
+            len = MAX_TEXT - 1;
+
+        p = get_alloc(&s, dstart, len);
+        if (p == NULL)
+            return;
+
+        if (items[n].f == BPM) {
+            if (len >= 2)
+                snprintf(text, sizeof text, "%u", be16(p));
+            else
+                text[0] = '\0';
+        } else {
+            copy_utf8(text, sizeof text, p, len);
+        }
+
+        free(p);
+        set(t, items[n].f, text);
+    }
+}
+
+/*
+ * Read the tags of an audio file, identified by its content
+ *
+ * Return: 0 if any tags were found, otherwise -1
+ */
+
+int tags_read(const char *pathname, struct tags *t)
+{
+    int fd;
+    uint64_t start;
+    unsigned char magic[8];
+    struct source s;
+
+    t->artist[0] = '\0';
+    t->title[0] = '\0';
+    t->bpm = 0.0;
+
+    fd = open(pathname, O_RDONLY);
+    if (fd == -1) {
+        perror(pathname);
+        return -1;
+    }
+
+    s.fd = fd;
+    s.buf = NULL;
+
+    start = id3v2(fd, t);
+
+    if (get(&s, start, magic, sizeof magic) == 0) {
+        if (memcmp(magic, "fLaC", 4) == 0)
+            flac(fd, start, t);
+        else if (memcmp(magic, "OggS", 4) == 0)
+            ogg(fd, start, t);
+        else if (memcmp(magic + 4, "ftyp", 4) == 0)
+            mp4(fd, t);
+    }
+
+    if (t->artist[0] == '\0' && t->title[0] == '\0')
+        id3v1(fd, t);
+
+    if (close(fd) == -1)
+        abort();
+
+    if (t->artist[0] == '\0' && t->title[0] == '\0' && t->bpm == 0.0)
+        return -1;
+
+    return 0;
+}
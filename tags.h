@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef TAGS_H
+#define TAGS_H
+
+/* Metadata read from the tags of an audio file, in UTF-8 */
+
+struct tags {
+    char artist[256], title[256];
+    double bpm; /* or 0.0 if not known */
+};
+
+int tags_read(const char *pathname, struct tags *t);
+
+#endif
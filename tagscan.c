@@ -0,0 +1,510 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Library scanner which reads the tags of audio files, for use with
+ * xwax -s
+ *
+ * Output is the same as the scan script, but the artist, title and
+ * BPM are taken from the tags of each file where it has them. Tags
+ * are kept in a cache so that a rescan only reads files which have
+ * changed.
+ */
+
+#define _GNU_SOURCE /* asprintf(), strdupa() */
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "hash.h"
+#include "tagcache.h"
+#include "tags.h"
+
+#define MAX_DEPTH 64 /* of directories */
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+static const char *extensions[] = {
+    "ogg", "oga", "opus", "aac", "cdaudio", "mp3", "flac", "wav",
+    "aif", "aiff", "m4a", "wma",
+};
+
+static struct tagcache cache;
+
+/* Directories being walked, to detect loops through symlinks */
+
+static struct {
+    dev_t dev;
+    ino_t ino;
+} parent[MAX_DEPTH];
+
+static size_t depth;
+
+/*
+ * Return: true if the filename is of a type of audio file
+ */
+
+static bool is_audio(const char *name)
+{
+    const char *s;
+    size_t n;
+
+    s = strrchr(name, '.');
+    if (s == NULL)
+        return false;
+
+    for (n = 0; n < ARRAY_SIZE(extensions); n++) {
+        if (strcasecmp(s + 1, extensions[n]) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Skip a track number at the start of a filename, eg. "01. " or
+ * "A1 " for a side of vinyl
+ *
+ * Return: pointer to the name after the number
+ */
+
+static const char* skip_number(const char *s)
+{
+    unsigned int n;
+
+    /* [A-H]?[A0-9]?[0-9].? + as tried by the scan script; try each
+     * combination of the optional parts */
+
+    for (n = 0; n < 8; n++) {
+        const unsigned char *p = (const unsigned char*)s;
+
+        if (n & 4) {
+            if (toupper(*p) < 'A' || toupper(*p) > 'H')
+                continue;
+            p++;
+        }
+        if (n & 2) {
+            if (toupper(*p) != 'A' && !isdigit(*p))
+                continue;
+            p++;
+        }
+        if (!isdigit(*p))
+            continue;
+        p++;
+        if ((n & 1) && *p != '\0' && *p != ' ')
+            p++;
+        if (*p != ' ')
+            continue;
+
+        while (*p == ' ')
+            p++;
+
+        return (const char*)p;
+    }
+
+    return s;
+}
+
+/*
+ * Split a name at " - ", eg. "Artist - Title"
+ *
+ * Return: pointer to the second part, or NULL if there is none
+ * Post: on success, the first part is terminated
+ */
+
+static char* split_name(char *s)
+{
+    char *x;
+
+    x = strstr(s, " - ");
+    if (x == NULL)
+        return NULL;
+
+    *x = '\0';
+    x += 3;
+    while (*x == ' ')
+        x++;
+
+    return x;
+}
+
+/*
+ * Take the artist and title from the pathname of a file, following
+ * the patterns of the scan script
+ */
+
+static void from_pathname(const char *pathname, struct tags *t)
+{
+    char *dir, *name, *s, *title;
+
+    t->artist[0] = '\0';
+    t->title[0] = '\0';
+    t->bpm = 0.0;
+
+    dir = strdupa(pathname);
+    name = strrchr(dir, '/');
+    if (name == NULL) {
+        name = dir;
+        dir = NULL;
+    } else {
+        *name++ = '\0';
+    }
+
+    s = strrchr(name, '.');
+    if (s != NULL && s != name)
+        *s = '\0';
+
+    name = (char*)skip_number(name);
+
+    /* "<artist> - <title>.ext" */
+
+    title = split_name(name);
+    if (title != NULL) {
+        snprintf(t->artist, sizeof t->artist, "%s", name);
+        snprintf(t->title, sizeof t->title, "%s", title);
+        return;
+    }
+
+    snprintf(t->title, sizeof t->title, "%s", name);
+
+    /* "<artist> - <album>[/(Disc|Side) <name>]/<title>.ext" */
+
+    if (dir == NULL)
+        return;
+
+    s = strrchr(dir, '/');
+    if (s != NULL && (strncasecmp(s + 1, "disc ", 5) == 0
+                      || strncasecmp(s + 1, "side ", 5) == 0))
+    {
+        *s = '\0';
+        s = strrchr(dir, '/');
+    }
+
+    s = (s == NULL) ? dir : s + 1;
+    if (split_name(s) != NULL)
+        snprintf(t->artist, sizeof t->artist, "%s", s);
+}
+
+/*
+ * Take a BPM from the end of the title, eg. "Ghostbusters (115.6 BPM)"
+ */
+
+static void bpm_from_title(struct tags *t)
+{
+    char *s, *end;
+    double bpm;
+
+    s = strrchr(t->title, '(');
+    if (s == NULL)
+        return;
+
+    bpm = strtod(s + 1, &end);
+    if (end == s + 1 || bpm <= 0.0)
+        return;
+
+    while (*end == ' ')
+        end++;
+    if (strcmp(end, "BPM)") != 0)
+        return;
+
+    while (s > t->title && s[-1] == ' ')
+        s--;
+    *s = '\0';
+
+    if (t->bpm == 0.0)
+        t->bpm = bpm;
+}
+
+/*
+ * Replace characters which would break the output format
+ */
+
+static void sanitise(char *s)
+{
+    for (; *s != '\0'; s++) {
+        if (*s == '\t' || *s == '\n' || *s == '\r')
+            *s = ' ';
+    }
+}
+
+/*
+ * Output a record for a single file, reading its tags if they are
+ * not already in the cache
+ */
+
+static void scan_file(const char *pathname, const struct stat *st)
+{
+    const struct tagcache_entry *e;
+    struct tags t;
+
+    if (strpbrk(pathname, "\t\n") != NULL) {
+        fprintf(stderr, "%s: Ignoring unsupported filename\n", pathname);
+        return;
+    }
+
+    e = tagcache_lookup(&cache, pathname, st);
+    if (e != NULL) {
+        snprintf(t.artist, sizeof t.artist, "%s", e->artist);
+        snprintf(t.title, sizeof t.title, "%s", e->title);
+        t.bpm = e->bpm;
+    } else {
+        if (tags_read(pathname, &t) == -1 || t.title[0] == '\0') {
+            double bpm;
+
+            bpm = t.bpm;
+            from_pathname(pathname, &t);
+            bpm_from_title(&t);
+            if (t.bpm == 0.0)
+                t.bpm = bpm;
+        }
+
+        sanitise(t.artist);
+        sanitise(t.title);
+
+        (void)tagcache_store(&cache, pathname, st, &t);
+    }
+
+    if (t.bpm > 0.0)
+        printf("%s\t%s\t%s\t%g\n", pathname, t.artist, t.title, t.bpm);
+    else
+        printf("%s\t%s\t%s\n", pathname, t.artist, t.title);
+}
+
+/*
+ * Scan a directory for audio files, following symlinks
+ */
+
+static void scan_dir(char *path, size_t len)
+{
+    DIR *d;
+    struct dirent *de;
+
+    d = opendir(path);
+    if (d == NULL) {
+        perror(path);
+        return;
+    }
+
+    while ((de = readdir(d)) != NULL) {
+        struct stat st;
+        size_t n, z;
+
+        if (de->d_name[0] == '.'
+            && (de->d_name[1] == '\0' || strcmp(de->d_name, "..") == 0))
+        {
+            continue;
+        }
+
+        z = strlen(de->d_name);
+        if (len + z + 2 > PATH_MAX)
+            continue;
+
+        path[len] = '/';
+        memcpy(path + len + 1, de->d_name, z + 1);
+
+        if (de->d_type != DT_DIR && de->d_type != DT_LNK
+            && de->d_type != DT_UNKNOWN && !is_audio(de->d_name))
+        {
+            continue;
+        }
+
+        if (stat(path, &st) == -1)
+            continue; /* eg. a dangling symlink */
+
+        if (S_ISREG(st.st_mode)) {
+            if (is_audio(de->d_name))
+                scan_file(path, &st);
+            continue;
+        }
+
+        if (!S_ISDIR(st.st_mode))
+            continue;
+
+        for (n = 0; n < depth; n++) {
+            if (parent[n].dev == st.st_dev && parent[n].ino == st.st_ino)
+                break;
+        }
+        if (n < depth || depth == MAX_DEPTH) {
+            fprintf(stderr, "%s: Skipping loop or deep directory\n", path);
+            continue;
+        }
+
+        parent[depth].dev = st.st_dev;
+        parent[depth].ino = st.st_ino;
+        depth++;
+
+        scan_dir(path, len + z + 1);
+        depth--;
+    }
+
+    path[len] = '\0';
+    closedir(d);
+}
+
+/*
+ * Scan a list of pathnames, one per line
+ */
+
+static void scan_list(const char *pathname)
+{
+    FILE *f;
+    char *line;
+    size_t len;
+    ssize_t z;
+
+    f = fopen(pathname, "r");
+    if (f == NULL) {
+        perror(pathname);
+        return;
+    }
+
+    line = NULL;
+    len = 0;
+
+    while ((z = getline(&line, &len, f)) != -1) {
+        struct stat st;
+
+        if (z > 0 && line[z - 1] == '\n')
+            line[--z] = '\0';
+
+        if (stat(line, &st) == -1) {
+            perror(line);
+            continue;
+        }
+
+        scan_file(line, &st);
+    }
+
+    free(line);
+    fclose(f);
+}
+
+/*
+ * Find the cache for the given scan, in the user's cache directory
+ *
+ * Return: pathname with responsibility, or NULL if none
+ */
+
+static char* cache_file(const char *id)
+{
+    const char *base;
+    char *dir, *file;
+
+    base = getenv("XDG_CACHE_HOME");
+    if (base != NULL && base[0] != '\0') {
+        dir = strdupa(base);
+    } else {
+        base = getenv("HOME");
+        if (base == NULL)
+            return NULL;
+
+        dir = alloca(strlen(base) + sizeof "/.cache");
+        sprintf(dir, "%s/.cache", base);
+    }
+
+    if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+        perror(dir);
+        return NULL;
+    }
+
+    if (asprintf(&file, "%s/xwax", dir) == -1) {
+        perror("asprintf");
+        return NULL;
+    }
+
+    if (mkdir(file, 0700) == -1 && errno != EEXIST) {
+        perror(file);
+        free(file);
+        return NULL;
+    }
+    free(file);
+
+    if (asprintf(&file, "%s/xwax/tags-%016llx", dir,
+                 (unsigned long long)fnv1a_64(id)) == -1)
+    {
+        perror("asprintf");
+        return NULL;
+    }
+
+    return file;
+}
+
+int main(int argc, char *argv[])
+{
+    char path[PATH_MAX], *id, *file;
+    struct stat st;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <path>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (stat(argv[1], &st) == -1) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    id = realpath(argv[1], NULL);
+    if (id == NULL) {
+        perror("realpath");
+        return EXIT_FAILURE;
+    }
+
+    tagcache_init(&cache);
+
+    file = cache_file(id);
+    if (file != NULL && tagcache_load(&cache, file, id) == -1)
+        fprintf(stderr, "%s: Not using the cache\n", file);
+
+    if (S_ISDIR(st.st_mode)) {
+        if (strlen(argv[1]) >= sizeof path) {
+            fprintf(stderr, "%s: Path is too long\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+
+        strcpy(path, argv[1]);
+        scan_dir(path, strlen(path));
+    } else {
+        scan_list(argv[1]);
+    }
+
+    if (fflush(stdout) != 0) {
+        perror("stdout");
+        return EXIT_FAILURE;
+    }
+
+    if (file != NULL)
+        (void)tagcache_save(&cache, file, id);
+
+    free(file);
+    free(id);
+    tagcache_clear(&cache);
+
+    return EXIT_SUCCESS;
+}
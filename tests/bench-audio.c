@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Benchmarks of the audio path: playback, timecode decoding and the
+ * import of audio into a track
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "lut.h"
+#include "meter.h"
+#include "player.h"
+#include "timecoder.h"
+#include "track.h"
+
+#define RATE 48000
+#define PERIOD 256 /* samples, a typical period of the audio device */
+#define SIGNAL RATE /* samples of timecode signal to loop */
+#define LOOKUPS 1024
+#define SLOTS (1 << 20)
+#define CHUNK 4096 /* samples, a typical read from the importer */
+#define BLOCKS 4 /* of the track, to be larger than the caches */
+#define STROKE 32 /* periods of a scratch in one direction */
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+
+static const double pitches[] = { -1.0, 0.0, 0.5, 1.0, 1.5, 8.0 };
+
+static const char *definitions[] = {
+    "serato_2a", "serato_2b", "serato_cd", "traktor_a", "traktor_b",
+    "mixvibes_v2", "mixvibes_7inch", "pioneer_a", "pioneer_b",
+};
+
+struct collect {
+    struct player pl;
+    signed short pcm[PERIOD * PLAYER_CHANNELS];
+    unsigned int periods;
+};
+
+struct submit {
+    struct timecoder tc;
+    signed short pcm[SIGNAL * 2];
+    size_t offset;
+};
+
+struct lookup {
+    struct lut lut;
+    unsigned int timecode[LOOKUPS];
+};
+
+struct commit {
+    struct meter meter;
+    unsigned int fill;
+};
+
+static const double gains[TRACK_MAX_STEMS] = { 1.0, 0.5, 0.0, 0.8 };
+
+static struct track track, stems;
+static struct timecoder idle;
+static struct collect collect[ARRAY_SIZE(pitches)], scratch, mix;
+static struct submit submit[ARRAY_SIZE(definitions)];
+static struct lookup lookup;
+static struct commit commit;
+
+/*
+ * Playback of the track at a given pitch; the resampler of
+ * build_pcm(), as called by the audio device every period
+ */
+
+static void run_collect(void *arg)
+{
+    struct collect *c = arg;
+    double length;
+
+    player_collect(&c->pl, c->pcm, PERIOD);
+
+    /* Stay within the audio, away from the silence either side */
+
+    length = (double)track.length / track.rate;
+    if (c->pl.position < 1.0 || c->pl.position > length - 1.0)
+        c->pl.position = length / 2;
+}
+
+/*
+ * A fast scratch, back and forth, which jumps across the track so
+ * that little of the audio is in the cache
+ */
+
+static void run_scratch(void *arg)
+{
+    struct collect *c = arg;
+
+    player_collect(&c->pl, c->pcm, PERIOD);
+
+    if (++c->periods % STROKE == 0) {
+        c->pl.pitch = -c->pl.pitch;
+        if (c->pl.pitch > 0.0)
+            c->pl.position = 2 + rand() % (track.length / track.rate - 4);
+    }
+}
+
+static void run_submit(void *arg)
+{
+    struct submit *s = arg;
+
+    timecoder_submit(&s->tc, s->pcm + s->offset * 2, PERIOD);
+
+    s->offset += PERIOD;
+    if (s->offset + PERIOD > SIGNAL)
+        s->offset = 0;
+}
+
+static void run_lookup(void *arg)
+{
+    struct lookup *l = arg;
+    unsigned int n;
+
+    for (n = 0; n < LOOKUPS; n++) {
+        if (lut_lookup(&l->lut, l->timecode[n]) == (unsigned)-1)
+            abort();
+    }
+}
+
+/*
+ * Metering of incoming audio; the work of commit_pcm_samples() as a
+ * track is imported
+ */
+
+static void run_commit(void *arg)
+{
+    struct commit *c = arg;
+
+    meter_commit(&c->meter, track.block[0], c->fill, CHUNK);
+
+    c->fill += CHUNK;
+    if (c->fill + CHUNK > TRACK_BLOCK_SAMPLES)
+        c->fill = 0;
+}
+
+static unsigned int timecode(unsigned int n)
+{
+    return (n * 2654435761u) & (SLOTS * 4 - 1);
+}
+
+/*
+ * Make up a timecode signal: a quadrature carrier at the resolution
+ * of the definition, with each cycle carrying a bit in its amplitude
+ */
+
+static void make_signal(signed short *pcm, const struct timecode_def *def)
+{
+    unsigned int n, cycle, last;
+    double amplitude;
+
+    last = 0;
+    amplitude = 16384.0;
+
+    for (n = 0; n < SIGNAL; n++) {
+        double phase;
+
+        cycle = (unsigned long long)def->resolution * n / RATE;
+        if (cycle != last) {
+            amplitude = (rand() % 2) ? 16384.0 : 9830.0;
+            last = cycle;
+        }
+
+        phase = 2 * M_PI * def->resolution * n / RATE;
+        pcm[n * 2] = amplitude * sin(phase);
+        pcm[n * 2 + 1] = amplitude * cos(phase);
+    }
+}
+
+/*
+ * Make up a track of one block with stems, held by us
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+static int make_stems(struct track *t)
+{
+    size_t n, k;
+    struct track_block *block;
+
+    block = track_block_alloc(TRACK_MAX_STEMS);
+    if (block == NULL)
+        return -1;
+
+    for (k = 0; k < TRACK_MAX_STEMS; k++) {
+        for (n = 0; n < TRACK_BLOCK_SAMPLES * TRACK_CHANNELS; n++)
+            block->stem[k][n] = rand() % 16384 - 8192;
+    }
+
+    t->refcount = 2;
+    t->rate = 44100;
+    t->stems = TRACK_MAX_STEMS;
+    t->block[0] = block;
+    t->blocks = 1;
+    t->length = TRACK_BLOCK_SAMPLES;
+
+    return 0;
+}
+
+/*
+ * Register the benchmarks of the audio path
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+int bench_audio(void)
+{
+    size_t n, b;
+    struct timecode_def *def;
+
+    srand(0);
+
+    /* A track of noise, held by us so that it is never freed */
+
+    for (b = 0; b < BLOCKS; b++) {
+        struct track_block *block;
+
+        block = track_block_alloc(0);
+        if (block == NULL)
+            return -1;
+
+        for (n = 0; n < TRACK_BLOCK_SAMPLES * TRACK_CHANNELS; n++)
+            block->pcm[n] = rand() % 65536 - 32768;
+
+        track.block[b] = block;
+    }
+
+    track.refcount = 2 + ARRAY_SIZE(pitches);
+    track.rate = 44100;
+    track.blocks = BLOCKS;
+    track.length = TRACK_BLOCK_SAMPLES * BLOCKS;
+
+    def = timecoder_find_definition(definitions[0]);
+    if (def == NULL)
+        return -1;
+    timecoder_init(&idle, def, 1.0, RATE, false);
+
+    for (n = 0; n < ARRAY_SIZE(pitches); n++) {
+        struct collect *c = &collect[n];
+
+        player_init(&c->pl, RATE, &track, &idle);
+        player_set_internal_playback(&c->pl);
+        c->pl.pitch = pitches[n];
+        c->pl.position = (double)track.length / track.rate / 2;
+
+        bench_add(run_collect, c, "player_collect/pitch=%+.1f", pitches[n]);
+    }
+
+    player_init(&scratch.pl, RATE, &track, &idle);
+    player_set_internal_playback(&scratch.pl);
+    scratch.pl.pitch = -8.0;
+    scratch.pl.position = (double)track.length / track.rate / 2;
+    scratch.periods = 0;
+
+    bench_add(run_scratch, &scratch, "player_collect/scratch");
+
+    /* A track with stems, mixed at other than unity to play all of
+     * the stems rather than the stereo mix */
+
+    if (make_stems(&stems) == -1)
+        return -1;
+
+    player_init(&mix.pl, RATE, &stems, &idle);
+    player_set_internal_playback(&mix.pl);
+    for (n = 0; n < TRACK_MAX_STEMS; n++)
+        player_set_gain(&mix.pl, n, gains[n]);
+    mix.pl.position = (double)stems.length / stems.rate / 2;
+
+    bench_add(run_collect, &mix, "player_collect/stems=%d", TRACK_MAX_STEMS);
+
+    for (n = 0; n < ARRAY_SIZE(definitions); n++) {
+        struct submit *s = &submit[n];
+
+        def = timecoder_find_definition(definitions[n]);
+        if (def == NULL)
+            return -1;
+
+        timecoder_init(&s->tc, def, 1.0, RATE, false);
+        make_signal(s->pcm, def);
+        s->offset = 0;
+
+        bench_add(run_submit, s, "timecoder_submit/%s", definitions[n]);
+    }
+
+    /* Distinct timecodes, as multiplying by an odd number is
+     * a bijection modulo a power of two */
+
+    if (lut_init(&lookup.lut, SLOTS) == -1)
+        return -1;
+
+    for (n = 0; n < SLOTS; n++)
+        lut_push(&lookup.lut, timecode(n));
+
+    for (n = 0; n < LOOKUPS; n++)
+        lookup.timecode[n] = timecode(rand() % SLOTS);
+
+    bench_add(run_lookup, &lookup, "lut_lookup/%d", LOOKUPS);
+
+    meter_init(&commit.meter, METER_WINDOW);
+    commit.fill = 0;
+    bench_add(run_commit, &commit, "meter_commit/%d", CHUNK);
+
+    return 0;
+}
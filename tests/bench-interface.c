@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Benchmarks of the interface: drawing of the spinner at the sizes
+ * given by the display scale
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "spinner.h"
+
+#define SPINNER_SIZE 58 /* pixels, as drawn by the interface at scale 1 */
+#define PITCH (1920 * 4) /* bytes, a row of a typical display */
+#define STEP 9 /* angle between frames, at 33RPM and 60 frames/sec */
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+
+static const double scales[] = { 1.0, 1.5, 2.0, 3.0 };
+
+struct draw {
+    struct spinner spinner;
+    int angle;
+};
+
+static const unsigned char dark[4] = { 0, 32, 8, 0 },
+    light[4] = { 3, 128, 32, 0 };
+
+static unsigned char *framebuffer;
+static struct draw draw[ARRAY_SIZE(scales)];
+
+/*
+ * A frame of the spinner, as drawn for each deck by the interface
+ */
+
+static void run_draw(void *arg)
+{
+    struct draw *d = arg;
+    int size;
+
+    size = d->spinner.size;
+    spinner_draw(&d->spinner, framebuffer, PITCH, 4, size, size,
+                 d->angle, dark, light);
+
+    d->angle += STEP;
+}
+
+int bench_interface(void)
+{
+    size_t n;
+    int largest;
+
+    largest = SPINNER_SIZE * scales[ARRAY_SIZE(scales) - 1];
+
+    framebuffer = calloc(largest, PITCH);
+    if (framebuffer == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    for (n = 0; n < ARRAY_SIZE(scales); n++) {
+        struct draw *d = &draw[n];
+
+        if (spinner_init(&d->spinner, SPINNER_SIZE * scales[n]) == -1)
+            return -1;
+        d->angle = 0;
+
+        bench_add(run_draw, d, "spinner_draw/size=%d", d->spinner.size);
+    }
+
+    return 0;
+}
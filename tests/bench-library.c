@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Benchmarks of the library: searching and the ingestion of records
+ * from a scan
+ */
+
+#define _GNU_SOURCE /* asprintf() */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "index.h"
+#include "library.h"
+
+#define RECORDS 100000
+#define INGEST 10000 /* records added to a listing at once */
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+
+static const char *prefix[] = {
+    "The ", "the ", "DJ ", "", "", "", "Various Artists", "VARIOUS ARTISTS",
+};
+
+struct search {
+    const char *query;
+    struct index *src;
+    struct match match;
+    int (*fn)(struct index *src, struct index *dest,
+              const struct match *match);
+};
+
+static struct record *record[RECORDS];
+static struct index by_artist, by_bpm, found;
+
+static int match_bpm(struct index *src, struct index *dest,
+                     const struct match *match)
+{
+    return index_match_bpm(src, dest, match);
+}
+
+static struct search search[] = {
+    { "the 1", &by_artist, .fn = index_match },
+    { "zzz", &by_artist, .fn = index_match },
+    { "bpm:124-125", &by_bpm, .fn = index_match },
+    { "bpm:124-125", &by_bpm, .fn = match_bpm },
+};
+
+static char* field(unsigned int n, const char *s)
+{
+    char *buf;
+
+    if (asprintf(&buf, "%s%u", s, n) == -1) {
+        perror("asprintf");
+        exit(EXIT_FAILURE);
+    }
+
+    return buf;
+}
+
+static void run_search(void *arg)
+{
+    struct search *s = arg;
+
+    if (s->fn(s->src, &found, &s->match) == -1)
+        abort();
+}
+
+/*
+ * Add records to an empty listing, as a crate does from a scan,
+ * either one at a time or deferred and sorted at once
+ */
+
+static void ingest(bool defer)
+{
+    unsigned int n;
+    struct listing l;
+
+    listing_init(&l);
+
+    if (defer)
+        listing_defer(&l);
+
+    for (n = 0; n < INGEST; n++) {
+        if (listing_add(&l, record[n]) == NULL)
+            abort();
+    }
+
+    if (defer && listing_commit(&l) == -1)
+        abort();
+
+    listing_clear(&l);
+}
+
+static void run_add(void *arg)
+{
+    ingest(false);
+}
+
+static void run_add_deferred(void *arg)
+{
+    ingest(true);
+}
+
+/*
+ * Register the benchmarks of the library
+ *
+ * Return: 0 on success, or -1 on error
+ */
+
+int bench_library(void)
+{
+    unsigned int n;
+
+    srand(0);
+
+    for (n = 0; n < RECORDS; n++) {
+        const char *p;
+        struct record *r;
+
+        p = prefix[rand() % ARRAY_SIZE(prefix)];
+
+        r = record_new();
+        if (r == NULL)
+            return -1;
+
+        r->pathname = field(n, "/music/");
+        r->artist = field(rand() % (RECORDS / 8 + 1), p);
+        r->title = field(rand() % 16, "Track ");
+        r->match = NULL;
+        r->bpm = (rand() % 8) ? 90.0 + rand() % 800 / 10.0 : 0.0;
+
+        record_init_key(r);
+        record[n] = r;
+    }
+
+    index_init(&by_artist);
+    index_init(&by_bpm);
+    index_init(&found);
+
+    if (index_reserve(&by_artist, RECORDS) == -1)
+        return -1;
+    if (index_reserve(&by_bpm, RECORDS) == -1)
+        return -1;
+
+    for (n = 0; n < RECORDS; n++) {
+        index_insert(&by_artist, record[n], SORT_ARTIST);
+        index_insert(&by_bpm, record[n], SORT_BPM);
+    }
+
+    for (n = 0; n < ARRAY_SIZE(search); n++) {
+        struct search *s = &search[n];
+
+        match_compile(&s->match, s->query);
+        bench_add(run_search, s, "%s/%s",
+                  s->fn == match_bpm ? "index_match_bpm" : "index_match",
+                  s->query);
+    }
+
+    bench_add(run_add, NULL, "listing_add/%d", INGEST);
+    bench_add(run_add_deferred, NULL, "listing_add/deferred/%d", INGEST);
+
+    return 0;
+}
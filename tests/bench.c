@@ -0,0 +1,462 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#define _GNU_SOURCE /* vasprintf() */
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define MAX_BENCHMARKS 64
+#define MAX_REPETITIONS 1000
+#define TARGET 0.001 /* seconds, minimum for a timed repetition */
+#define MAX_BATCH (1 << 24)
+
+#define WARMUP 5
+#define REPETITIONS 50
+#define THRESHOLD 20.0 /* per cent */
+
+#define COUNTERS 2
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+
+/*
+ * Microbenchmarks of the hot paths, each compared against a stored
+ * baseline so that a regression is caught.
+ *
+ * Each benchmark is an operation which is repeated in a batch, large
+ * enough that it can be timed. After calibrating and warming up, the
+ * time per operation of many batches gives percentiles. Results are
+ * JSON on standard output, one benchmark per line so that the output
+ * can be kept as the baseline for a later run.
+ *
+ * Where the system allows, misses of the cache and TLB are counted
+ * too, per operation.
+ */
+
+struct bench {
+    char *name;
+    void (*run)(void *arg);
+    void *arg;
+};
+
+struct counter {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    int fd; /* or -1 if not available */
+};
+
+struct result {
+    unsigned int batch, repetitions;
+    double min, median, p90, p99, max; /* nanoseconds per operation */
+    double count[COUNTERS]; /* per operation */
+};
+
+static struct bench bench[MAX_BENCHMARKS];
+static size_t nbench;
+
+static struct counter counter[COUNTERS] = {
+    {
+        .name = "cache_misses",
+        .type = PERF_TYPE_HARDWARE,
+        .config = PERF_COUNT_HW_CACHE_MISSES,
+    }, {
+        .name = "dtlb_misses",
+        .type = PERF_TYPE_HW_CACHE,
+        .config = PERF_COUNT_HW_CACHE_DTLB
+            | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+            | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    },
+};
+
+/*
+ * Register a benchmark, with a name in the style of printf()
+ */
+
+void bench_add(void (*run)(void *arg), void *arg, const char *fmt, ...)
+{
+    va_list ap;
+    struct bench *b;
+
+    if (nbench == ARRAY_SIZE(bench)) {
+        fprintf(stderr, "Too many benchmarks\n");
+        abort();
+    }
+
+    b = &bench[nbench++];
+
+    va_start(ap, fmt);
+    if (vasprintf(&b->name, fmt, ap) == -1) {
+        perror("vasprintf");
+        abort();
+    }
+    va_end(ap);
+
+    b->run = run;
+    b->arg = arg;
+}
+
+/*
+ * Open the performance counters of this thread, where possible
+ */
+
+static void open_counters(void)
+{
+    size_t n;
+
+    for (n = 0; n < COUNTERS; n++) {
+        struct counter *c = &counter[n];
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = c->type;
+        attr.config = c->config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        c->fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (c->fd == -1)
+            fprintf(stderr, "No counter of %s\n", c->name);
+    }
+}
+
+static void close_counters(void)
+{
+    size_t n;
+
+    for (n = 0; n < COUNTERS; n++) {
+        if (counter[n].fd != -1 && close(counter[n].fd) == -1)
+            abort();
+    }
+}
+
+static void start_counters(void)
+{
+    size_t n;
+
+    for (n = 0; n < COUNTERS; n++) {
+        if (counter[n].fd == -1)
+            continue;
+        if (ioctl(counter[n].fd, PERF_EVENT_IOC_RESET, 0) == -1)
+            abort();
+        if (ioctl(counter[n].fd, PERF_EVENT_IOC_ENABLE, 0) == -1)
+            abort();
+    }
+}
+
+/*
+ * Post: count contains the events of each counter divided by ops, or
+ * -1.0 where the counter is not available
+ */
+
+static void stop_counters(double *count, unsigned long ops)
+{
+    size_t n;
+
+    for (n = 0; n < COUNTERS; n++) {
+        uint64_t v;
+
+        count[n] = -1.0;
+
+        if (counter[n].fd == -1)
+            continue;
+        if (ioctl(counter[n].fd, PERF_EVENT_IOC_DISABLE, 0) == -1)
+            abort();
+        if (read(counter[n].fd, &v, sizeof v) != sizeof v)
+            abort();
+
+        count[n] = (double)v / ops;
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Return: time in seconds of a batch of the given size
+ */
+
+static double batch(const struct bench *b, unsigned int size)
+{
+    unsigned int n;
+    double start;
+
+    start = now();
+    for (n = 0; n < size; n++)
+        b->run(b->arg);
+
+    return now() - start;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Return: nearest-rank percentile p of the sorted values
+ */
+
+static double percentile(const double *v, size_t n, double p)
+{
+    size_t r;
+
+    r = p * n;
+    if (r >= n)
+        r = n - 1;
+
+    return v[r];
+}
+
+static void measure(const struct bench *b, unsigned int warmup,
+                    unsigned int repetitions, struct result *r)
+{
+    unsigned int size, n;
+    double t[MAX_REPETITIONS];
+
+    /* Grow the batch until it takes long enough to time */
+
+    size = 1;
+    while (batch(b, size) < TARGET && size < MAX_BATCH)
+        size *= 2;
+
+    for (n = 0; n < warmup; n++)
+        batch(b, size);
+
+    start_counters();
+
+    for (n = 0; n < repetitions; n++)
+        t[n] = batch(b, size) * 1e9 / size;
+
+    stop_counters(r->count, (unsigned long)repetitions * size);
+
+    qsort(t, repetitions, sizeof *t, cmp_double);
+
+    r->batch = size;
+    r->repetitions = repetitions;
+    r->min = t[0];
+    r->median = percentile(t, repetitions, 0.5);
+    r->p90 = percentile(t, repetitions, 0.9);
+    r->p99 = percentile(t, repetitions, 0.99);
+    r->max = t[repetitions - 1];
+}
+
+/*
+ * Find the median time of a benchmark in a baseline; the output of a
+ * previous run
+ *
+ * Return: median in nanoseconds, or -1.0 if not present
+ */
+
+static double baseline_median(FILE *f, const char *name)
+{
+    char line[256], key[128];
+    double median;
+
+    if (f == NULL)
+        return -1.0;
+
+    rewind(f);
+
+    while (fgets(line, sizeof line, f) != NULL) {
+        if (sscanf(line, " {\"name\": \"%127[^\"]\", \"batch\": %*u, "
+                   "\"repetitions\": %*u, \"min\": %*f, \"median\": %lf",
+                   key, &median) != 2)
+        {
+            continue;
+        }
+
+        if (strcmp(key, name) == 0)
+            return median;
+    }
+
+    return -1.0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-w <warmup>] [-r <repetitions>] "
+            "[-b <baseline>] [-t <threshold>] [<name> ...]\n"
+            "\n"
+            "  -w  Batches to run before timing (default %d)\n"
+            "  -r  Batches to time (default %d)\n"
+            "  -b  Compare to results in the given file\n"
+            "  -t  Per cent slower than the baseline to fail (default %.0f)\n"
+            "\n"
+            "Only benchmarks whose name contains one of the given names "
+            "are run.\n", argv0, WARMUP, REPETITIONS, THRESHOLD);
+}
+
+/*
+ * Return: true if the benchmark was chosen on the command line
+ */
+
+static bool chosen(const struct bench *b, int argc, char *argv[])
+{
+    int n;
+
+    if (argc == 0)
+        return true;
+
+    for (n = 0; n < argc; n++) {
+        if (strstr(b->name, argv[n]) != NULL)
+            return true;
+    }
+
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    unsigned int warmup, repetitions, regressions;
+    double threshold;
+    const char *baseline, *sep;
+    FILE *f;
+    size_t n, m;
+
+    warmup = WARMUP;
+    repetitions = REPETITIONS;
+    threshold = THRESHOLD;
+    baseline = NULL;
+
+    while ((c = getopt(argc, argv, "w:r:b:t:h")) != -1) {
+        switch (c) {
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'r':
+            repetitions = atoi(optarg);
+            break;
+        case 'b':
+            baseline = optarg;
+            break;
+        case 't':
+            threshold = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (repetitions < 1 || repetitions > MAX_REPETITIONS) {
+        fprintf(stderr, "Repetitions must be 1 to %d\n", MAX_REPETITIONS);
+        return -1;
+    }
+
+    f = NULL;
+    if (baseline != NULL) {
+        f = fopen(baseline, "r");
+        if (f == NULL)
+            fprintf(stderr, "No baseline %s, not comparing\n", baseline);
+    }
+
+    if (bench_audio() == -1)
+        return -1;
+    if (bench_interface() == -1)
+        return -1;
+    if (bench_library() == -1)
+        return -1;
+
+    open_counters();
+
+    printf("{\"benchmarks\": [");
+    sep = "\n";
+    regressions = 0;
+
+    for (n = 0; n < nbench; n++) {
+        struct bench *b;
+        struct result r;
+        double base;
+
+        b = &bench[n];
+        if (!chosen(b, argc - optind, argv + optind))
+            continue;
+
+        measure(b, warmup, repetitions, &r);
+
+        printf("%s  {\"name\": \"%s\", \"batch\": %u, \"repetitions\": %u, "
+               "\"min\": %.1f, \"median\": %.1f, \"p90\": %.1f, "
+               "\"p99\": %.1f, \"max\": %.1f",
+               sep, b->name, r.batch, r.repetitions,
+               r.min, r.median, r.p90, r.p99, r.max);
+
+        for (m = 0; m < COUNTERS; m++) {
+            if (r.count[m] >= 0.0)
+                printf(", \"%s\": %.2f", counter[m].name, r.count[m]);
+        }
+
+        printf("}");
+        fflush(stdout);
+        sep = ",\n";
+
+        fprintf(stderr, "%-32s %12.1fns", b->name, r.median);
+
+        base = baseline_median(f, b->name);
+        if (base > 0.0) {
+            double change;
+
+            change = (r.median - base) / base * 100.0;
+            fprintf(stderr, " %+6.1f%%", change);
+
+            if (change > threshold) {
+                fprintf(stderr, " REGRESSION");
+                regressions++;
+            }
+        }
+
+        fputc('\n', stderr);
+    }
+
+    printf("\n]}\n");
+
+    close_counters();
+    if (f != NULL)
+        fclose(f);
+
+    if (regressions > 0) {
+        fprintf(stderr, "%u benchmarks slower than the baseline by more "
+                "than %.0f%%\n", regressions, threshold);
+        return 1;
+    }
+
+    return 0;
+}
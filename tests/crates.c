@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "library.h"
+
+#define CRATES 5000
+#define FOLDERS 50
+
+/*
+ * Manual benchmark of creating a library with many crates, as when
+ * importing playlists in folders
+ */
+
+static double since(clock_t t)
+{
+    return (double)(clock() - t) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int n, crates;
+    char name[64];
+    struct library lib;
+    struct crate *folder[FOLDERS], *prev;
+    clock_t t;
+
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [<crates>]\n", argv[0]);
+        return -1;
+    }
+
+    crates = (argc > 1) ? atoi(argv[1]) : CRATES;
+
+    if (library_global_init() == -1)
+        return -1;
+
+    if (library_init(&lib) == -1)
+        return -1;
+
+    t = clock();
+
+    for (n = 0; n < FOLDERS; n++) {
+        sprintf(name, "Folder %u", n);
+        folder[n] = library_local(&lib, NULL, name);
+        if (folder[n] == NULL)
+            return -1;
+    }
+
+    srand(0);
+
+    for (n = 0; n < crates; n++) {
+        sprintf(name, "Playlist %d", rand());
+        if (library_local(&lib, folder[n % FOLDERS], name) == NULL)
+            return -1;
+    }
+
+    printf("%zu crates created and sorted in %.4fs\n", lib.crates, since(t));
+
+    /* Lookup of an existing crate by name */
+
+    t = clock();
+
+    for (n = 0; n < FOLDERS; n++) {
+        sprintf(name, "Folder %u", n);
+        if (get_crate(&lib, name) != folder[n]) {
+            fprintf(stderr, "Crate '%s' was not found\n", name);
+            return -1;
+        }
+    }
+
+    printf("%d crates found in %.6fs\n", FOLDERS, since(t));
+
+    /* The content of each folder follows it */
+
+    prev = NULL;
+
+    for (n = 0; n < lib.crates; n++) {
+        struct crate *c;
+
+        c = library_crate(&lib, n);
+
+        if (c->parent != NULL && c->parent != prev
+            && c->parent != prev->parent)
+        {
+            fprintf(stderr, "Crate '%s' is not in its folder\n", c->name);
+            return -1;
+        }
+
+        prev = c;
+    }
+
+    library_clear(&lib);
+    library_global_clear();
+
+    return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#define _GNU_SOURCE /* asprintf() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "index.h"
+
+#define RECORDS 100000
+#define SEARCHES 16
+
+/*
+ * Manual benchmark of sorting records into the indexes, as when a
+ * library is scanned. The records are made up, with many sharing the
+ * start of the artist name or the whole of it.
+ */
+
+static const char *prefix[] = {
+    "The ", "the ", "DJ ", "", "", "", "Various Artists", "VARIOUS ARTISTS",
+};
+
+static char* field(unsigned int n, const char *s)
+{
+    char *buf;
+
+    if (asprintf(&buf, "%s%u", s, n) == -1) {
+        perror("asprintf");
+        exit(EXIT_FAILURE);
+    }
+
+    return buf;
+}
+
+/*
+ * Return: true if the index is in order of artist, then title
+ */
+
+static bool is_sorted(const struct index *i)
+{
+    size_t n;
+
+    for (n = 1; n < i->entries; n++) {
+        const struct record *a, *b;
+        int r;
+
+        a = index_record(i, n - 1);
+        b = index_record(i, n);
+
+        r = strcasecmp(a->artist, b->artist);
+        if (r == 0)
+            r = strcasecmp(a->title, b->title);
+        if (r == 0)
+            r = strcmp(a->pathname, b->pathname);
+
+        if (r >= 0)
+            return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int n, records;
+    struct record **r;
+    size_t scanned;
+    struct index by_artist, by_bpm, found, ordered;
+    struct record_set set;
+    struct match match;
+    struct path_index by_pathname;
+    clock_t elapsed;
+
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [<records>]\n", argv[0]);
+        return -1;
+    }
+
+    records = (argc > 1) ? atoi(argv[1]) : RECORDS;
+
+    r = malloc(sizeof *r * records);
+    if (r == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    srand(0);
+
+    for (n = 0; n < records; n++) {
+        const char *p;
+
+        p = prefix[rand() % (sizeof prefix / sizeof *prefix)];
+
+        r[n] = record_new();
+        if (r[n] == NULL)
+            return -1;
+
+        r[n]->pathname = field(n, "/music/");
+        r[n]->artist = field(rand() % (records / 8 + 1), p);
+        r[n]->title = field(rand() % 16, "Track ");
+        r[n]->match = NULL;
+        r[n]->bpm = (rand() % 8) ? 90.0 + rand() % 800 / 10.0 : 0.0;
+
+        record_init_key(r[n]);
+    }
+
+    index_init(&by_artist);
+    index_init(&by_bpm);
+
+    if (index_reserve(&by_artist, records) == -1)
+        return -1;
+    if (index_reserve(&by_bpm, records) == -1)
+        return -1;
+
+    elapsed = clock();
+
+    for (n = 0; n < records; n++) {
+        index_insert(&by_artist, r[n], SORT_ARTIST);
+        index_insert(&by_bpm, r[n], SORT_BPM);
+    }
+
+    elapsed = clock() - elapsed;
+
+    printf("%u records sorted in %.3fs\n",
+           records, (double)elapsed / CLOCKS_PER_SEC);
+
+    /* Searching is almost entirely comparisons */
+
+    elapsed = clock();
+
+    for (n = 0; n < records; n++) {
+        if (index_find(&by_artist, r[n], SORT_ARTIST) >= records)
+            abort();
+        if (index_find(&by_bpm, r[n], SORT_BPM) >= records)
+            abort();
+    }
+
+    elapsed = clock() - elapsed;
+
+    printf("%u records found in %.3fs\n",
+           records, (double)elapsed / CLOCKS_PER_SEC);
+
+    if (!is_sorted(&by_artist)) {
+        fprintf(stderr, "Index is not in order\n");
+        return -1;
+    }
+
+    /* Identity of a record, by pathname */
+
+    path_index_init(&by_pathname);
+
+    if (path_index_reserve(&by_pathname, records) == -1)
+        return -1;
+
+    for (n = 0; n < records; n++)
+        path_index_add(&by_pathname, r[n]);
+
+    elapsed = clock();
+
+    for (n = 0; n < records; n++) {
+        if (path_index_match(&by_pathname, r[n]) != r[n])
+            abort();
+        if (path_index_find(&by_pathname, r[n]->pathname) != r[n])
+            abort();
+    }
+
+    elapsed = clock() - elapsed;
+
+    printf("%u records found by pathname in %.3fs\n",
+           records, (double)elapsed / CLOCKS_PER_SEC);
+
+    if (path_index_find(&by_pathname, "/music/none") != NULL) {
+        fprintf(stderr, "Unknown pathname was found\n");
+        return -1;
+    }
+
+    path_index_clear(&by_pathname);
+
+    /* A narrow range of BPM, by scanning and binary search */
+
+    match_compile(&match, "bpm:124-125");
+    index_init(&found);
+
+    elapsed = clock();
+    for (n = 0; n < SEARCHES; n++)
+        if (index_match(&by_bpm, &found, &match) == -1)
+            return -1;
+    elapsed = clock() - elapsed;
+
+    printf("%zu records in range, scanned in %.6fs\n", found.entries,
+           (double)elapsed / CLOCKS_PER_SEC / SEARCHES);
+
+    scanned = found.entries;
+
+    elapsed = clock();
+    for (n = 0; n < SEARCHES; n++)
+        if (index_match_bpm(&by_bpm, &found, &match) == -1)
+            return -1;
+    elapsed = clock() - elapsed;
+
+    printf("%zu records in range, searched in %.6fs\n", found.entries,
+           (double)elapsed / CLOCKS_PER_SEC / SEARCHES);
+
+    if (found.entries != scanned) {
+        fprintf(stderr, "Range search does not match\n");
+        return -1;
+    }
+
+    /* Change the order of a search result, by repeating the search
+     * and by filtering against the result */
+
+    match_compile(&match, "the 1");
+    if (index_match(&by_artist, &found, &match) == -1)
+        return -1;
+
+    index_init(&ordered);
+    record_set_init(&set);
+
+    elapsed = clock();
+    for (n = 0; n < SEARCHES; n++)
+        if (index_match(&by_bpm, &ordered, &match) == -1)
+            return -1;
+    elapsed = clock() - elapsed;
+
+    printf("%zu records re-ordered by search in %.6fs\n", ordered.entries,
+           (double)elapsed / CLOCKS_PER_SEC / SEARCHES);
+
+    scanned = ordered.entries;
+
+    elapsed = clock();
+    for (n = 0; n < SEARCHES; n++)
+        if (index_filter(&by_bpm, &ordered, &found, &set) == -1)
+            return -1;
+    elapsed = clock() - elapsed;
+
+    printf("%zu records re-ordered by filter in %.6fs\n", ordered.entries,
+           (double)elapsed / CLOCKS_PER_SEC / SEARCHES);
+
+    if (ordered.entries != scanned || ordered.entries != found.entries) {
+        fprintf(stderr, "Re-ordered records do not match\n");
+        return -1;
+    }
+
+    record_set_clear(&set);
+    index_clear(&ordered);
+    index_clear(&found);
+    index_clear(&by_artist);
+    index_clear(&by_bpm);
+
+    for (n = 0; n < records; n++) {
+        free(r[n]->pathname);
+        free(r[n]->artist);
+        free(r[n]->title);
+    }
+    free(r);
+    record_table_clear();
+
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "meter.h"
+#include "track.h"
+
+#define RATE 44100
+#define CHUNK 16384 /* samples committed at once, as from a pipe */
+#define PASSES 8
+
+#define PPM_VALUES (TRACK_BLOCK_SAMPLES / TRACK_PPM_RES)
+#define OVERVIEW_VALUES (TRACK_BLOCK_SAMPLES / TRACK_OVERVIEW_RES)
+
+/*
+ * Manual benchmark of the meters computed on import. Read raw sample
+ * information, up to one block, and meter it in the same way as a
+ * track being imported.
+ *
+ * Only the metering is timed; decoding and the pipe are not involved.
+ * The output of each window size is compared to the per-sample meters
+ * of earlier versions, which are reproduced here.
+ */
+
+static void reference(struct track_block *b, unsigned int samples)
+{
+    unsigned int fill;
+    unsigned short ppm;
+    unsigned int overview;
+    const signed short *pcm;
+
+    ppm = 0;
+    overview = 0;
+    pcm = b->pcm;
+
+    for (fill = 0; fill < samples; fill++) {
+        unsigned short v;
+        unsigned int w;
+
+        v = abs(pcm[0]) + abs(pcm[1]);
+
+        if (v > ppm)
+            ppm += (v - ppm) >> 3;
+        else
+            ppm -= (ppm - v) >> 9;
+
+        b->ppm[fill / TRACK_PPM_RES] = ppm >> 8;
+
+        w = v << 16;
+
+        if (w > overview)
+            overview += (w - overview) >> 8;
+        else
+            overview -= (overview - w) >> 17;
+
+        b->overview[fill / TRACK_OVERVIEW_RES] = overview >> 24;
+
+        pcm += TRACK_CHANNELS;
+    }
+}
+
+static void meter(struct track_block *b, unsigned int samples,
+                  unsigned int window)
+{
+    unsigned int fill;
+    struct meter m;
+
+    meter_init(&m, window);
+
+    for (fill = 0; fill < samples; fill += CHUNK) {
+        unsigned int n;
+
+        n = samples - fill;
+        if (n > CHUNK)
+            n = CHUNK;
+
+        meter_commit(&m, b, fill, n);
+    }
+}
+
+/*
+ * Print the difference of meter values from the reference
+ */
+
+static void compare(const unsigned char *x, const unsigned char *ref,
+                    size_t n)
+{
+    size_t s;
+    int worst;
+    double total;
+
+    worst = 0;
+    total = 0.0;
+
+    for (s = 0; s < n; s++) {
+        int d;
+
+        d = abs(x[s] - ref[s]);
+        if (d > worst)
+            worst = d;
+        total += d;
+    }
+
+    fprintf(stderr, " error %.2f mean, %d max", n ? total / n : 0.0, worst);
+}
+
+int main(int argc, char *argv[])
+{
+    static unsigned char ppm[PPM_VALUES], overview[OVERVIEW_VALUES];
+    unsigned int samples, p;
+    size_t z;
+    struct track_block *b;
+    struct {
+        const char *name;
+        unsigned int window;
+    } *m, mode[] = {
+        { "reference", 0 },
+        { "window", METER_WINDOW },
+        { "compat", METER_COMPAT_WINDOW },
+    };
+
+    if (argc != 1) {
+        fprintf(stderr, "usage: %s < <raw>\n", argv[0]);
+        return -1;
+    }
+
+    b = malloc(sizeof *b);
+    if (b == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    z = fread(b->pcm, TRACK_CHANNELS * sizeof *b->pcm,
+              TRACK_BLOCK_SAMPLES, stdin);
+    if (ferror(stdin)) {
+        perror("fread");
+        return -1;
+    }
+    samples = z;
+
+    for (m = mode; m < mode + sizeof mode / sizeof *mode; m++) {
+        clock_t elapsed;
+        double secs;
+
+        elapsed = clock();
+
+        for (p = 0; p < PASSES; p++) {
+            if (m->window == 0)
+                reference(b, samples);
+            else
+                meter(b, samples, m->window);
+        }
+
+        elapsed = clock() - elapsed;
+        secs = (double)elapsed / CLOCKS_PER_SEC / PASSES;
+
+        fprintf(stderr, "%s: %u samples in %.4fs (%.0fx realtime)",
+                m->name, samples, secs,
+                secs > 0.0 ? (double)samples / RATE / secs : 0.0);
+
+        if (m->window == 0) {
+            memcpy(ppm, b->ppm, sizeof ppm);
+            memcpy(overview, b->overview, sizeof overview);
+        } else {
+            fprintf(stderr, "; ppm");
+            compare(b->ppm, ppm, samples / TRACK_PPM_RES);
+            fprintf(stderr, "; overview");
+            compare(b->overview, overview, samples / TRACK_OVERVIEW_RES);
+        }
+
+        fputc('\n', stderr);
+    }
+
+    free(b);
+
+    return 0;
+}
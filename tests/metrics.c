@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Manual test of the metrics, updated from several threads at once
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "metrics.h"
+
+#define THREADS 4
+#define UPDATES 1000000
+
+static struct metric counter, gauge[2];
+
+static void* hammer(void *p)
+{
+    int n;
+
+    for (n = 0; n < UPDATES; n++) {
+        metric_inc(&counter);
+        metric_add(&metric_import_bytes, 0.5);
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int n;
+    pthread_t ph[THREADS];
+
+    metrics_global_init();
+
+    metric_init(&counter, METRIC_COUNTER, "test_updates_total", NULL,
+                "Updates from all the threads");
+    metric_init(&gauge[0], METRIC_GAUGE, "test_gauge", "deck=\"0\"",
+                "A gauge with labels");
+    metric_init(&gauge[1], METRIC_GAUGE, "test_gauge", "deck=\"1\"",
+                "A gauge with labels");
+
+    metric_register(&gauge[0]);
+    metric_register(&counter);
+    metric_register(&gauge[1]); /* joins the other */
+
+    metric_set(&gauge[0], 1.5);
+    metric_set(&gauge[1], -3.0);
+
+    for (n = 0; n < THREADS; n++) {
+        if (pthread_create(&ph[n], NULL, hammer, NULL) != 0)
+            abort();
+    }
+
+    for (n = 0; n < THREADS; n++) {
+        if (pthread_join(ph[n], NULL) != 0)
+            abort();
+    }
+
+    if (metrics_write(stdout) == -1)
+        return -1;
+
+    if (metric_get(&counter) != THREADS * UPDATES) {
+        fprintf(stderr, "Updates were lost\n");
+        return -1;
+    }
+
+    if (metric_get(&metric_import_bytes) != THREADS * UPDATES * 0.5) {
+        fprintf(stderr, "Bytes were lost\n");
+        return -1;
+    }
+
+    metric_unregister(&gauge[0]);
+    metric_unregister(&gauge[1]);
+    metric_unregister(&counter);
+    metrics_global_clear();
+
+    return 0;
+}
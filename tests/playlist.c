@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include <stdio.h>
+#include <time.h>
+
+#include "library.h"
+#include "playlist.h"
+
+/*
+ * Manual test of importing playlists and the libraries of other
+ * software, showing the resulting crates
+ */
+
+int main(int argc, char *argv[])
+{
+    size_t n;
+    struct library lib;
+    clock_t t;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <playlist> [...]\n", argv[0]);
+        return -1;
+    }
+
+    if (library_global_init() == -1)
+        return -1;
+
+    if (library_init(&lib) == -1)
+        return -1;
+
+    t = clock();
+
+    for (n = 1; n < argc; n++) {
+        if (playlist_import(&lib, argv[n]) == -1)
+            return -1;
+    }
+
+    printf("%zu records imported in %.3fs\n", lib.storage.by_artist.entries,
+           (double)(clock() - t) / CLOCKS_PER_SEC);
+
+    for (n = 0; n < lib.crates; n++) {
+        struct crate *c;
+
+        c = library_crate(&lib, n);
+        printf("%*s%s: %zu\n", c->depth * 2, "", c->name,
+               c->listing->by_order.entries);
+    }
+
+    library_clear(&lib);
+    library_global_clear();
+
+    return 0;
+}
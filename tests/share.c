@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Manual test of the shared state, as a separate process would see
+ * it; run xwax with --share <name>
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "share.h"
+
+/*
+ * Send a single command, and print the reply
+ */
+
+static int command(const char *name, const char *cmd)
+{
+    char buf[4096];
+    const char *dir;
+    int fd;
+    ssize_t z;
+    struct sockaddr_un addr;
+
+    dir = getenv("XDG_RUNTIME_DIR");
+    if (dir == NULL || dir[0] == '\0')
+        dir = "/tmp";
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof addr.sun_path, "%s/%s.sock", dir, name);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof addr) == -1) {
+        perror(addr.sun_path);
+        return -1;
+    }
+
+    if (dprintf(fd, "%s\n", cmd) < 0) {
+        perror("dprintf");
+        return -1;
+    }
+
+    shutdown(fd, SHUT_WR);
+
+    while ((z = read(fd, buf, sizeof buf)) > 0)
+        fwrite(buf, 1, z, stdout);
+
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char shm[256];
+    int fd;
+    unsigned int n, tries;
+    uint64_t frame;
+    const struct share_state *s;
+    static struct share_state copy;
+
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <name> [<command>]\n", argv[0]);
+        return -1;
+    }
+
+    if (argc == 3)
+        return command(argv[1], argv[2]);
+
+    snprintf(shm, sizeof shm, "/%s", argv[1]);
+
+    fd = shm_open(shm, O_RDONLY, 0);
+    if (fd == -1) {
+        perror(shm);
+        return -1;
+    }
+
+    s = mmap(NULL, sizeof *s, PROT_READ, MAP_SHARED, fd, 0);
+    if (s == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    close(fd);
+
+    if (s->magic != SHARE_MAGIC || s->version != SHARE_VERSION
+        || s->size != sizeof *s)
+    {
+        fprintf(stderr, "Unknown version of the shared state.\n");
+        return -1;
+    }
+
+    frame = 0;
+
+    for (;;) {
+        tries = 1;
+        while (!share_read(s, &copy))
+            tries++;
+
+        if (copy.frame == frame) {
+            usleep(10000);
+            continue;
+        }
+        frame = copy.frame;
+
+        printf("frame %llu (%u tries) decks %u crates %u: %s\n",
+               (unsigned long long)copy.frame, tries,
+               copy.decks, copy.crates, copy.status);
+
+        for (n = 0; n < copy.decks && n < SHARE_DECKS; n++) {
+            const struct share_deck *d = &copy.deck[n];
+
+            printf("  %u: [%u] %s - %s %.3f/%.3fs pitch %+.3f%s%s\n",
+                   n, d->track, d->artist, d->title, d->position,
+                   d->rate ? (double)d->length / d->rate : 0.0,
+                   d->pitch,
+                   d->flags & SHARE_IMPORTING ? " importing" : "",
+                   d->flags & SHARE_TIMECODE ? " timecode" : "");
+        }
+
+        fflush(stdout);
+        usleep(100000);
+    }
+}
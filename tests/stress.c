@@ -0,0 +1,446 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "deck.h"
+#include "device.h"
+#include "library.h"
+#include "realtime.h"
+#include "rig.h"
+#include "selector.h"
+#include "thread.h"
+#include "timecoder.h"
+
+/*
+ * Stress test of realtime playback against the operations of the
+ * interface
+ *
+ * Decks play at realtime pace on a device paced by a timer, whilst
+ * a driver thread loads, clones, searches and rescans as fast as it
+ * can. The periods of silence, late periods and blocking calls from
+ * the realtime thread are counted against budgets.
+ */
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+
+#define DECKS 3
+#define RATE 48000
+#define PERIOD 256 /* samples */
+#define LATE 0.5 /* fraction of a period to be woken late */
+
+#define DURATION 10 /* seconds */
+#define DROPOUTS 0
+#define LATE_PERIODS 0
+
+#define PRIORITY 80
+
+#define TIMECODE "serato_2a"
+
+/* A device which asks for audio at the pace of a soundcard, and
+ * discards it */
+
+struct paced {
+    int fd;
+    double deadline;
+    unsigned long periods, late;
+    signed short in[PERIOD * DEVICE_CHANNELS],
+        out[PERIOD * DEVICE_CHANNELS];
+};
+
+static struct rt rt;
+static struct library library;
+static struct selector selector;
+static struct deck deck[DECKS];
+static struct paced paced[DECKS];
+
+static double duration;
+static unsigned long operations[4], violations;
+
+static __thread bool realtime;
+
+/*
+ * Replacements for those of thread.c, to count calls which would
+ * block the realtime thread rather than abort
+ */
+
+int thread_global_init(void)
+{
+    return 0;
+}
+
+void thread_global_clear(void)
+{
+}
+
+void thread_to_realtime(void)
+{
+    realtime = true;
+}
+
+void rt_not_allowed()
+{
+    if (realtime)
+        __atomic_add_fetch(&violations, 1, __ATOMIC_RELAXED);
+}
+
+/* Nothing is written at intervals in this test */
+
+int periodic_start(struct periodic *p, void (*fn)(void),
+                   unsigned int interval)
+{
+    return -1;
+}
+
+void periodic_stop(struct periodic *p)
+{
+}
+
+static double now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static ssize_t paced_pollfds(struct device *dv, struct pollfd *pe, size_t z)
+{
+    struct paced *p = dv->local;
+
+    if (z < 1)
+        return -1;
+
+    pe->fd = p->fd;
+    pe->events = POLLIN;
+    return 1;
+}
+
+/*
+ * Handle a period, or any number of them which were missed
+ *
+ * A period is late when the timer has expired more than once, or
+ * when we were woken well after it expired.
+ */
+
+static int paced_handle(struct device *dv)
+{
+    struct paced *p = dv->local;
+    uint64_t n;
+
+    if (read(p->fd, &n, sizeof n) == -1) {
+        if (errno == EAGAIN)
+            return 0; /* activity was on another device */
+        perror("read");
+        return -1;
+    }
+
+    p->deadline += (double)PERIOD / RATE * n;
+    p->periods += n;
+    p->late += n - 1;
+
+    if (now() - p->deadline > (double)PERIOD / RATE * LATE)
+        p->late++;
+
+    device_submit(dv, p->in, PERIOD);
+    device_collect(dv, p->out, PERIOD);
+
+    return 0;
+}
+
+static unsigned int paced_sample_rate(struct device *dv)
+{
+    return RATE;
+}
+
+static void paced_start(struct device *dv)
+{
+    struct paced *p = dv->local;
+    struct itimerspec t;
+
+    t.it_interval.tv_sec = 0;
+    t.it_interval.tv_nsec = 1000000000LL * PERIOD / RATE;
+    t.it_value = t.it_interval;
+
+    p->deadline = now();
+    if (timerfd_settime(p->fd, 0, &t, NULL) == -1)
+        abort();
+}
+
+static void paced_clear(struct device *dv)
+{
+    struct paced *p = dv->local;
+
+    if (close(p->fd) == -1)
+        abort();
+}
+
+static struct device_ops paced_ops = {
+    .pollfds = paced_pollfds,
+    .handle = paced_handle,
+    .sample_rate = paced_sample_rate,
+    .start = paced_start, /* no stop; it wakes the realtime thread */
+    .clear = paced_clear,
+};
+
+static int paced_init(struct device *dv, struct paced *p)
+{
+    p->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (p->fd == -1) {
+        perror("timerfd_create");
+        return -1;
+    }
+
+    p->periods = 0;
+    p->late = 0;
+    memset(p->in, 0, sizeof p->in);
+
+    device_init(dv, &paced_ops);
+    dv->local = p;
+
+    return 0;
+}
+
+/*
+ * One operation of the interface, chosen at random
+ *
+ * Pre: rig lock is held
+ */
+
+static void operate(unsigned int *seed)
+{
+    unsigned int op;
+    struct deck *d;
+    const struct index *all;
+    struct crate *c;
+
+    op = rand_r(seed) % ARRAY_SIZE(operations);
+    d = &deck[rand_r(seed) % DECKS];
+
+    switch (op) {
+    case 0:
+        all = &library_crate(&library, 0)->listing->by_order;
+        if (all->entries == 0)
+            return;
+        deck_load(d, index_record(all, rand_r(seed) % all->entries));
+        break;
+
+    case 1:
+        deck_clone(d, &deck[rand_r(seed) % DECKS]);
+        break;
+
+    case 2:
+        if (selector.search_len > 3)
+            selector_search_expand(&selector);
+        else
+            selector_search_refine(&selector, 'a' + rand_r(seed) % 26);
+        break;
+
+    case 3:
+        c = library_crate(&library, rand_r(seed) % library.crates);
+        if (c->excrate == NULL)
+            return;
+        (void)library_rescan(&library, c);
+        break;
+    }
+
+    operations[op]++;
+}
+
+static void* drive(void *p)
+{
+    unsigned int seed;
+    double end;
+
+    seed = 0;
+    end = now() + duration;
+
+    while (now() < end) {
+        struct timespec t;
+
+        rig_lock();
+        operate(&seed);
+        rig_unlock();
+
+        /* Let the rig take the lock to handle imports */
+
+        t.tv_sec = 0;
+        t.tv_nsec = rand_r(&seed) % 2000000;
+        nanosleep(&t, NULL);
+    }
+
+    if (rig_quit() == -1)
+        abort();
+
+    return NULL;
+}
+
+static bool budget(const char *name, unsigned long n, unsigned long max)
+{
+    bool ok;
+
+    ok = (n <= max);
+    printf("%-16s %8lu  (budget %lu) %s\n", name, n, max,
+           ok ? "ok" : "FAIL");
+
+    return ok;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-t <seconds>] [-d <dropouts>] "
+            "[-l <late>] [-p <priority>] <importer> <scanner> <path>\n"
+            "\n"
+            "  -t  Length of the test (default %d)\n"
+            "  -d  Budget of periods of silence (default %d)\n"
+            "  -l  Budget of late periods (default %d)\n"
+            "  -p  Realtime priority, or 0 for none (default %d)\n",
+            argv0, DURATION, DROPOUTS, LATE_PERIODS, PRIORITY);
+}
+
+int main(int argc, char *argv[])
+{
+    int c, priority;
+    unsigned long max_dropouts, max_late, periods, dropouts, late;
+    struct timecode_def *timecode;
+    pthread_t ph;
+    size_t n;
+    bool ok;
+
+    duration = DURATION;
+    max_dropouts = DROPOUTS;
+    max_late = LATE_PERIODS;
+    priority = PRIORITY;
+
+    while ((c = getopt(argc, argv, "t:d:l:p:h")) != -1) {
+        switch (c) {
+        case 't':
+            duration = atof(optarg);
+            break;
+        case 'd':
+            max_dropouts = atol(optarg);
+            break;
+        case 'l':
+            max_late = atol(optarg);
+            break;
+        case 'p':
+            priority = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (argc - optind != 3) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (library_global_init() == -1)
+        return -1;
+    metrics_global_init();
+
+    if (rig_init() == -1)
+        return -1;
+    rt_init(&rt);
+    if (library_init(&library) == -1)
+        return -1;
+
+    if (library_import(&library, argv[optind + 1], argv[optind + 2]) == -1)
+        return -1;
+
+    selector_init(&selector, &library);
+    selector_set_lines(&selector, 20);
+
+    timecode = timecoder_find_definition(TIMECODE);
+    if (timecode == NULL)
+        abort();
+
+    for (n = 0; n < DECKS; n++) {
+        if (paced_init(&deck[n].device, &paced[n]) == -1)
+            return -1;
+
+        if (deck_init(&deck[n], &rt, timecode, false, argv[optind],
+                      1.0, false, false) == -1)
+        {
+            return -1;
+        }
+
+        player_set_internal_playback(&deck[n].player);
+    }
+
+    if (rt_start(&rt, priority) == -1)
+        return -1;
+
+    if (pthread_create(&ph, NULL, drive, NULL) != 0) {
+        perror("pthread_create");
+        return -1;
+    }
+
+    if (rig_main() == -1)
+        return -1;
+
+    if (pthread_join(ph, NULL) != 0)
+        abort();
+
+    rt_stop(&rt);
+
+    periods = 0;
+    dropouts = 0;
+    late = 0;
+
+    for (n = 0; n < DECKS; n++) {
+        periods += paced[n].periods;
+        dropouts += deck[n].player.dropouts.value;
+        late += paced[n].late;
+    }
+
+    printf("%lu loads, %lu clones, %lu searches, %lu rescans\n",
+           operations[0], operations[1], operations[2], operations[3]);
+    printf("%-16s %8lu\n", "periods", periods);
+
+    ok = true;
+    ok &= budget("dropouts", dropouts, max_dropouts);
+    ok &= budget("late periods", late, max_late);
+    ok &= budget("rt violations", violations, 0);
+
+    for (n = 0; n < DECKS; n++)
+        deck_clear(&deck[n]);
+
+    selector_clear(&selector);
+    timecoder_free_lookup();
+    library_clear(&library);
+    rt_clear(&rt);
+    rig_clear();
+    library_global_clear();
+    metrics_global_clear();
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,509 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#define _GNU_SOURCE /* asprintf() */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tagcache.h"
+#include "tags.h"
+
+#define FILES 2000
+#define AUDIO 65536 /* bytes of 'audio' in each file */
+#define PICTURE 131072
+
+/*
+ * Manual benchmark of reading tags, with and without the cache.
+ * Files of each format are made up, each with a large picture and
+ * some audio which the reader should skip over.
+ */
+
+static char *dir;
+
+static void die(const char *s)
+{
+    perror(s);
+    exit(EXIT_FAILURE);
+}
+
+static void put(FILE *f, const void *p, size_t len)
+{
+    if (fwrite(p, 1, len, f) != len)
+        die("fwrite");
+}
+
+static void put_zero(FILE *f, size_t len)
+{
+    static const unsigned char zero[4096];
+
+    while (len > 0) {
+        size_t z = (len < sizeof zero) ? len : sizeof zero;
+        put(f, zero, z);
+        len -= z;
+    }
+}
+
+static void be32(FILE *f, uint32_t x)
+{
+    unsigned char b[4] = { x >> 24, x >> 16, x >> 8, x };
+    put(f, b, 4);
+}
+
+static void le32(FILE *f, uint32_t x)
+{
+    unsigned char b[4] = { x, x >> 8, x >> 16, x >> 24 };
+    put(f, b, 4);
+}
+
+static void syncsafe(FILE *f, uint32_t x)
+{
+    unsigned char b[4] = { (x >> 21) & 0x7f, (x >> 14) & 0x7f,
+                           (x >> 7) & 0x7f, x & 0x7f };
+    put(f, b, 4);
+}
+
+/*
+ * MP3 with ID3v2.3; artist in UTF-16 after a picture
+ */
+
+static void write_mp3(FILE *f, const char *artist, const char *title)
+{
+    size_t a, t, n;
+
+    a = 1 + 2 + strlen(artist) * 2;
+    t = 1 + strlen(title);
+
+    put(f, "ID3\x03\x00\x00", 6);
+    syncsafe(f, 10 + PICTURE + 10 + a + 10 + t + 10 + 4 + 1024);
+
+    put(f, "APIC", 4);
+    be32(f, PICTURE);
+    put(f, "\0\0", 2);
+    put_zero(f, PICTURE);
+
+    put(f, "TPE1", 4);
+    be32(f, a);
+    put(f, "\0\0\x01\xff\xfe", 5);
+    for (n = 0; artist[n] != '\0'; n++) {
+        put(f, &artist[n], 1);
+        put(f, "", 1);
+    }
+
+    put(f, "TIT2", 4);
+    be32(f, t);
+    put(f, "\0\0\0", 3);
+    put(f, title, strlen(title));
+
+    put(f, "TBPM", 4);
+    be32(f, 4);
+    put(f, "\0\0\0" "128", 6);
+
+    put_zero(f, 1024); /* padding */
+}
+
+static void comments(FILE *f, const char *artist, const char *title)
+{
+    char *s[3];
+    size_t n;
+
+    if (asprintf(&s[0], "ARTIST=%s", artist) == -1
+        || asprintf(&s[1], "title=%s", title) == -1
+        || asprintf(&s[2], "BPM=128") == -1)
+    {
+        die("asprintf");
+    }
+
+    le32(f, 1);
+    put(f, "x", 1);
+    le32(f, 3);
+
+    for (n = 0; n < 3; n++) {
+        le32(f, strlen(s[n]));
+        put(f, s[n], strlen(s[n]));
+        free(s[n]);
+    }
+}
+
+static size_t comments_len(const char *artist, const char *title)
+{
+    return 4 + 1 + 4 + 3 * 4 + strlen("ARTIST=") + strlen(artist)
+        + strlen("title=") + strlen(title) + strlen("BPM=128");
+}
+
+/*
+ * FLAC with a picture block before the comments
+ */
+
+static void write_flac(FILE *f, const char *artist, const char *title)
+{
+    size_t len;
+
+    put(f, "fLaC", 4);
+
+    be32(f, 34); /* STREAMINFO */
+    put_zero(f, 34);
+
+    be32(f, 6 << 24 | PICTURE);
+    put_zero(f, PICTURE);
+
+    len = comments_len(artist, title);
+    be32(f, (0x80 | 4) << 24 | len);
+    comments(f, artist, title);
+}
+
+static void ogg_page(FILE *f, unsigned int seq, size_t len)
+{
+    unsigned char segs;
+
+    put(f, "OggS\0\0", 6);
+    put_zero(f, 8); /* granule */
+    le32(f, 1234); /* serial */
+    le32(f, seq);
+    le32(f, 0); /* CRC, not checked */
+
+    segs = len / 255 + 1;
+    put(f, &segs, 1);
+    while (len >= 255) {
+        put(f, "\xff", 1);
+        len -= 255;
+    }
+    segs = len;
+    put(f, &segs, 1);
+}
+
+/*
+ * Ogg Vorbis, with the comments in the second page
+ */
+
+static void write_ogg(FILE *f, const char *artist, const char *title)
+{
+    size_t len;
+
+    ogg_page(f, 0, 30);
+    put(f, "\x01vorbis", 7);
+    put_zero(f, 23);
+
+    len = 7 + comments_len(artist, title) + 1;
+    ogg_page(f, 1, len);
+    put(f, "\x03vorbis", 7);
+    comments(f, artist, title);
+    put(f, "\x01", 1); /* framing */
+}
+
+static void atom(FILE *f, const char *type, size_t len)
+{
+    be32(f, 8 + len);
+    put(f, type, 4);
+}
+
+static void item(FILE *f, const char *type, const void *p, size_t len)
+{
+    atom(f, type, 16 + len);
+    atom(f, "data", 8 + len);
+    be32(f, 1);
+    be32(f, 0);
+    put(f, p, len);
+}
+
+/*
+ * MP4 with the audio before the metadata
+ */
+
+static void write_m4a(FILE *f, const char *artist, const char *title)
+{
+    size_t ilst, meta;
+
+    atom(f, "ftyp", 12);
+    put(f, "M4A \0\0\0\0M4A ", 12);
+
+    atom(f, "mdat", PICTURE);
+    put_zero(f, PICTURE);
+
+    ilst = (24 + strlen(artist)) + (24 + strlen(title)) + (24 + 2);
+    meta = 4 + (8 + 25) + (8 + ilst);
+
+    atom(f, "moov", (8 + 100) + (8 + (8 + meta)));
+    atom(f, "mvhd", 100);
+    put_zero(f, 100);
+    atom(f, "udta", 8 + meta);
+    atom(f, "meta", meta);
+    be32(f, 0);
+    atom(f, "hdlr", 25);
+    put_zero(f, 25);
+    atom(f, "ilst", ilst);
+    item(f, "\xa9" "ART", artist, strlen(artist));
+    item(f, "\xa9" "nam", title, strlen(title));
+    item(f, "tmpo", "\x00\x80", 2);
+}
+
+/*
+ * MP3 with a frame which is empty, but flagged as having a group
+ * identifier; it must be passed over, not read from
+ */
+
+static void write_empty_group(FILE *f)
+{
+    put(f, "ID3\x03\x00\x00", 6);
+    syncsafe(f, 10 + 10 + 6);
+
+    put(f, "TPE1", 4);
+    be32(f, 0);
+    put(f, "\x00\x20", 2);
+
+    put(f, "TIT2", 4);
+    be32(f, 6);
+    put(f, "\0\0\0" "Title", 8);
+}
+
+static void check_malformed(void)
+{
+    char *path;
+    FILE *f;
+    struct tags tags;
+
+    if (asprintf(&path, "%s/malformed.mp3", dir) == -1)
+        die("asprintf");
+
+    f = fopen(path, "w");
+    if (f == NULL)
+        die(path);
+    write_empty_group(f);
+    put_zero(f, AUDIO);
+    if (fclose(f) != 0)
+        die("fclose");
+
+    if (tags_read(path, &tags) == -1)
+        abort();
+    if (strcmp(tags.title, "Title") != 0) {
+        fprintf(stderr, "%s: got title '%s'\n", path, tags.title);
+        exit(EXIT_FAILURE);
+    }
+
+    unlink(path);
+    free(path);
+}
+
+static const struct {
+    const char *extension;
+    void (*write)(FILE *f, const char *artist, const char *title);
+} formats[] = {
+    { "mp3", write_mp3 },
+    { "flac", write_flac },
+    { "ogg", write_ogg },
+    { "m4a", write_m4a },
+};
+
+#define FORMATS (sizeof formats / sizeof *formats)
+
+static char* pathname(unsigned int n)
+{
+    char *s;
+
+    if (asprintf(&s, "%s/%u.%s", dir, n, formats[n % FORMATS].extension) == -1)
+        die("asprintf");
+
+    return s;
+}
+
+static void make_file(unsigned int n)
+{
+    char *path, artist[64], title[64];
+    FILE *f;
+
+    sprintf(artist, "Artist %u", n);
+    sprintf(title, "Title %u", n);
+
+    path = pathname(n);
+    f = fopen(path, "w");
+    if (f == NULL)
+        die(path);
+
+    formats[n % FORMATS].write(f, artist, title);
+
+    put_zero(f, AUDIO);
+
+    if (fclose(f) != 0)
+        die("fclose");
+
+    free(path);
+}
+
+static void check(unsigned int n, const char *artist, const char *title,
+                  double bpm)
+{
+    char a[64], t[64];
+
+    sprintf(a, "Artist %u", n);
+    sprintf(t, "Title %u", n);
+
+    if (strcmp(artist, a) != 0 || strcmp(title, t) != 0 || bpm != 128.0) {
+        fprintf(stderr, "File %u: got '%s' '%s' %g\n", n, artist, title, bpm);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Drop the page cache, so that the files are read from the disk;
+ * this needs root
+ *
+ * Return: true if the cache was dropped
+ */
+
+static bool drop_caches(void)
+{
+    FILE *f;
+
+    sync();
+
+    f = fopen("/proc/sys/vm/drop_caches", "w");
+    if (f == NULL)
+        return false;
+
+    fputs("1\n", f);
+    return fclose(f) == 0;
+}
+
+static double since(const struct timespec *t)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t->tv_sec) + (now.tv_nsec - t->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int n, files;
+    char tmpl[] = "/tmp/xwax-tags-XXXXXX", *cache;
+    struct tagcache c;
+    struct timespec t;
+    double elapsed;
+    bool cold;
+
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [<files>]\n", argv[0]);
+        return -1;
+    }
+
+    files = (argc > 1) ? atoi(argv[1]) : FILES;
+
+    dir = mkdtemp(tmpl);
+    if (dir == NULL)
+        die("mkdtemp");
+
+    if (asprintf(&cache, "%s/cache", dir) == -1)
+        die("asprintf");
+
+    check_malformed();
+
+    for (n = 0; n < files; n++)
+        make_file(n);
+
+    /* Cold: read the tags of every file; without root the files are
+     * likely to still be in memory from being written */
+
+    cold = drop_caches();
+
+    tagcache_init(&c);
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    for (n = 0; n < files; n++) {
+        char *path;
+        struct stat st;
+        struct tags tags;
+
+        path = pathname(n);
+        if (stat(path, &st) == -1)
+            die(path);
+
+        if (tagcache_lookup(&c, path, &st) != NULL)
+            abort();
+        if (tags_read(path, &tags) == -1)
+            abort();
+        check(n, tags.artist, tags.title, tags.bpm);
+
+        if (tagcache_store(&c, path, &st, &tags) == -1)
+            return -1;
+
+        free(path);
+    }
+
+    elapsed = since(&t);
+    printf("%s: %u files in %.3fs, %.0f files/sec\n",
+           cold ? "cold" : "uncached (page cache not dropped)",
+           files, elapsed, files / elapsed);
+
+    if (tagcache_save(&c, cache, dir) == -1)
+        return -1;
+    tagcache_clear(&c);
+
+    /* Warm: the cache is loaded, and no file is opened */
+
+    tagcache_init(&c);
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    if (tagcache_load(&c, cache, dir) == -1)
+        return -1;
+
+    for (n = 0; n < files; n++) {
+        char *path;
+        struct stat st;
+        const struct tagcache_entry *e;
+
+        path = pathname(n);
+        if (stat(path, &st) == -1)
+            die(path);
+
+        e = tagcache_lookup(&c, path, &st);
+        if (e == NULL) {
+            fprintf(stderr, "%s: Not in the cache\n", path);
+            return -1;
+        }
+        check(n, e->artist, e->title, e->bpm);
+
+        free(path);
+    }
+
+    elapsed = since(&t);
+    printf("warm: %u files in %.3fs, %.0f files/sec\n",
+           files, elapsed, files / elapsed);
+
+    tagcache_clear(&c);
+
+    for (n = 0; n < files; n++) {
+        char *path;
+
+        path = pathname(n);
+        unlink(path);
+        free(path);
+    }
+
+    unlink(cache);
+    free(cache);
+    rmdir(dir);
+
+    return 0;
+}
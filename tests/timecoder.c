@@ -19,54 +19,110 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
 #include "timecoder.h"
 
 #define STEREO 2
 #define RATE 96000
 #define INTERVAL 4096
+#define BATCH 64 /* intervals read and decoded at once */
 
 /*
  * Manual test of the timecoder's movement tracking. Read raw sample
  * information and write decoded pitch information.
+ *
+ * The time spent decoding is reported at the end, so the sample rate
+ * and decimation factor can be given to compare the cost. So is the
+ * proportion of time with a valid position, to compare the lock on
+ * recorded captures.
  */
 
 int main(int argc, char *argv[])
 {
-    unsigned int s;
-    signed short sample[STEREO];
+    unsigned int s, rate, block, intervals, locked;
+    double first;
+    signed short sample[STEREO * BATCH * RATE / INTERVAL];
+    float pitch[BATCH];
+    bool valid[BATCH];
     struct timecoder tc;
     struct timecode_def *def;
+    clock_t elapsed;
+
+    if (argc > 4) {
+        fprintf(stderr, "usage: %s [<rate> [<decimation> [<timecode>]]]\n",
+                argv[0]);
+        return -1;
+    }
 
-    def = timecoder_find_definition("serato_2a");
-    assert(def != NULL);
+    rate = (argc > 1) ? atoi(argv[1]) : RATE;
+
+    block = rate / INTERVAL;
+    if (block < 1)
+        block = 1;
+    if (block * BATCH > sizeof(sample) / sizeof(*sample) / STEREO)
+        block = sizeof(sample) / sizeof(*sample) / STEREO / BATCH;
+
+    def = timecoder_find_definition(argc > 3 ? argv[3] : "serato_2a");
+    if (def == NULL) {
+        fprintf(stderr, "Timecode is not known\n");
+        return -1;
+    }
 
-    timecoder_init(&tc, def, 1.0, RATE, false);
+    timecoder_init(&tc, def, 1.0, rate, false);
+    if (argc > 2)
+        timecoder_set_decimation(&tc, atoi(argv[2]));
 
     s = 0;
+    elapsed = 0;
+    intervals = 0;
+    locked = 0;
+    first = -1.0;
 
     for(;;) {
-        size_t z;
+        size_t z, n, b;
+        clock_t start;
 
-        z = fread(&sample, sizeof(short), STEREO, stdin);
-        if (z != 2)
+        z = fread(&sample, sizeof(short) * STEREO, block * BATCH, stdin);
+        if (z == 0)
             break;
 
-        timecoder_submit(&tc, sample, 1);
+        /* Time only the decoding, not the input and output */
 
-        if (s % (RATE / INTERVAL) == 0) {
-            float pitch;
+        start = clock();
 
-            pitch = timecoder_get_pitch(&tc);
-            printf("%f\t%.12f\n",
-                   (float)s / RATE, pitch);
+        for (n = 0, b = 0; n < z; n += block, b++) {
+            timecoder_submit(&tc, sample + n * STEREO,
+                             z - n < block ? z - n : block);
+            pitch[b] = timecoder_get_pitch(&tc);
+            valid[b] = (timecoder_get_position(&tc, NULL) != -1);
         }
 
-        s++;
+        elapsed += clock() - start;
+
+        for (n = 0, b = 0; n < z; n += block, b++) {
+            printf("%f\t%.12f\n", (float)(s + n) / rate, pitch[b]);
+
+            intervals++;
+            if (valid[b]) {
+                locked++;
+                if (first < 0.0)
+                    first = (double)(s + n) / rate;
+            }
+        }
+
+        s += z;
     }
 
     fflush(stdout);
 
+    fprintf(stderr, "%u samples decoded in %.3fs (%.1fx realtime)\n",
+            s, (double)elapsed / CLOCKS_PER_SEC,
+            (double)s / rate * CLOCKS_PER_SEC / (elapsed ? elapsed : 1));
+    fprintf(stderr, "position valid for %.1f%% of the time, first at %.3fs\n",
+            intervals ? 100.0 * locked / intervals : 0.0, first);
+
     timecoder_clear(&tc);
     timecoder_free_lookup();
 
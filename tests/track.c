@@ -17,8 +17,10 @@
  *
  */
 
+#include <poll.h>
 #include <stdio.h>
 
+#include "metrics.h"
 #include "rig.h"
 #include "thread.h"
 #include "track.h"
@@ -27,6 +29,22 @@
  * Self-contained manual test of a track import operation
  */
 
+#define HUGE_PAGE ((size_t)2 << 20)
+
+/*
+ * Return: the memory mapped for each block, in whole huge pages
+ */
+
+static size_t mapped(unsigned int stems)
+{
+    size_t z;
+
+    z = sizeof(struct track_block)
+        + stems * sizeof(((struct track_block*)NULL)->stem[0]);
+
+    return (z + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+}
+
 int main(int argc, char *argv[])
 {
     struct track *track;
@@ -45,9 +63,33 @@ int main(int argc, char *argv[])
     if (track == NULL)
         return -1;
 
-    rig_main();
+    while (track_is_importing(track)) {
+        struct pollfd pe;
+
+        track_pollfd(track, &pe);
+        if (poll(&pe, 1, -1) == -1) {
+            perror("poll");
+            return -1;
+        }
+        track_handle(track);
+    }
+
+    printf("%u blocks of %zu bytes\n", track->blocks, mapped(track->stems));
+
+    if (metric_get(&metric_track_bytes)
+        != (double)track->blocks * mapped(track->stems))
+    {
+        fprintf(stderr, "Mapped size of the track is wrong\n");
+        return -1;
+    }
 
     track_release(track);
+
+    if (metric_get(&metric_track_bytes) != 0.0) {
+        fprintf(stderr, "Track memory was not returned\n");
+        return -1;
+    }
+
     rig_clear();
     thread_global_clear();
 
@@ -22,6 +22,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "thread.h"
 
@@ -82,3 +83,100 @@ void rt_not_allowed()
         abort();
     }
 }
+
+static void* launch(void *x)
+{
+    struct periodic *p = x;
+    struct timespec t;
+
+    if (pthread_mutex_lock(&p->lock) != 0)
+        abort();
+
+    clock_gettime(CLOCK_REALTIME, &t);
+
+    while (!p->finished) {
+        int r;
+
+        if (pthread_mutex_unlock(&p->lock) != 0)
+            abort();
+
+        p->fn();
+
+        if (pthread_mutex_lock(&p->lock) != 0)
+            abort();
+
+        t.tv_sec += p->interval;
+
+        do {
+            r = pthread_cond_timedwait(&p->cond, &p->lock, &t);
+        } while (r == 0 && !p->finished);
+
+        if (r != 0 && r != ETIMEDOUT)
+            abort();
+    }
+
+    if (pthread_mutex_unlock(&p->lock) != 0)
+        abort();
+
+    return NULL;
+}
+
+/*
+ * Start a thread which calls the given function straight away, and
+ * then at the given interval in seconds
+ *
+ * Return: 0 on success, otherwise -1
+ */
+
+int periodic_start(struct periodic *p, void (*fn)(void),
+                   unsigned int interval)
+{
+    int r;
+
+    p->fn = fn;
+    p->interval = interval;
+    p->finished = false;
+
+    if (pthread_mutex_init(&p->lock, NULL) != 0)
+        abort();
+    if (pthread_cond_init(&p->cond, NULL) != 0)
+        abort();
+
+    r = pthread_create(&p->ph, NULL, launch, p);
+    if (r != 0) {
+        errno = r;
+        perror("pthread_create");
+        if (pthread_cond_destroy(&p->cond) != 0)
+            abort();
+        if (pthread_mutex_destroy(&p->lock) != 0)
+            abort();
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Stop the thread, waiting for any call in progress to finish
+ */
+
+void periodic_stop(struct periodic *p)
+{
+    if (pthread_mutex_lock(&p->lock) != 0)
+        abort();
+
+    p->finished = true;
+
+    if (pthread_cond_signal(&p->cond) != 0)
+        abort();
+    if (pthread_mutex_unlock(&p->lock) != 0)
+        abort();
+
+    if (pthread_join(p->ph, NULL) != 0)
+        abort();
+
+    if (pthread_cond_destroy(&p->cond) != 0)
+        abort();
+    if (pthread_mutex_destroy(&p->lock) != 0)
+        abort();
+}
@@ -24,9 +24,28 @@
 #ifndef THREAD_H
 #define THREAD_H
 
+#include <pthread.h>
+#include <stdbool.h>
+
+/* A thread which calls a function at a regular interval */
+
+struct periodic {
+    void (*fn)(void);
+    unsigned int interval; /* seconds */
+
+    pthread_t ph;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool finished;
+};
+
 int thread_global_init(void);
 void thread_global_clear(void);
 void thread_to_realtime(void);
 void rt_not_allowed();
 
+int periodic_start(struct periodic *p, void (*fn)(void),
+                   unsigned int interval);
+void periodic_stop(struct periodic *p);
+
 #endif
@@ -19,6 +19,7 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,11 +27,33 @@
 
 #include "debug.h"
 #include "timecoder.h"
+#include "trace.h"
 
 #define ZERO_THRESHOLD (128 << 16)
 
 #define ZERO_RC 0.001 /* time constant for zero/rumble filter */
 
+/* The threshold for crossing the axis is adjusted to the input, but
+ * begins at ZERO_THRESHOLD. Timecode is recognised by the rotation of
+ * the signal, which noise and hum do not have. The threshold is set
+ * above the level of the noise, but kept low enough to see the
+ * timecode */
+
+#define LEVEL_RC 0.02 /* decay of the envelope */
+#define SIGNAL_RC 0.05
+#define NOISE_RC 0.5
+
+#define NOISE_MARGIN 2.0 /* approx +6dB */
+#define SIGNAL_MARGIN 0.5 /* approx -6dB */
+#define MIN_THRESHOLD (1 << 16)
+
+/* The proportion of movement which must be in a consistent direction
+ * for the signal to be considered as timecode; with hysteresis */
+
+#define COHERENCE_RC 0.02
+#define PRESENT_ON 0.3
+#define PRESENT_OFF 0.1
+
 #define REF_PEAKS_AVG 48 /* in wave cycles */
 
 /* The number of correct bits which come in before the timecode is
@@ -41,15 +64,22 @@
 
 #define MONITOR_DECAY_EVERY 512 /* in samples */
 
+/* Samples are processed in blocks so that the phase of the signal
+ * can be calculated in a tight loop which the compiler can vectorise */
+
+#define PHASE_BLOCK 64 /* in samples */
+
+/* Above this sample rate the input is decimated before decoding;
+ * there is nothing to gain from the extra bandwidth but the cost of
+ * decoding every sample */
+
+#define DECIMATE_RATE 44100
+
 #define SQ(x) ((x)*(x))
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
 
 /* Timecode definitions */
 
-#define SWITCH_PHASE 0x1 /* tone phase difference of 270 (not 90) degrees */
-#define SWITCH_PRIMARY 0x2 /* use left channel (not right) as primary */
-#define SWITCH_POLARITY 0x4 /* read bit values in negative (not positive) */
-
 static struct timecode_def timecodes[] = {
     {
         .name = "serato_2a",
@@ -283,10 +313,15 @@ void timecoder_free_lookup(void) {
  * Initialise filter values for one channel
  */
 
-static void init_channel(struct timecoder_channel *ch)
+static void init_channel(struct timecoder_channel *ch, signed int threshold)
 {
     ch->positive = false;
     ch->zero = 0;
+
+    ch->level = 0.0;
+    ch->signal = 0.0;
+    ch->noise = threshold / NOISE_MARGIN;
+    ch->threshold = threshold;
 }
 
 /*
@@ -298,6 +333,9 @@ static void init_channel(struct timecoder_channel *ch)
 void timecoder_init(struct timecoder *tc, struct timecode_def *def,
                     double speed, unsigned int sample_rate, bool phono)
 {
+    unsigned int factor;
+    signed int threshold;
+
     assert(def != NULL);
 
     /* A definition contains a lookup table which can be shared
@@ -306,25 +344,41 @@ void timecoder_init(struct timecoder *tc, struct timecode_def *def,
     assert(def->lookup);
     tc->def = def;
     tc->speed = speed;
+    tc->sample_rate = sample_rate;
 
-    tc->dt = 1.0 / sample_rate;
-    tc->zero_alpha = tc->dt / (ZERO_RC + tc->dt);
-    tc->threshold = ZERO_THRESHOLD;
+    threshold = ZERO_THRESHOLD;
     if (phono)
-        tc->threshold >>= 5; /* approx -36dB */
+        threshold >>= 5; /* approx -36dB */
 
     tc->forwards = 1;
-    init_channel(&tc->primary);
-    init_channel(&tc->secondary);
-    pitch_init(&tc->pitch, tc->dt);
+    init_channel(&tc->primary, threshold);
+    init_channel(&tc->secondary, threshold);
+    tc->present = false;
+    tc->net = 0.0;
+    tc->gross = 0.0;
+    tc->phase_x = 0.0;
+    tc->phase_y = 0.0;
+    tc->movement = 0.0;
 
     tc->ref_level = INT_MAX;
+    tc->ref_calibrated = false;
     tc->bitstream = 0;
     tc->timecode = 0;
     tc->valid_counter = 0;
     tc->timecode_ticker = 0;
 
+    tc->autodetect = false;
+    tc->detected = NULL;
+
     tc->mon = NULL;
+
+    factor = sample_rate / DECIMATE_RATE;
+    if (factor < 1)
+        factor = 1;
+    if (factor > DECIMATOR_MAX_FACTOR)
+        factor = DECIMATOR_MAX_FACTOR;
+
+    timecoder_set_decimation(tc, factor);
 }
 
 /*
@@ -336,6 +390,25 @@ void timecoder_clear(struct timecoder *tc)
     assert(tc->mon == NULL);
 }
 
+/*
+ * Set the factor by which input is decimated before it is decoded
+ *
+ * This is chosen automatically from the sample rate, but can be set
+ * explicitly; eg. for comparison. The values which depend on the rate
+ * of decoding are recalculated.
+ *
+ * Pre: factor is between 1 and DECIMATOR_MAX_FACTOR
+ */
+
+void timecoder_set_decimation(struct timecoder *tc, unsigned int factor)
+{
+    decimator_init(&tc->decimator, factor);
+
+    tc->dt = (double)factor / tc->sample_rate;
+    tc->zero_alpha = tc->dt / (ZERO_RC + tc->dt);
+    pitch_init(&tc->pitch, tc->dt, factor);
+}
+
 /*
  * Initialise a raster display of the incoming audio
  *
@@ -375,17 +448,16 @@ void timecoder_monitor_clear(struct timecoder *tc)
  */
 
 static void detect_zero_crossing(struct timecoder_channel *ch,
-                                 signed int v, double alpha,
-                                 signed int threshold)
+                                 signed int v, double alpha)
 {
     ch->crossing_ticker++;
 
     ch->swapped = false;
-    if (v > ch->zero + threshold && !ch->positive) {
+    if (v > ch->zero + ch->threshold && !ch->positive) {
         ch->swapped = true;
         ch->positive = true;
         ch->crossing_ticker = 0;
-    } else if (v < ch->zero - threshold && ch->positive) {
+    } else if (v < ch->zero - ch->threshold && ch->positive) {
         ch->swapped = true;
         ch->positive = false;
         ch->crossing_ticker = 0;
@@ -394,6 +466,192 @@ static void detect_zero_crossing(struct timecoder_channel *ch,
     ch->zero += alpha * (v - ch->zero);
 }
 
+/*
+ * Approximation to atan2(), accurate to about 0.0001 radians
+ *
+ * Much cheaper than the libm function and has no data dependent
+ * branches, so it can be vectorised.
+ */
+
+static inline float fast_atan2(float y, float x)
+{
+    float ax, ay, a, s, r;
+
+    ax = fabsf(x);
+    ay = fabsf(y);
+
+    a = fminf(ax, ay) / (fmaxf(ax, ay) + 1e-20f);
+    s = a * a;
+    r = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * a + a;
+
+    r = (ay > ax) ? 1.57079637f - r : r;
+    r = (x < 0) ? 3.14159274f - r : r;
+    r = (y < 0) ? -r : r;
+
+    return r;
+}
+
+/*
+ * Calculate the rotation of the signal for each sample in a block
+ *
+ * The two channels of the timecode are in quadrature, so each sample
+ * is a point rotating around the origin once per wave cycle. The
+ * angle between successive points gives the movement in that sample,
+ * continuously rather than only at each zero crossing.
+ *
+ * The input values are relative to the zero (DC offset) of each
+ * channel.
+ *
+ * Post: dx contains the movement of each sample, in wave cycles
+ */
+
+static void calculate_phase(const float *x, const float *y, float *dx,
+                            size_t n, float px, float py)
+{
+    size_t s;
+
+    for (s = 0; s < n; s++) {
+        float cross, dot;
+
+        cross = px * y[s] - py * x[s];
+        dot = px * x[s] + py * y[s];
+
+        dx[s] = fast_atan2(cross, dot) * (float)(0.5 / M_PI);
+
+        px = x[s];
+        py = y[s];
+    }
+}
+
+/*
+ * Discard the movement where the signal is below the noise threshold
+ *
+ * Post: dx is zero where the movement is unknown
+ */
+
+static void gate_phase(const float *x, const float *y, float *dx,
+                       size_t n, float threshold)
+{
+    size_t s;
+    float min;
+
+    min = threshold * threshold;
+
+    for (s = 0; s < n; s++) {
+        float mag;
+
+        mag = x[s] * x[s] + y[s] * y[s];
+        dx[s] = (mag > min) ? dx[s] : 0.0f;
+    }
+}
+
+/*
+ * Return: the largest magnitude in a block of samples
+ */
+
+static float block_peak(const float *x, size_t n)
+{
+    size_t s;
+    float peak;
+
+    peak = 0.0f;
+
+    for (s = 0; s < n; s++)
+        peak = fmaxf(peak, fabsf(x[s]));
+
+    return peak;
+}
+
+/*
+ * Update the level estimates of a channel, and its threshold
+ *
+ * The envelope rises immediately to the peak of the block. Its level
+ * is attributed to the timecode or to the noise floor, depending on
+ * whether timecode is present.
+ */
+
+static void calibrate_channel(struct timecoder_channel *ch, float peak,
+                              double t, bool present)
+{
+    float threshold;
+
+    if (peak > ch->level)
+        ch->level = peak;
+    else
+        ch->level += (peak - ch->level) * t / (LEVEL_RC + t);
+
+    if (present) {
+        if (ch->signal == 0.0)
+            ch->signal = ch->level;
+        else
+            ch->signal += (ch->level - ch->signal) * t / (SIGNAL_RC + t);
+    } else {
+        ch->noise += (ch->level - ch->noise) * t / (NOISE_RC + t);
+    }
+
+    threshold = ch->noise * NOISE_MARGIN;
+
+    if (ch->signal != 0.0 && threshold > ch->signal * SIGNAL_MARGIN)
+        threshold = ch->signal * SIGNAL_MARGIN;
+
+    if (threshold < MIN_THRESHOLD)
+        threshold = MIN_THRESHOLD;
+
+    ch->threshold = threshold;
+}
+
+/*
+ * Calibrate to the level of the incoming signal
+ *
+ * The timecode is present if the signal rotates consistently in one
+ * direction. When it is first present, the reference level for
+ * reading bits is brought into range of the signal.
+ */
+
+static void calibrate(struct timecoder *tc, const float *x, const float *y,
+                      const float *dx, size_t n)
+{
+    size_t s;
+    float sum, total, coherence;
+    double t, alpha;
+
+    sum = 0.0f;
+    total = 0.0f;
+
+    for (s = 0; s < n; s++) {
+        sum += dx[s];
+        total += fabsf(dx[s]);
+    }
+
+    t = n * tc->dt;
+    alpha = t / (COHERENCE_RC + t);
+
+    tc->net += (sum - tc->net) * alpha;
+    tc->gross += (total - tc->gross) * alpha;
+
+    coherence = (tc->gross > 0.0f) ? fabsf(tc->net) / tc->gross : 0.0f;
+
+    if (coherence > PRESENT_ON)
+        tc->present = true;
+    else if (coherence < PRESENT_OFF)
+        tc->present = false;
+    calibrate_channel(&tc->primary, block_peak(x, n), t, tc->present);
+    calibrate_channel(&tc->secondary, block_peak(y, n), t, tc->present);
+
+    /* The reference level otherwise takes many cycles to settle from
+     * its previous value. Bits are compared against half the sample
+     * (see process_sample()) so the peak is halved to that scale, and
+     * the reference starts at three quarters of it, near where it
+     * settles between the peaks of 0 and 1 bits */
+
+    if (!tc->present) {
+        tc->ref_calibrated = false;
+    } else if (!tc->ref_calibrated) {
+        tc->ref_level = tc->primary.signal / 2 * 3 / 4;
+        tc->ref_calibrated = true;
+    }
+}
+
 /*
  * Plot the given sample value in the x-y monitor
  */
@@ -431,6 +689,31 @@ static void update_monitor(struct timecoder *tc, signed int x, signed int y)
     tc->mon[py * size + px] = 0xff; /* white */
 }
 
+/*
+ * Work out the direction of the vinyl from an axis crossing
+ *
+ * Return: true if the crossing indicates forwards movement
+ * Pre: one of the channels has just crossed the axis
+ */
+
+static bool crossing_direction(const struct timecoder_channel *primary,
+                               const struct timecoder_channel *secondary,
+                               int flags)
+{
+    bool forwards;
+
+    if (primary->swapped) {
+        forwards = (primary->positive != secondary->positive);
+    } else {
+        forwards = (primary->positive == secondary->positive);
+    }
+
+    if (flags & SWITCH_PHASE)
+        forwards = !forwards;
+
+    return forwards;
+}
+
 /*
  * Extract the bitstream from the sample value
  */
@@ -460,9 +743,13 @@ static void process_bitstream(struct timecoder *tc, signed int m)
 	tc->bitstream = ((tc->bitstream << 1) & mask) + b;
     }
 
-    if (tc->timecode == tc->bitstream)
+    if (tc->timecode == tc->bitstream) {
 	tc->valid_counter++;
-    else {
+	if (tc->valid_counter == VALID_BITS + 1)
+	    TRACE(timecoder_lock, tc, tc->bitstream);
+    } else {
+	if (tc->valid_counter > VALID_BITS)
+	    TRACE(timecoder_unlock, tc, tc->bitstream);
 	tc->timecode = tc->bitstream;
 	tc->valid_counter = 0;
     }
@@ -483,6 +770,128 @@ static void process_bitstream(struct timecoder *tc, signed int m)
 	  tc->valid_counter);
 }
 
+/*
+ * Initialise the matcher for one candidate timecode definition
+ */
+
+static void init_match(struct timecoder_match *m)
+{
+    m->forwards = true;
+    m->bitstream = 0;
+    m->timecode = 0;
+    m->valid_counter = 0;
+    m->ref_level = INT_MAX;
+}
+
+/*
+ * Add a bit to a candidate's bitstream and check it against the LFSR
+ *
+ * As process_bitstream(), but without the side effects on the decoder.
+ */
+
+static void match_bit(struct timecoder_match *m, struct timecode_def *def,
+                      signed int level)
+{
+    bits_t b;
+
+    b = level > m->ref_level;
+
+    if (m->forwards) {
+        m->timecode = fwd(m->timecode, def);
+        m->bitstream = (m->bitstream >> 1) + (b << (def->bits - 1));
+    } else {
+        bits_t mask;
+
+        mask = ((1 << def->bits) - 1);
+        m->timecode = rev(m->timecode, def);
+        m->bitstream = ((m->bitstream << 1) & mask) + b;
+    }
+
+    if (m->timecode == m->bitstream) {
+        m->valid_counter++;
+    } else {
+        m->timecode = m->bitstream;
+        m->valid_counter = 0;
+    }
+
+    m->ref_level -= m->ref_level / REF_PEAKS_AVG;
+    m->ref_level += level / REF_PEAKS_AVG;
+}
+
+/*
+ * Return: true if the decoder has a position from the timecode
+ */
+
+static bool has_position(struct timecoder *tc)
+{
+    if (tc->valid_counter <= VALID_BITS)
+        return false;
+
+    return lut_lookup(&tc->def->lut, tc->bitstream) != (unsigned)-1;
+}
+
+/*
+ * Run the bitstream of every timecode definition against the incoming
+ * signal, looking for one which is valid
+ *
+ * The work is done only on an axis crossing, and is a few operations
+ * for each definition; no lookup tables are needed. A definition
+ * which validates when the decoder has no position is noted for
+ * timecoder_commit_detected(), which builds its lookup table outside
+ * of the realtime thread.
+ */
+
+static void detect_definition(struct timecoder *tc,
+                              signed int primary, signed int secondary)
+{
+    unsigned int n;
+
+    if (!tc->primary.swapped && !tc->secondary.swapped)
+        return;
+
+    for (n = 0; n < ARRAY_SIZE(timecodes); n++) {
+        struct timecode_def *def = &timecodes[n];
+        struct timecoder_match *m = &tc->match[n];
+        const struct timecoder_channel *p, *s;
+        signed int v;
+        bool forwards;
+
+        /* The candidate may use the other channel as its primary */
+
+        if ((def->flags ^ tc->def->flags) & SWITCH_PRIMARY) {
+            p = &tc->secondary;
+            s = &tc->primary;
+            v = secondary;
+        } else {
+            p = &tc->primary;
+            s = &tc->secondary;
+            v = primary;
+        }
+
+        forwards = crossing_direction(p, s, def->flags);
+        if (forwards != m->forwards) {
+            m->forwards = forwards;
+            m->valid_counter = 0;
+        }
+
+        if (!s->swapped)
+            continue;
+        if (p->positive != ((def->flags & SWITCH_POLARITY) == 0))
+            continue;
+
+        match_bit(m, def, abs(v / 2 - p->zero / 2));
+
+        /* A bitstream of zeroes is valid in any LFSR, and is what is
+         * read before the reference level has settled */
+
+        if (m->valid_counter > VALID_BITS && m->bitstream != 0
+            && def != tc->def && tc->detected == NULL && !has_position(tc))
+        {
+            tc->detected = def;
+        }
+    }
+}
+
 /*
  * Process a single sample from the incoming audio
  *
@@ -493,8 +902,8 @@ static void process_bitstream(struct timecoder *tc, signed int m)
 static void process_sample(struct timecoder *tc,
 			   signed int primary, signed int secondary)
 {
-    detect_zero_crossing(&tc->primary, primary, tc->zero_alpha, tc->threshold);
-    detect_zero_crossing(&tc->secondary, secondary, tc->zero_alpha, tc->threshold);
+    detect_zero_crossing(&tc->primary, primary, tc->zero_alpha);
+    detect_zero_crossing(&tc->secondary, secondary, tc->zero_alpha);
 
     /* If an axis has been crossed, use the direction of the crossing
      * to work out the direction of the vinyl */
@@ -502,14 +911,8 @@ static void process_sample(struct timecoder *tc,
     if (tc->primary.swapped || tc->secondary.swapped) {
         bool forwards;
 
-        if (tc->primary.swapped) {
-            forwards = (tc->primary.positive != tc->secondary.positive);
-        } else {
-            forwards = (tc->primary.positive == tc->secondary.positive);
-        }
-
-        if (tc->def->flags & SWITCH_PHASE)
-	    forwards = !forwards;
+        forwards = crossing_direction(&tc->primary, &tc->secondary,
+                                      tc->def->flags);
 
         if (forwards != tc->forwards) { /* direction has changed */
             tc->forwards = forwards;
@@ -517,20 +920,6 @@ static void process_sample(struct timecoder *tc,
         }
     }
 
-    /* If any axis has been crossed, register movement using the pitch
-     * counters */
-
-    if (!tc->primary.swapped && !tc->secondary.swapped)
-	pitch_dt_observation(&tc->pitch, 0.0);
-    else {
-	double dx;
-
-	dx = 1.0 / tc->def->resolution / 4;
-	if (!tc->forwards)
-	    dx = -dx;
-	pitch_dt_observation(&tc->pitch, dx);
-    }
-
     /* If we have crossed the primary channel in the right polarity,
      * it's time to read off a timecode 0 or 1 value */
 
@@ -544,6 +933,9 @@ static void process_sample(struct timecoder *tc,
 	process_bitstream(tc, m);
     }
 
+    if (tc->autodetect)
+        detect_definition(tc, primary, secondary);
+
     tc->timecode_ticker++;
 }
 
@@ -569,14 +961,203 @@ static struct timecode_def* next_definition(struct timecode_def *def)
 }
 
 /*
- * Change the timecode definition to the next available
+ * Switch the decoder to the given timecode definition
  */
 
-void timecoder_cycle_definition(struct timecoder *tc)
+static void set_definition(struct timecoder *tc, struct timecode_def *def)
 {
-    tc->def = next_definition(tc->def);
+    tc->def = def;
     tc->valid_counter = 0;
     tc->timecode_ticker = 0;
+    tc->movement = 0.0;
+    tc->ref_calibrated = false;
+}
+
+/*
+ * Change the timecode definition to the next available
+ */
+
+void timecoder_cycle_definition(struct timecoder *tc)
+{
+    set_definition(tc, next_definition(tc->def));
+}
+
+/*
+ * Change the timecode definition, eg. to one restored from a session
+ *
+ * Pre: def has a lookup table, see timecoder_find_definition()
+ */
+
+void timecoder_set_definition(struct timecoder *tc, struct timecode_def *def)
+{
+    assert(def->lookup);
+    set_definition(tc, def);
+}
+
+/*
+ * Enable or disable automatic detection of the timecode definition
+ *
+ * When enabled, all the known definitions are matched against the
+ * incoming signal and the decoder switches to any that is found,
+ * through timecoder_commit_detected().
+ */
+
+void timecoder_set_autodetect(struct timecoder *tc, bool autodetect)
+{
+    unsigned int n;
+
+    assert(ARRAY_SIZE(timecodes) <= TIMECODER_MAX_DEFINITIONS);
+
+    for (n = 0; n < ARRAY_SIZE(timecodes); n++)
+        init_match(&tc->match[n]);
+
+    tc->detected = NULL;
+    tc->autodetect = autodetect;
+}
+
+/*
+ * Switch to a timecode definition which has been detected
+ *
+ * Definitions which share an LFSR (eg. both sides of a record) can't
+ * be told apart from the bitstream alone; the lookup tables are used
+ * to see which one contains this part of the timecode. Lookup tables
+ * are built here, as needed.
+ *
+ * Return: the definition switched to, or NULL if no change was made
+ */
+
+struct timecode_def* timecoder_commit_detected(struct timecoder *tc)
+{
+    struct timecode_def *def, *d;
+    struct timecoder_match *m;
+    bits_t bitstream;
+
+    def = tc->detected;
+    if (def == NULL)
+        return NULL;
+
+    /* The candidate may have lost its lock since it was noted */
+
+    m = &tc->match[def - timecodes];
+    bitstream = m->bitstream;
+
+    if (m->valid_counter <= VALID_BITS) {
+        tc->detected = NULL;
+        return NULL;
+    }
+
+    for (d = timecodes; d < timecodes + ARRAY_SIZE(timecodes); d++) {
+        if (d->bits != def->bits || d->taps != def->taps
+            || d->flags != def->flags)
+        {
+            continue;
+        }
+
+        if (build_lookup(d) == -1)
+            break;
+
+        if (lut_lookup(&d->lut, bitstream) == (unsigned)-1)
+            continue;
+
+        if (d == tc->def)
+            break;
+
+        set_definition(tc, d);
+        tc->detected = NULL;
+        return d;
+    }
+
+    tc->detected = NULL;
+    return NULL;
+}
+
+/*
+ * Register the movement in a block of samples using the pitch filter
+ */
+
+static void observe_block(struct timecoder *tc, const float *x,
+                          const float *y, size_t n)
+{
+    size_t s;
+    float dx[PHASE_BLOCK];
+    double direction, scale;
+
+    assert(n > 0);
+    calculate_phase(x, y, dx, n, tc->phase_x, tc->phase_y);
+    calibrate(tc, x, y, dx, n);
+    gate_phase(x, y, dx, n, fmaxf(tc->primary.threshold,
+                                  tc->secondary.threshold));
+
+    tc->phase_x = x[n - 1];
+    tc->phase_y = y[n - 1];
+
+    /* Rotation is in the direction of the timecode, unless the
+     * phase of the tones is reversed */
+
+    direction = (tc->def->flags & SWITCH_PHASE) ? -1.0 : 1.0;
+
+    /* Convert from wave cycles to seconds at the reference speed */
+
+    scale = direction / tc->def->resolution;
+
+    for (s = 0; s < n; s++)
+        pitch_dt_observation(&tc->pitch, dx[s] * scale);
+
+    /* Accumulate the movement since the last timecode was read, which
+     * may have been part way through this block */
+
+    if (tc->timecode_ticker < n) {
+        s = n - tc->timecode_ticker;
+        tc->movement = 0.0;
+    } else {
+        s = 0;
+    }
+
+    for (; s < n; s++)
+        tc->movement += dx[s] * direction;
+}
+
+/*
+ * Decode a block of PCM audio at the decoding sample rate
+ */
+
+static void decode(struct timecoder *tc, const signed short *pcm, size_t npcm)
+{
+    while (npcm > 0) {
+        size_t n, s;
+        float x[PHASE_BLOCK], y[PHASE_BLOCK];
+
+        n = npcm < PHASE_BLOCK ? npcm : PHASE_BLOCK;
+
+        for (s = 0; s < n; s++) {
+            signed int left, right, primary, secondary;
+
+            left = pcm[0] << 16;
+            right = pcm[1] << 16;
+
+            if (tc->def->flags & SWITCH_PRIMARY) {
+                primary = left;
+                secondary = right;
+            } else {
+                primary = right;
+                secondary = left;
+            }
+
+            process_sample(tc, primary, secondary);
+            update_monitor(tc, left, right);
+
+            /* Keep the signal with its DC offset removed, for the
+             * phase calculation */
+
+            x[s] = (float)primary - tc->primary.zero;
+            y[s] = (float)secondary - tc->secondary.zero;
+
+            pcm += TIMECODER_CHANNELS;
+        }
+
+        observe_block(tc, x, y, n);
+        npcm -= n;
+    }
 }
 
 /*
@@ -587,24 +1168,25 @@ void timecoder_cycle_definition(struct timecoder *tc)
 
 void timecoder_submit(struct timecoder *tc, signed short *pcm, size_t npcm)
 {
-    while (npcm--) {
-	signed int left, right, primary, secondary;
+    struct decimator *d = &tc->decimator;
+
+    if (d->factor == 1) {
+        decode(tc, pcm, npcm);
+        return;
+    }
 
-        left = pcm[0] << 16;
-        right = pcm[1] << 16;
+    while (npcm > 0) {
+        size_t n, z;
+        signed short out[(DECIMATOR_CHUNK + 1) * TIMECODER_CHANNELS];
 
-        if (tc->def->flags & SWITCH_PRIMARY) {
-            primary = left;
-            secondary = right;
-        } else {
-            primary = right;
-            secondary = left;
-        }
+        n = npcm < DECIMATOR_CHUNK ? npcm : DECIMATOR_CHUNK;
 
-	process_sample(tc, primary, secondary);
-        update_monitor(tc, left, right);
+        z = decimator_run(d, pcm, n, out);
+        assert(z <= decimator_max_output(d));
+        decode(tc, out, z);
 
-        pcm += TIMECODER_CHANNELS;
+        pcm += n * TIMECODER_CHANNELS;
+        npcm -= n;
     }
 }
 
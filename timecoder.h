@@ -22,11 +22,18 @@
 
 #include <stdbool.h>
 
+#include "decimator.h"
 #include "lut.h"
 #include "pitch.h"
 
 #define TIMECODER_CHANNELS 2
 
+#define TIMECODER_MAX_DEFINITIONS 16
+
+#define SWITCH_PHASE 0x1 /* tone phase difference of 270 (not 90) degrees */
+#define SWITCH_PRIMARY 0x2 /* use left channel (not right) as primary */
+#define SWITCH_POLARITY 0x4 /* read bit values in negative (not positive) */
+
 typedef unsigned int bits_t;
 
 struct timecode_def {
@@ -47,30 +54,62 @@ struct timecoder_channel {
 	swapped; /* wave recently swapped polarity */
     signed int zero;
     unsigned int crossing_ticker; /* samples since we last crossed zero */
+
+    /* Calibration of the input level */
+
+    float level, /* envelope of the input */
+        signal, /* level when timecode is present, or zero if unknown */
+        noise; /* level when timecode is absent */
+    signed int threshold; /* for crossing the axis, either side of zero */
+};
+
+/* Lightweight decoder of the bitstream, used to recognise a timecode
+ * without its lookup table */
+
+struct timecoder_match {
+    bool forwards;
+    bits_t bitstream, timecode;
+    unsigned int valid_counter;
+    signed int ref_level;
 };
 
 struct timecoder {
     struct timecode_def *def;
     double speed;
+    unsigned int sample_rate;
+
+    /* Input at high sample rates is reduced before decoding */
+
+    struct decimator decimator;
 
     /* Precomputed values */
 
     double dt, zero_alpha;
-    signed int threshold;
 
     /* Pitch information */
 
     bool forwards;
     struct timecoder_channel primary, secondary;
+    bool present; /* signal is rotating as timecode does */
+    float net, gross; /* recent rotation of the signal, in wave cycles */
     struct pitch pitch;
+    float phase_x, phase_y; /* last sample, for calculating rotation */
 
     /* Numerical timecode */
 
     signed int ref_level;
+    bool ref_calibrated;
     bits_t bitstream, /* actual bits from the record */
         timecode; /* corrected timecode */
     unsigned int valid_counter, /* number of successful error checks */
         timecode_ticker; /* samples since valid timecode was read */
+    double movement; /* wave cycles since valid timecode was read */
+
+    /* Automatic detection of the timecode definition */
+
+    bool autodetect;
+    struct timecoder_match match[TIMECODER_MAX_DEFINITIONS];
+    struct timecode_def *detected; /* candidate awaiting its lookup table */
 
     /* Feedback */
 
@@ -84,11 +123,15 @@ void timecoder_free_lookup(void);
 void timecoder_init(struct timecoder *tc, struct timecode_def *def,
                     double speed, unsigned int sample_rate, bool phono);
 void timecoder_clear(struct timecoder *tc);
+void timecoder_set_decimation(struct timecoder *tc, unsigned int factor);
 
 int timecoder_monitor_init(struct timecoder *tc, int size);
 void timecoder_monitor_clear(struct timecoder *tc);
 
 void timecoder_cycle_definition(struct timecoder *tc);
+void timecoder_set_definition(struct timecoder *tc, struct timecode_def *def);
+void timecoder_set_autodetect(struct timecoder *tc, bool autodetect);
+struct timecode_def* timecoder_commit_detected(struct timecoder *tc);
 void timecoder_submit(struct timecoder *tc, signed short *pcm, size_t npcm);
 signed int timecoder_get_position(struct timecoder *tc, double *when);
 
@@ -131,6 +174,17 @@ static inline double timecoder_get_resolution(struct timecoder *tc)
     return tc->def->resolution * tc->speed;
 }
 
+/*
+ * Return the distance moved since the last timecode was read, in
+ * seconds at the reference playback speed. Measured from the phase of
+ * the signal, so it is not quantised to whole wave cycles.
+ */
+
+static inline double timecoder_get_movement(struct timecoder *tc)
+{
+    return tc->movement / timecoder_get_resolution(tc);
+}
+
 /*
  * The number of revolutions per second of the timecode vinyl,
  * used only for visual display
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Static tracepoints
+ *
+ * Marks points in the audio and import paths for an external tracer
+ * (perf, bpftrace, SystemTap) to record; see the trace-timeline
+ * script. Each probe carries two integer arguments, usually the
+ * object concerned and a value.
+ *
+ * Without -DWITH_SDT the probes compile to nothing. With it, each is
+ * a single no-op instruction until a tracer attaches.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef WITH_SDT
+
+#include <sys/sdt.h>
+
+#define TRACE(name, a, b) DTRACE_PROBE2(xwax, name, a, b)
+
+#else
+
+#define TRACE(name, a, b)
+
+#endif
+
+#endif
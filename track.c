@@ -19,18 +19,24 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <sys/types.h>
 #include <sys/wait.h>
-#include <sys/mman.h> /* mlock() */
+#include <sys/mman.h> /* mlock(), mmap() */
 
 #include "debug.h"
 #include "external.h"
 #include "list.h"
+#include "metrics.h"
 #include "realtime.h"
 #include "rig.h"
 #include "status.h"
+#include "trace.h"
 #include "track.h"
 
 #define RATE 44100
@@ -38,6 +44,27 @@
 #define SAMPLE (sizeof(signed short) * TRACK_CHANNELS) /* bytes per sample */
 #define TRACK_BLOCK_PCM_BYTES (TRACK_BLOCK_SAMPLES * SAMPLE)
 
+/* Blocks are mapped in whole huge pages, so the meters at the end of
+ * a block can cost up to one huge page more */
+
+#define HUGE_PAGE ((size_t)2 << 20)
+#define HUGE_ROUND(x) (((x) + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1))
+
+#define BLOCK_SIZE(stems) (sizeof(struct track_block) \
+                           + (stems) * TRACK_BLOCK_PCM_BYTES)
+#define BLOCK_BYTES(stems) HUGE_ROUND(BLOCK_SIZE(stems))
+
+#define STEMS_SUFFIX ".stem.mp4"
+#define STEMS_HEADER "stems " STR(TRACK_MAX_STEMS) "\n"
+#define MIX_HEADER "stems " STR(TRACK_MAX_STEMS) " mix\n"
+#define STAGING 4096 /* frames of the mix and all stems */
+
+#ifdef COMPAT_METERS
+#define WINDOW METER_COMPAT_WINDOW
+#else
+#define WINDOW METER_WINDOW
+#endif
+
 #define _STR(tok) #tok
 #define STR(tok) _STR(tok)
 
@@ -70,6 +97,95 @@ void track_use_mlock(void)
     use_mlock = true;
 }
 
+/*
+ * Map memory for a block, aligned to huge pages and asking for them
+ * to be used
+ *
+ * Return: pointer to the memory, or NULL on error
+ */
+
+static void* map_transparent(size_t size)
+{
+    char *p, *aligned, *end;
+    size_t bytes, huge;
+
+    bytes = HUGE_ROUND(size);
+
+    p = mmap(NULL, bytes + HUGE_PAGE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+
+    /* Trim the mapping to the aligned part */
+
+    aligned = (char*)HUGE_ROUND((uintptr_t)p);
+    end = p + bytes + HUGE_PAGE;
+
+    if (aligned != p && munmap(p, aligned - p) == -1)
+        abort();
+    if (munmap(aligned + bytes, end - aligned - bytes) == -1)
+        abort();
+
+    /* Only the audio fills whole huge pages. The advice is ignored
+     * by kernels without transparent huge pages */
+
+    huge = size & ~(HUGE_PAGE - 1);
+    (void)madvise(aligned, huge, MADV_HUGEPAGE);
+    (void)madvise(aligned + huge, bytes - huge, MADV_NOHUGEPAGE);
+
+    return aligned;
+}
+
+/*
+ * Allocate a block for audio, from huge pages where possible so that
+ * playback takes fewer misses of the TLB
+ *
+ * Explicit huge pages (see hugetlbpage in the kernel documentation)
+ * are used first, if the system has any reserved, otherwise
+ * transparent huge pages.
+ *
+ * Return: pointer to block, or NULL on error
+ * Post: if track_use_mlock() was called, the block is in RAM
+ */
+
+struct track_block* track_block_alloc(unsigned int stems)
+{
+    void *p;
+
+    assert(stems <= TRACK_MAX_STEMS);
+
+    p = mmap(NULL, BLOCK_BYTES(stems), PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p == MAP_FAILED) {
+        p = map_transparent(BLOCK_SIZE(stems));
+        if (p == NULL)
+            return NULL;
+    }
+
+    /* Locking also faults in every page, so the realtime thread
+     * never waits on the kernel to play new audio */
+
+    if (use_mlock && mlock(p, BLOCK_SIZE(stems)) == -1) {
+        perror("mlock");
+        track_block_free(p, stems);
+        return NULL;
+    }
+
+    return p;
+}
+
+/*
+ * Pre: block was allocated with the given number of stems
+ */
+
+void track_block_free(struct track_block *b, unsigned int stems)
+{
+    if (munmap(b, BLOCK_BYTES(stems)) == -1)
+        abort();
+}
+
 /*
  * Allocate more memory
  *
@@ -87,25 +203,18 @@ static int more_space(struct track *tr)
         return -1;
     }
 
-    block = malloc(sizeof(struct track_block));
-    if (block == NULL) {
-        perror("malloc");
-        return -1;
-    }
-
-    if (use_mlock && mlock(block, sizeof(struct track_block)) == -1) {
-        perror("mlock");
-        free(block);
+    block = track_block_alloc(tr->stems);
+    if (block == NULL)
         return -1;
-    }
 
     /* No memory barrier is needed here, because nobody else tries to
      * access these blocks until tr->length is actually incremented */
 
     tr->block[tr->blocks++] = block;
+    metric_add(&metric_track_bytes, BLOCK_BYTES(tr->stems));
 
     debug("allocated new track block (%d blocks, %zu bytes)",
-          tr->blocks, tr->blocks * TRACK_BLOCK_SAMPLES * SAMPLE);
+          tr->blocks, tr->blocks * BLOCK_BYTES(tr->stems));
 
     return 0;
 }
@@ -143,48 +252,15 @@ static void* access_pcm(struct track *tr, size_t *len)
 
 static void commit_pcm_samples(struct track *tr, unsigned int samples)
 {
-    unsigned int fill, n;
-    signed short *pcm;
+    unsigned int fill;
     struct track_block *block;
 
     block = tr->block[tr->length / TRACK_BLOCK_SAMPLES];
     fill = tr->length % TRACK_BLOCK_SAMPLES;
-    pcm = block->pcm + TRACK_CHANNELS * fill;
 
     assert(samples <= TRACK_BLOCK_SAMPLES - fill);
 
-    /* Meter the new audio */
-
-    for (n = samples; n > 0; n--) {
-        unsigned short v;
-        unsigned int w;
-
-        v = abs(pcm[0]) + abs(pcm[1]);
-
-        /* PPM-style fast meter approximation */
-
-        if (v > tr->ppm)
-            tr->ppm += (v - tr->ppm) >> 3;
-        else
-            tr->ppm -= (tr->ppm - v) >> 9;
-
-        block->ppm[fill / TRACK_PPM_RES] = tr->ppm >> 8;
-
-        /* Update the slow-metering overview. Fixed point arithmetic
-         * going on here */
-
-        w = v << 16;
-
-        if (w > tr->overview)
-            tr->overview += (w - tr->overview) >> 8;
-        else
-            tr->overview -= (tr->overview - w) >> 17;
-
-        block->overview[fill / TRACK_OVERVIEW_RES] = tr->overview >> 24;
-
-        fill++;
-        pcm += TRACK_CHANNELS;
-    }
+    meter_commit(&tr->meter, block, fill, samples);
 
     /* Increment the track length. A memory barrier ensures the
      * realtime or UI thread does not access garbage audio */
@@ -201,10 +277,82 @@ static void commit_pcm_samples(struct track *tr, unsigned int samples)
 
 static void commit(struct track *tr, size_t len)
 {
+    TRACE(track_import_chunk, tr, len);
+    metric_add(&metric_import_bytes, len);
     tr->bytes += len;
     commit_pcm_samples(tr, tr->bytes / SAMPLE - tr->length);
 }
 
+/*
+ * Split whole frames of all stems from the staging area into the
+ * planes of the current block
+ *
+ * The stereo mix is taken from the importer where it gives one,
+ * otherwise the stems are summed to it.
+ */
+
+static void split_stems(struct track *tr, const signed short *in,
+                        unsigned int frames)
+{
+    unsigned int n, s, c, fill;
+    struct track_block *block;
+    signed short *mix;
+
+    block = tr->block[tr->length / TRACK_BLOCK_SAMPLES];
+    fill = tr->length % TRACK_BLOCK_SAMPLES;
+
+    assert(frames <= TRACK_BLOCK_SAMPLES - fill);
+
+    mix = block->pcm + fill * TRACK_CHANNELS;
+
+    for (n = 0; n < frames; n++) {
+        const signed short *stem;
+
+        stem = tr->mix ? in + TRACK_CHANNELS : in;
+
+        for (c = 0; c < TRACK_CHANNELS; c++) {
+            int v;
+
+            v = 0;
+            for (s = 0; s < tr->stems; s++) {
+                signed short x;
+
+                x = stem[s * TRACK_CHANNELS + c];
+                block->stem[s][(fill + n) * TRACK_CHANNELS + c] = x;
+                v += x;
+            }
+
+            if (tr->mix)
+                v = in[c];
+            else if (v > SHRT_MAX)
+                v = SHRT_MAX;
+            else if (v < SHRT_MIN)
+                v = SHRT_MIN;
+
+            *mix++ = v;
+        }
+
+        in += (tr->mix + tr->stems) * TRACK_CHANNELS;
+    }
+}
+
+/*
+ * Return: true if the file at the given path has stems
+ */
+
+static bool has_stems(const char *path)
+{
+    size_t len, suffix;
+
+    len = strlen(path);
+    suffix = strlen(STEMS_SUFFIX);
+
+    if (len < suffix)
+        return false;
+
+    return strcasecmp(path + len - suffix, STEMS_SUFFIX) == 0;
+}
+
 /*
  * Initialise object which will hold PCM audio data, and start
  * importing the data
@@ -219,13 +367,38 @@ static int track_init(struct track *t, const char *importer, const char *path)
 
     fprintf(stderr, "Importing '%s'...\n", path);
 
-    pid = fork_pipe_nb(&t->fd, importer, "import", path, STR(RATE), NULL);
-    if (pid == -1)
+    /* The importer is asked for all stems of a file which has them,
+     * as one stereo pair after another in each frame, preceded by
+     * the mix if it has one. It confirms this with a header, see
+     * read_stems() */
+
+    if (has_stems(path)) {
+        t->stems = TRACK_MAX_STEMS;
+        t->staging = malloc(STAGING * SAMPLE * (1 + t->stems));
+        if (t->staging == NULL) {
+            perror("malloc");
+            return -1;
+        }
+
+        pid = fork_pipe_nb(&t->fd, importer, "import", path, STR(RATE),
+                           STR(TRACK_MAX_STEMS), NULL);
+    } else {
+        t->stems = 0;
+        t->staging = NULL;
+
+        pid = fork_pipe_nb(&t->fd, importer, "import", path, STR(RATE), NULL);
+    }
+
+    if (pid == -1) {
+        free(t->staging);
         return -1;
+    }
 
     t->pid = pid;
     t->pe = NULL;
     t->terminated = false;
+    clock_gettime(CLOCK_MONOTONIC, &t->started);
+    TRACE(track_import_start, t, pid);
 
     t->refcount = 0;
 
@@ -234,8 +407,10 @@ static int track_init(struct track *t, const char *importer, const char *path)
 
     t->bytes = 0;
     t->length = 0;
-    t->ppm = 0;
-    t->overview = 0;
+    t->staged = 0;
+    t->confirmed = false;
+    t->mix = false;
+    meter_init(&t->meter, WINDOW);
 
     t->importer = importer;
     t->path = path;
@@ -263,7 +438,9 @@ static void track_clear(struct track *tr)
     assert(tr->pid == 0);
 
     for (n = 0; n < tr->blocks; n++)
-        free(tr->block[n]);
+        track_block_free(tr->block[n], tr->stems);
+    metric_add(&metric_track_bytes,
+               -(double)BLOCK_BYTES(tr->stems) * tr->blocks);
 
     list_del(&tr->tracks);
 }
@@ -389,6 +566,166 @@ void track_pollfd(struct track *t, struct pollfd *pe)
     t->pe = pe;
 }
 
+static int read_from_pipe(struct track *tr);
+
+/*
+ * Return: true if the staging area starts with the given header
+ */
+
+static bool has_header(const struct track *tr, const char *header)
+{
+    size_t len;
+
+    len = strlen(header);
+    return tr->staged >= len && !memcmp(tr->staging, header, len);
+}
+
+/*
+ * Read the header by which the importer confirms it is giving stems,
+ * and whether it gives the mix ahead of them
+ *
+ * An importer which does not know of stems gives stereo audio, and
+ * the track is imported as that.
+ *
+ * Return: 1 if confirmed, otherwise as read_from_pipe()
+ */
+
+static int confirm_stems(struct track *tr)
+{
+    size_t len;
+    void *pcm;
+
+    /* Enough for the longer header; anything after the header is
+     * the start of the audio */
+
+    len = strlen(MIX_HEADER);
+
+    while (tr->staged < len) {
+        ssize_t z;
+
+        z = read(tr->fd, tr->staging + tr->staged, len - tr->staged);
+        if (z == -1) {
+            if (errno == EAGAIN) {
+                return 0;
+            } else {
+                perror("read");
+                return -1;
+            }
+        }
+
+        if (z == 0) /* EOF */
+            break;
+
+        tr->staged += z;
+    }
+
+    if (has_header(tr, MIX_HEADER) || has_header(tr, STEMS_HEADER)) {
+        tr->mix = has_header(tr, MIX_HEADER);
+        len = strlen(tr->mix ? MIX_HEADER : STEMS_HEADER);
+
+        tr->staged -= len;
+        memmove(tr->staging, tr->staging + len, tr->staged);
+        tr->bytes += tr->staged;
+        metric_add(&metric_import_bytes, tr->staged);
+
+        tr->confirmed = true;
+        return 1;
+    }
+
+    /* No audio is in the track yet, so it can change to stereo. The
+     * player may already have the track, but reads the number of
+     * stems only once the length is published, see build() */
+
+    __atomic_store_n(&tr->stems, 0, __ATOMIC_RELEASE);
+
+    if (tr->staged > 0) {
+        fprintf(stderr, "Importer gave no stems for '%s'; importing it "
+                "as stereo\n", tr->path);
+        status_printf(STATUS_WARN, "Importer gave no stems for %s",
+                      tr->path);
+
+        pcm = access_pcm(tr, &len);
+        if (pcm == NULL)
+            return -1;
+
+        memcpy(pcm, tr->staging, tr->staged);
+        commit(tr, tr->staged);
+    }
+
+    free(tr->staging);
+    tr->staging = NULL;
+    tr->staged = 0;
+
+    return read_from_pipe(tr);
+}
+
+/*
+ * As read_from_pipe(), for a track with stems
+ *
+ * The frames of all stems are split into the block from a staging
+ * area, which keeps any partial frame for next time.
+ */
+
+static int read_stems(struct track *tr)
+{
+    size_t frame;
+
+    if (!tr->confirmed) {
+        int r;
+
+        r = confirm_stems(tr);
+        if (r != 1)
+            return r;
+    }
+
+    frame = SAMPLE * (tr->mix + tr->stems);
+
+    for (;;) {
+        unsigned int room, frames;
+        size_t len;
+        ssize_t z;
+
+        if (tr->length / TRACK_BLOCK_SAMPLES == tr->blocks) {
+            if (more_space(tr) == -1)
+                return -1;
+        }
+
+        /* Read no more than fits in the current block */
+
+        room = TRACK_BLOCK_SAMPLES - tr->length % TRACK_BLOCK_SAMPLES;
+        if (room > STAGING)
+            room = STAGING;
+        len = room * frame - tr->staged;
+
+        z = read(tr->fd, tr->staging + tr->staged, len);
+        if (z == -1) {
+            if (errno == EAGAIN) {
+                return 0;
+            } else {
+                perror("read");
+                return -1;
+            }
+        }
+
+        if (z == 0) /* EOF */
+            break;
+
+        TRACE(track_import_chunk, tr, z);
+        metric_add(&metric_import_bytes, z);
+        tr->bytes += z;
+        tr->staged += z;
+
+        frames = tr->staged / frame;
+        split_stems(tr, (signed short*)tr->staging, frames);
+        commit_pcm_samples(tr, frames);
+
+        tr->staged -= frames * frame;
+        memmove(tr->staging, tr->staging + frames * frame, tr->staged);
+    }
+
+    return -1; /* completion without error */
+}
+
 /*
  * Read the next block of data from the file handle into the track's
  * PCM data
@@ -398,6 +735,9 @@ void track_pollfd(struct track *t, struct pollfd *pe)
 
 static int read_from_pipe(struct track *tr)
 {
+    if (tr->stems > 0)
+        return read_stems(tr);
+
     for (;;) {
         void *pcm;
         size_t len;
@@ -436,6 +776,7 @@ static int read_from_pipe(struct track *tr)
 static void stop_import(struct track *t)
 {
     int status;
+    struct timespec now;
 
     assert(t->pid != 0);
 
@@ -445,14 +786,26 @@ static void stop_import(struct track *t)
     if (waitpid(t->pid, &status, 0) == -1)
         abort();
 
+    free(t->staging);
+    t->staging = NULL;
+
     if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
         fprintf(stderr, "Track import completed\n");
+        metric_inc(&metric_imports);
     } else {
         fprintf(stderr, "Track import completed with status %d\n", status);
-        if (!t->terminated)
+        if (!t->terminated) {
             status_printf(STATUS_ALERT, "Error importing %s", t->path);
+            metric_inc(&metric_import_failures);
+        }
     }
 
+    TRACE(track_import_end, t, status);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    metric_add(&metric_import_seconds, (now.tv_sec - t->started.tv_sec)
+               + (now.tv_nsec - t->started.tv_nsec) / 1e9);
+
     t->pid = 0;
 }
 
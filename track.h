@@ -23,20 +23,28 @@
 #include <stdbool.h>
 #include <sys/poll.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include "list.h"
+#include "meter.h"
 
 #define TRACK_CHANNELS 2
+#define TRACK_MAX_STEMS 4
 
 #define TRACK_MAX_BLOCKS 64
 #define TRACK_BLOCK_SAMPLES (2048 * 1024)
 #define TRACK_PPM_RES 64
 #define TRACK_OVERVIEW_RES 2048
 
+/* A block holds the stereo mix of the track. Where the track has
+ * stems, each follows in its own plane so that playback reads each
+ * in sequence */
+
 struct track_block {
     signed short pcm[TRACK_BLOCK_SAMPLES * TRACK_CHANNELS];
     unsigned char ppm[TRACK_BLOCK_SAMPLES / TRACK_PPM_RES],
         overview[TRACK_BLOCK_SAMPLES / TRACK_OVERVIEW_RES];
+    signed short stem[][TRACK_BLOCK_SAMPLES * TRACK_CHANNELS];
 };
 
 struct track {
@@ -50,7 +58,8 @@ struct track {
     
     size_t bytes; /* loaded in */
     unsigned int length, /* track length in samples */
-        blocks; /* number of blocks allocated */
+        blocks, /* number of blocks allocated */
+        stems; /* in each block, or 0 for stereo only */
     struct track_block *block[TRACK_MAX_BLOCKS];
 
     /* State of audio import */
@@ -60,15 +69,28 @@ struct track {
     int fd;
     struct pollfd *pe;
     bool terminated;
+    struct timespec started;
+
+    /* Whole frames of all stems are split into the blocks; this holds
+     * the remainder, or the header until it is confirmed */
+
+    char *staging;
+    size_t staged;
+    bool confirmed, /* importer gave the stems header */
+        mix; /* importer gives the mix ahead of the stems */
 
     /* Current value of audio meters when loading */
-    
-    unsigned short ppm;
-    unsigned int overview;
+
+    struct meter meter;
 };
 
 void track_use_mlock(void);
 
+/* Memory for audio */
+
+struct track_block* track_block_alloc(unsigned int stems);
+void track_block_free(struct track_block *b, unsigned int stems);
+
 /* Tracks are dynamically allocated and reference counted */
 
 struct track* track_acquire_by_import(const char *importer, const char *path);
@@ -115,5 +137,14 @@ static inline signed short* track_get_sample(struct track *tr, int s)
     return &b->pcm[(s % TRACK_BLOCK_SAMPLES) * TRACK_CHANNELS];
 }
 
+/* As track_get_sample(), but for one stem */
+
+static inline signed short* track_get_stem(struct track *tr, int stem, int s)
+{
+    struct track_block *b;
+    b = tr->block[s / TRACK_BLOCK_SAMPLES];
+    return &b->stem[stem][(s % TRACK_BLOCK_SAMPLES) * TRACK_CHANNELS];
+}
+
 #endif
 
@@ -0,0 +1,480 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+/*
+ * Minimal streaming parser for XML documents, such as the libraries
+ * exported by other DJ software
+ *
+ * Only elements and their attributes are reported; text, comments,
+ * processing instructions and the document type are skipped. Memory
+ * use is bounded by the largest single tag, not the document.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xml.h"
+
+#define MAX_TAG 1048576
+#define MAX_ATTRS 64
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+struct parser {
+    FILE *f;
+    const char *pathname;
+    unsigned int line;
+
+    char *tag;
+    size_t len, size;
+};
+
+/*
+ * Return: next character of the document, or EOF
+ */
+
+static inline int next(struct parser *p)
+{
+    int c;
+
+    c = getc_unlocked(p->f);
+    if (c == '\n')
+        p->line++;
+
+    return c;
+}
+
+static void error(const struct parser *p, const char *msg)
+{
+    fprintf(stderr, "%s:%u: %s\n", p->pathname, p->line, msg);
+}
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/*
+ * Skip to the end of a construct which is closed by at least n of the
+ * given character then '>', eg. "-->"
+ *
+ * Return: 0 on success, -1 at the end of the document
+ */
+
+static int skip_to(struct parser *p, int ch, unsigned int n)
+{
+    unsigned int run;
+
+    run = 0;
+
+    for (;;) {
+        int c;
+
+        c = next(p);
+        if (c == EOF)
+            return -1;
+
+        if (c == '>' && run >= n)
+            return 0;
+
+        if (c == ch)
+            run++;
+        else
+            run = 0;
+    }
+}
+
+/*
+ * Skip a construct which begins "<!"
+ *
+ * Return: 0 on success, -1 at the end of the document
+ */
+
+static int skip_declaration(struct parser *p)
+{
+    int c, depth;
+
+    c = next(p);
+    if (c == '-')
+        return skip_to(p, '-', 2); /* comment */
+    if (c == '[')
+        return skip_to(p, ']', 2); /* CDATA */
+
+    /* Document type, which may have an internal subset */
+
+    depth = 0;
+
+    while (c != '>' || depth > 0) {
+        if (c == EOF)
+            return -1;
+        if (c == '[')
+            depth++;
+        if (c == ']')
+            depth--;
+
+        c = next(p);
+    }
+
+    return 0;
+}
+
+/*
+ * Read a tag up to its closing '>', into the buffer
+ *
+ * Return: 0 on success, -1 on error
+ * Post: on success, tag is a string without the enclosing brackets
+ */
+
+static int read_tag(struct parser *p, int c)
+{
+    int quote;
+
+    p->len = 0;
+    quote = 0;
+
+    while (c != '>' || quote != 0) {
+        if (c == EOF) {
+            error(p, "Unexpected end of file");
+            return -1;
+        }
+
+        if (quote == 0 && (c == '"' || c == '\''))
+            quote = c;
+        else if (c == quote)
+            quote = 0;
+
+        if (p->len + 1 >= p->size) {
+            size_t size;
+            char *tag;
+
+            if (p->size >= MAX_TAG) {
+                error(p, "Tag is too long");
+                return -1;
+            }
+
+            size = p->size ? p->size * 2 : 1024;
+            tag = realloc(p->tag, size);
+            if (tag == NULL) {
+                perror("realloc");
+                return -1;
+            }
+
+            p->tag = tag;
+            p->size = size;
+        }
+
+        p->tag[p->len++] = c;
+        c = next(p);
+    }
+
+    p->tag[p->len] = '\0';
+    return 0;
+}
+
+/*
+ * Encode a character as UTF-8
+ *
+ * Return: pointer to the end of the encoded character
+ */
+
+static char* utf8(char *out, unsigned long c)
+{
+    if (c < 0x80) {
+        *out++ = c;
+    } else if (c < 0x800) {
+        *out++ = 0xc0 | (c >> 6);
+        *out++ = 0x80 | (c & 0x3f);
+    } else if (c < 0x10000) {
+        *out++ = 0xe0 | (c >> 12);
+        *out++ = 0x80 | ((c >> 6) & 0x3f);
+        *out++ = 0x80 | (c & 0x3f);
+    } else {
+        *out++ = 0xf0 | (c >> 18);
+        *out++ = 0x80 | ((c >> 12) & 0x3f);
+        *out++ = 0x80 | ((c >> 6) & 0x3f);
+        *out++ = 0x80 | (c & 0x3f);
+    }
+
+    return out;
+}
+
+/*
+ * Replace the references to entities and characters in a string
+ *
+ * The result is never longer than the original, so it is done in
+ * place. An unknown reference is left as it is.
+ */
+
+static void decode(char *s)
+{
+    static const struct {
+        const char *name;
+        char c;
+    } entity[] = {
+        { "amp;", '&' },
+        { "lt;", '<' },
+        { "gt;", '>' },
+        { "quot;", '"' },
+        { "apos;", '\'' },
+    };
+
+    char *out;
+
+    s = strchr(s, '&');
+    if (s == NULL)
+        return;
+
+    out = s;
+
+    while (*s != '\0') {
+        size_t n;
+
+        if (*s != '&') {
+            *out++ = *s++;
+            continue;
+        }
+
+        if (s[1] == '#') {
+            unsigned long c;
+            char *end;
+
+            errno = 0;
+            if (s[2] == 'x')
+                c = strtoul(s + 3, &end, 16);
+            else
+                c = strtoul(s + 2, &end, 10);
+
+            if (errno == 0 && *end == ';' && end > s + 2
+                && c > 0 && c <= 0x10ffff)
+            {
+                out = utf8(out, c);
+                s = end + 1;
+                continue;
+            }
+        }
+
+        for (n = 0; n < ARRAY_SIZE(entity); n++) {
+            size_t len;
+
+            len = strlen(entity[n].name);
+            if (strncmp(s + 1, entity[n].name, len) == 0) {
+                *out++ = entity[n].c;
+                s += len + 1;
+                break;
+            }
+        }
+
+        if (n == ARRAY_SIZE(entity))
+            *out++ = *s++;
+    }
+
+    *out = '\0';
+}
+
+/*
+ * Split the attributes of a start tag into names and values
+ *
+ * Attributes beyond the maximum are ignored.
+ *
+ * Return: 0 on success, or -1 if the tag is malformed
+ * Post: on success, attr is a NULL-terminated list
+ */
+
+static int split_attrs(struct parser *p, char *s, char *attr[], size_t len)
+{
+    size_t n;
+
+    n = 0;
+
+    for (;;) {
+        char *name, *value, quote;
+
+        while (is_space(*s))
+            s++;
+        if (*s == '\0')
+            break;
+
+        name = s;
+        while (*s != '=' && *s != '\0' && !is_space(*s))
+            s++;
+        while (is_space(*s))
+            *s++ = '\0';
+        if (*s != '=')
+            goto malformed;
+        *s++ = '\0';
+
+        while (is_space(*s))
+            s++;
+        quote = *s++;
+        if (quote != '"' && quote != '\'')
+            goto malformed;
+
+        value = s;
+        s = strchr(s, quote);
+        if (s == NULL)
+            goto malformed;
+        *s++ = '\0';
+
+        decode(value);
+
+        if (n + 2 < len) {
+            attr[n++] = name;
+            attr[n++] = value;
+        }
+    }
+
+    attr[n] = NULL;
+    return 0;
+
+malformed:
+    error(p, "Malformed attribute");
+    return -1;
+}
+
+/*
+ * Report a tag to the handler
+ *
+ * Return: 0 on success, -1 on error
+ */
+
+static int handle_tag(struct parser *p, struct xml_handler *h)
+{
+    char *s, *name, *attr[MAX_ATTRS * 2 + 1];
+    bool empty;
+
+    s = p->tag;
+
+    while (p->len > 0 && is_space(s[p->len - 1]))
+        s[--p->len] = '\0';
+
+    if (s[0] == '/') {
+        name = s + 1;
+        return h->end(h, name);
+    }
+
+    empty = (p->len > 0 && s[p->len - 1] == '/');
+    if (empty)
+        s[--p->len] = '\0';
+
+    name = s;
+    while (*s != '\0' && !is_space(*s))
+        s++;
+    if (*s != '\0')
+        *s++ = '\0';
+
+    if (split_attrs(p, s, attr, ARRAY_SIZE(attr)) == -1)
+        return -1;
+
+    if (h->start(h, name, attr) == -1)
+        return -1;
+
+    if (empty)
+        return h->end(h, name);
+
+    return 0;
+}
+
+/*
+ * Parse an XML document from a file, reporting each element to the
+ * given handler
+ *
+ * Return: 0 on success, or -1 on error or if the handler returns an
+ * error
+ */
+
+int xml_parse(const char *pathname, struct xml_handler *h)
+{
+    struct parser p;
+    int r;
+
+    p.f = fopen(pathname, "r");
+    if (p.f == NULL) {
+        perror(pathname);
+        return -1;
+    }
+
+    p.pathname = pathname;
+    p.line = 1;
+    p.tag = NULL;
+    p.len = 0;
+    p.size = 0;
+
+    r = -1;
+
+    for (;;) {
+        int c;
+
+        c = next(&p);
+        if (c == EOF)
+            break;
+
+        if (c != '<')
+            continue; /* text is not used */
+
+        c = next(&p);
+
+        if (c == '!') {
+            if (skip_declaration(&p) == -1)
+                goto eof;
+        } else if (c == '?') {
+            if (skip_to(&p, '?', 1) == -1)
+                goto eof;
+        } else {
+            if (read_tag(&p, c) == -1)
+                goto done;
+            if (handle_tag(&p, h) == -1)
+                goto done;
+        }
+    }
+
+    if (ferror(p.f)) {
+        perror(pathname);
+        goto done;
+    }
+
+    r = 0;
+    goto done;
+
+eof:
+    error(&p, "Unexpected end of file");
+done:
+    free(p.tag);
+    fclose(p.f);
+    return r;
+}
+
+/*
+ * Return: value of the named attribute, or NULL if not present
+ */
+
+const char* xml_attr(char *attr[], const char *name)
+{
+    size_t n;
+
+    for (n = 0; attr[n] != NULL; n += 2) {
+        if (strcmp(attr[n], name) == 0)
+            return attr[n + 1];
+    }
+
+    return NULL;
+}
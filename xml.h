@@ -0,0 +1,36 @@
+/*
+ * Copyright (C) 2021 Mark Hills <mark@xwax.org>
+ *
+ * This file is part of "xwax".
+ *
+ * "xwax" is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License, version 3 as
+ * published by the Free Software Foundation.
+ *
+ * "xwax" is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#ifndef XML_H
+#define XML_H
+
+/* Receiver of the elements of an XML document, in the order they
+ * appear; a self-closing element is reported as its start and end.
+ * The attributes are a NULL-terminated list of names and values */
+
+struct xml_handler {
+    int (*start)(struct xml_handler *h, const char *name, char *attr[]);
+    int (*end)(struct xml_handler *h, const char *name);
+};
+
+int xml_parse(const char *pathname, struct xml_handler *h);
+const char* xml_attr(char *attr[], const char *name);
+
+#endif
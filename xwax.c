@@ -19,13 +19,16 @@
 
 #include <assert.h>
 #include <locale.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/mman.h> /* mlockall() */
 
+#ifdef WITH_SDL
 #include <SDL.h> /* may override main() */
+#endif
 
 #include "alsa.h"
 #include "controller.h"
@@ -35,10 +38,14 @@
 #include "interface.h"
 #include "jack.h"
 #include "library.h"
+#include "metrics.h"
 #include "oss.h"
+#include "playlist.h"
 #include "realtime.h"
+#include "session.h"
 #include "thread.h"
 #include "rig.h"
+#include "share.h"
 #include "timecoder.h"
 #include "track.h"
 #include "xwax.h"
@@ -68,7 +75,7 @@ static struct controller ctl[2];
 static struct rt rt;
 
 static double speed;
-static bool protect, phono;
+static bool protect, phono, autodetect;
 static const char *importer;
 static struct timecode_def *timecode;
 
@@ -81,6 +88,10 @@ static void usage(FILE *fd)
       "  -q <n>         Real-time priority (0 for no priority, default %d)\n"
       "  -g <s>         Set display geometry (see man page)\n"
       "  --no-decor     Request a window with no decorations\n"
+      "  --share <name> Export state for other processes (see man page)\n"
+      "  --headless     No interface; control through --share only\n"
+      "  --metrics <p>  Write metrics to the file <p> every second\n"
+      "  --session <p>  Restore decks from the file <p>, and save them to it\n"
       "  -h             Display this message to stdout and exit\n\n",
       DEFAULT_PRIORITY);
 
@@ -136,7 +147,8 @@ static void usage(FILE *fd)
       "  serato_2a (default), serato_2b, serato_cd,\n"
       "  pioneer_a, pioneer_b,\n"
       "  traktor_a, traktor_b,\n"
-      "  mixvibes_v2, mixvibes_7inch\n\n"
+      "  mixvibes_v2, mixvibes_7inch,\n"
+      "  auto (detect from the signal)\n\n"
       "See the xwax(1) man page for full information and examples.\n");
 }
 
@@ -168,10 +180,13 @@ static int commit_deck(void)
 
     d = &deck[ndeck];
 
-    r = deck_init(d, &rt, timecode, importer, speed, phono, protect);
+    r = deck_init(d, &rt, timecode, autodetect, importer, speed, phono,
+                  protect);
     if (r == -1)
         return -1;
 
+    player_add_metrics(&d->player, ndeck);
+
     /* Connect this deck to available controllers */
 
     for (n = 0; n < nctl; n++)
@@ -182,12 +197,42 @@ static int commit_deck(void)
     return 0;
 }
 
+static void quit(int signum)
+{
+    (void)rig_quit();
+}
+
+/*
+ * Exit cleanly on an interrupt, as the interface would when its
+ * window is closed
+ *
+ * Return: 0 on success, otherwise -1
+ */
+
+static int quit_on_signal(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = quit;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(SIGINT, &sa, NULL) == -1
+        || sigaction(SIGTERM, &sa, NULL) == -1)
+    {
+        perror("sigaction");
+        return -1;
+    }
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     int rc = -1, n, priority;
-    const char *scanner, *geo;
+    const char *scanner, *geo, *share, *metrics, *session;
     char *endptr;
-    bool use_mlock, decor;
+    bool use_mlock, decor, headless;
 
     struct library library;
 
@@ -222,6 +267,7 @@ int main(int argc, char *argv[])
         return -1;
     if (library_global_init() == -1)
         return -1;
+    metrics_global_init();
 
     if (rig_init() == -1)
         return -1;
@@ -231,11 +277,20 @@ int main(int argc, char *argv[])
     ndeck = 0;
     geo = "";
     decor = true;
+    share = NULL;
+    metrics = NULL;
+    session = NULL;
+#ifdef WITH_SDL
+    headless = false;
+#else
+    headless = true;
+#endif
     nctl = 0;
     priority = DEFAULT_PRIORITY;
     importer = DEFAULT_IMPORTER;
     scanner = DEFAULT_SCANNER;
     timecode = NULL;
+    autodetect = false;
     speed = 1.0;
     protect = false;
     phono = false;
@@ -433,10 +488,15 @@ int main(int argc, char *argv[])
                 return -1;
             }
 
-            timecode = timecoder_find_definition(argv[1]);
-            if (timecode == NULL) {
-                fprintf(stderr, "Timecode '%s' is not known.\n", argv[1]);
-                return -1;
+            if (!strcmp(argv[1], "auto")) {
+                autodetect = true;
+            } else {
+                timecode = timecoder_find_definition(argv[1]);
+                if (timecode == NULL) {
+                    fprintf(stderr, "Timecode '%s' is not known.\n", argv[1]);
+                    return -1;
+                }
+                autodetect = false;
             }
 
             argv += 2;
@@ -533,6 +593,49 @@ int main(int argc, char *argv[])
             argv++;
             argc--;
 
+        } else if (!strcmp(argv[0], "--share")) {
+
+            if (argc < 2) {
+                fprintf(stderr, "--share requires a name.\n");
+                return -1;
+            }
+
+            share = argv[1];
+
+            argv += 2;
+            argc -= 2;
+
+        } else if (!strcmp(argv[0], "--metrics")) {
+
+            if (argc < 2) {
+                fprintf(stderr, "--metrics requires a pathname.\n");
+                return -1;
+            }
+
+            metrics = argv[1];
+
+            argv += 2;
+            argc -= 2;
+
+        } else if (!strcmp(argv[0], "--session")) {
+
+            if (argc < 2) {
+                fprintf(stderr, "--session requires a pathname.\n");
+                return -1;
+            }
+
+            session = argv[1];
+
+            argv += 2;
+            argc -= 2;
+
+        } else if (!strcmp(argv[0], "--headless")) {
+
+            headless = true;
+
+            argv++;
+            argc--;
+
         } else if (!strcmp(argv[0], "-i")) {
 
             /* Importer script for subsequent decks */
@@ -572,8 +675,13 @@ int main(int argc, char *argv[])
                 return -1;
             }
 
-            if (library_import(&library, scanner, argv[1]) == -1)
-                return -1;
+            if (playlist_is_known(argv[1])) {
+                if (playlist_import(&library, argv[1]) == -1)
+                    return -1;
+            } else {
+                if (library_import(&library, scanner, argv[1]) == -1)
+                    return -1;
+            }
 
             argv += 2;
             argc -= 2;
@@ -620,6 +728,18 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    if (headless && share == NULL) {
+        fprintf(stderr, "With no interface, xwax must be controlled "
+                "using --share; try -h.\n");
+        return -1;
+    }
+
+    /* Restore before the realtime thread is running, as it changes
+     * the decks without locks */
+
+    if (session != NULL && session_restore(&library, session) == -1)
+        return -1;
+
     rc = EXIT_FAILURE; /* until clean exit */
 
     /* Order is important: launch realtime thread first, then mlock.
@@ -633,17 +753,46 @@ int main(int argc, char *argv[])
         goto out_rt;
     }
 
-    if (interface_start(&library, geo, decor) == -1)
+#ifdef WITH_SDL
+    if (!headless && interface_start(&library, geo, decor) == -1)
         goto out_rt;
+#else
+    (void)geo;
+    (void)decor;
+#endif
 
-    if (rig_main() == -1)
+    if (headless && quit_on_signal() == -1)
+        goto out_rt;
+
+    if (share != NULL && share_start(&library, share) == -1)
         goto out_interface;
 
+    if (metrics != NULL && metrics_start(metrics) == -1)
+        goto out_share;
+
+    if (session != NULL && session_start(session) == -1)
+        goto out_metrics;
+
+    if (rig_main() == -1)
+        goto out_session;
+
     rc = EXIT_SUCCESS;
     fprintf(stderr, "Exiting cleanly...\n");
 
+out_session:
+    if (session != NULL)
+        session_stop();
+out_metrics:
+    if (metrics != NULL)
+        metrics_stop();
+out_share:
+    if (share != NULL)
+        share_stop();
 out_interface:
-    interface_stop();
+#ifdef WITH_SDL
+    if (!headless)
+        interface_stop();
+#endif
 out_rt:
     rt_stop(&rt);
 
@@ -658,6 +807,7 @@ out_rt:
     rt_clear(&rt);
     rig_clear();
     library_global_clear();
+    metrics_global_clear();
     thread_global_clear();
 
     if (rc == EXIT_SUCCESS)